@@ -18,6 +18,7 @@
 #include <Rinternals.h>
 #include "c4photo.h"
 #include "BioCro.h"
+#include "solver_stats.h"
 
 
 /* Light Macro Environment */
@@ -169,6 +170,120 @@ void LNprof(double LeafN, double LAI, int nlayers, double kpLN, double* leafN_pr
     }
 }
 
+/* Canopy layers at the nodes of Gauss-Legendre quadrature over cumulative
+ * LAI. depth[i] is the LAI above node i, from the top, and thickness[i] its
+ * weight, the leaf area the node stands for; the weights add up to LAI. A
+ * sum over the nodes is exact for polynomials in depth of degree up to
+ * 2 * nlayers - 1, so a few nodes integrate the smooth profiles of the
+ * canopy as well as many uniform layers. */
+void gauss_layers(double LAI, int nlayers, double* depth, double* thickness)
+{
+    int i, j, m = (nlayers + 1) / 2;
+    double x, dx, p0, p1, p2, dp;
+
+    for(i = 0; i < m; i++)
+    {
+        /* Newton's method on the Legendre polynomial of degree nlayers,
+           from the usual estimate of its root */
+        x = cos(M_PI * (i + 0.75) / (nlayers + 0.5));
+        do {
+            p1 = 1.0;
+            p2 = 0.0;
+            for(j = 1; j <= nlayers; j++)
+            {
+                p0 = p1;
+                p1 = ((2.0 * j - 1.0) * x * p0 - (j - 1.0) * p2) / j;
+                p2 = p0;
+            }
+            dp = nlayers * (x * p1 - p2) / (x * x - 1.0);
+            dx = p1 / dp;
+            x -= dx;
+        } while(fabs(dx) > 1e-15);
+
+        /* Nodes from [-1, 1] to [0, LAI], symmetric about LAI / 2 */
+        depth[i] = LAI * (1.0 - x) / 2.0;
+        depth[nlayers - 1 - i] = LAI * (1.0 + x) / 2.0;
+        thickness[i] = thickness[nlayers - 1 - i] = LAI / ((1.0 - x * x) * dp * dp);
+    }
+}
+
+/* sunML, RHprof, WINDprof and LNprof at the given depths instead of at
+ * uniform layers. The sunlit fraction is that at the depth itself rather
+ * than its average over a layer, and thickness only sets the light a layer
+ * intercepts. */
+struct Light_profile sunML_at(double Idir, double Idiff, double LAI, int nlayers,
+        const double* depth, const double* thickness,
+        double cosTheta, double kd, double chil, double heightf)
+{
+    struct Light_profile light_profile;
+    int i;
+    double k0, k1, k;
+    double CumLAI, LAIi;
+    double Isolar, Idiffuse, Ibeam, Iscat, Iaverage, alphascatter;
+    double Fsun, Fshade;
+    alphascatter = 0.8;
+    k0 = sqrt(pow(chil ,2) + pow(tan(acos(cosTheta)),2));
+    k1 = chil + 1.744*pow((chil+1.183),-0.733);
+    k = k0/k1;
+    if(k < 0)
+        k = -k;
+
+    for(i = 0; i < nlayers; i++)
+    {
+        CumLAI = depth[i];
+        LAIi = thickness[i];
+
+        Ibeam=Idir*cosTheta;
+        Iscat = Ibeam * exp(-k *sqrt(alphascatter)* CumLAI)-Ibeam * exp(-k * CumLAI);
+
+        Isolar = Ibeam*k;
+        Idiffuse = Idiff * exp(-kd * CumLAI) + Iscat;
+
+        Fsun = exp(-k*CumLAI);
+        Fshade = 1 - Fsun;
+        Iaverage = (Fsun*(Isolar + Idiffuse) + Fshade*Idiffuse) * (1-exp(-k*LAIi))/k;
+
+        light_profile.direct_irradiance[i] = Isolar + Idiffuse;
+        light_profile.diffuse_irradiance[i]= Idiffuse;
+        light_profile.total_irradiance[i] = Iaverage;
+        light_profile.sunlit_fraction[i] = Fsun;
+        light_profile.shaded_fraction[i] = Fshade;
+        light_profile.height[i] = LAI/heightf - CumLAI/heightf;
+    }
+    return(light_profile);
+}
+
+void RHprof_at(double RH, double LAI, int nlayers, const double* depth, double* relative_humidity_profile)
+{
+    int i;
+    const double kh = 1 - RH;
+    double temp_rh;
+
+    for(i = 0; i < nlayers; i++)
+    {
+        temp_rh = LAI > 0 ? RH * exp(kh * (depth[i] / LAI)) : RH;
+        if(temp_rh > 1) temp_rh = 0.99;
+        relative_humidity_profile[i] = temp_rh;
+    }
+}
+
+void WINDprof_at(double WindSpeed, int nlayers, const double* depth, double* wind_speed_profile)
+{
+    int i;
+    const double k = 0.7;
+
+    for(i = 0; i < nlayers; i++)
+        wind_speed_profile[i] = WindSpeed * exp(-k * depth[i]);
+}
+
+void LNprof_at(double LeafN, int nlayers, const double* depth, double kpLN, double* leafN_profile)
+{
+    int i;
+
+    for(i = 0; i < nlayers; i++)
+        leafN_profile[i] = LeafN * exp(-kpLN * depth[i]);
+}
+
 double TempToDdryA(double Temp)
 {
     double DdryA;
@@ -563,6 +678,8 @@ struct ET_Str EvapoTrans2(double Rad,
             ChangeInLeafTemp = -ChangeInLeafTemp;
         Counter++;
     }
+    SOLVER_STATS(solver_stats_record(SOLVER_EVAPOTRANS2, Counter, ChangeInLeafTemp <= 0.5, ChangeInLeafTemp,
+                                     (double[]){Rad, Iave, Airtemperature, RH, WindSpeed, stomatacond}));
 
     /* Net radiation */
     PhiN = Ja - rlc;
@@ -919,15 +1036,17 @@ struct ws_str watstr(double precipit, double evapo, double cws, double soildepth
 
 /* Function to simulate the multilayer behavior of soil water. In the
    future this could be coupled with Campbell (BASIC) ideas to
-   esitmate water potential. */
-struct soilML_str soilML(double precipit, double transp, double *cws, double soildepth, double *depths,
+   esitmate water potential. The water content of the first layers
+   layers of soil is updated in place, and the other results are stored
+   in it. */
+void soilML(struct soil_column *soil, double precipit, double transp, double soildepth, double *depths,
         double fieldc, double wiltp, double phi1, double phi2, struct soilText_str soTexS, int wsFun,
         int layers, double rootDB, double LAI, double k, double AirTemp, double IRad, double winds,
         double RelH, int hydrDist, double rfl, double rsec, double rsdf)
 {
 
-    struct rd_str root_distribution;
-    struct soilML_str tmp;
+    const double *root_fraction;
+    double *cws = soil->cws;
     /* Constant */
     /* const double G = 6.67428e-11;  m3 / (kg * s-2)  ##  http://en.wikipedia.org/wiki/Gravitational_constant */
     const double g = 9.8; /* m / s-2  ##  http://en.wikipedia.org/wiki/Standard_gravity */
@@ -948,6 +1067,7 @@ struct soilML_str soilML(double precipit, double transp, double *cws, double soi
     double EvapoTra = 0.0, oldEvapoTra = 0.0, Sevap = 0.0, Ctransp = 0.0;
     double psim1 = 0.0, psim2 = 0.0, K_psim = 0.0, J_w = 0.0, dPsim = 0.0;
     double theta_s; /* This is the saturated soil water content. Larger than FieldC.*/
+    const struct campbell_table *campbell = NULL;
     int i;
     int j = layers - 1; 
 
@@ -961,12 +1081,17 @@ struct soilML_str soilML(double precipit, double transp, double *cws, double soi
     }
 
     theta_s = soTexS.satur;
+    if(hydrDist > 0)
+        campbell = soil_campbell_table(soil, soTexS);
     /* rooting depth */
     /* Crude empirical relationship between root biomass and rooting depth*/
     rootDepth = rootDB * rsdf;
     if(rootDepth > soildepth) rootDepth = soildepth;
 
-    root_distribution = rootDist(layers,rootDepth,&depths[0],rfl);
+    root_fraction = soil_root_fractions(soil, rootDepth, depths, rfl);
+
+    if(hydrDist == 2)
+        richards_redistribute(soil, depths, soTexS, &drainage);
 
     /* unit conversion for precip */
     waterIn = precipit * 1e-3; /* convert precip in mm to m*/
@@ -983,18 +1108,20 @@ struct soilML_str soilML(double precipit, double transp, double *cws, double soi
         }
 
 
-        if(hydrDist > 0) {
+        if(hydrDist == 2) {
+            /* Already moved by richards_redistribute */
+            J_w = soil->hourlyWflux[i];
+        } else if(hydrDist > 0) {
             /* For this section see Campbell and Norman "Environmental BioPhysics" Chapter 9*/
             /* First compute the matric potential */
-            psim1 = soTexS.air_entry * pow((cws[i]/theta_s),-soTexS.b); /* This is matric potential of current layer */
+            campbell_curves(campbell, soTexS, cws[i], &psim1, &K_psim); /* This is matric potential and hydraulic conductivity of current layer */
             if(i > 0) {
-                psim2 = soTexS.air_entry * pow((cws[i-1]/theta_s),-soTexS.b); /* This is matric potential of next layer */
+                psim2 = campbell_psim(campbell, soTexS, cws[i-1]); /* This is matric potential of next layer */
                 dPsim = psim1 - psim2;
                 /* The substraction is from the layer i - (i-1). If this last term is positive then it will move upwards. If it is negative it will move downwards. Presumably this term is almost always positive. */
             } else {
                 dPsim = 0;
             }
-            K_psim = soTexS.Ks * pow((soTexS.air_entry/psim1),2+3/soTexS.b); /* This is hydraulic conductivity */
             J_w = K_psim * (dPsim/layerDepth) - g * K_psim; /*  Campbell, pg 129 do not ignore the graviational effect*/
             /* Notice that K_psim is positive because my
                reference system is reversed */
@@ -1043,8 +1170,8 @@ struct soilML_str soilML(double precipit, double transp, double *cws, double soi
         }
 
         /* Root Biomass */
-        rootATdepth = rootDB * root_distribution.rootDist[i];
-        tmp.rootDist[i] = rootATdepth;
+        rootATdepth = rootDB * root_fraction[i];
+        soil->rootDist[i] = rootATdepth;
         /* Plant available water is only between current water status and permanent wilting point */
         /* Plant available water */
         paw = aw - wiltp * layerDepth;
@@ -1058,13 +1185,13 @@ struct soilML_str soilML(double precipit, double transp, double *cws, double soi
             /* I assume that crop transpiration is distributed simlarly to
                root density.  In other words the crop takes up water proportionally
                to the amount of root in each respective layer.*/
-            Ctransp = transp*root_distribution.rootDist[0];
+            Ctransp = transp*root_fraction[0];
             EvapoTra = Ctransp + Sevap;
             Newpawha = (paw * 1e4) - EvapoTra / 0.9982; /* See the watstr function for this last number 0.9882 */
             /* The first term in the rhs (paw * 1e4) is the m3 of water available in this layer.
                EvapoTra is the Mg H2O ha-1 of transpired and evaporated water. 1/0.9882 converts from Mg to m3 */
         } else {
-            Ctransp = transp*root_distribution.rootDist[i];
+            Ctransp = transp*root_fraction[i];
             EvapoTra = Ctransp;
             Newpawha = (paw * 1e4) - (EvapoTra + oldEvapoTra);
         }
@@ -1079,8 +1206,8 @@ struct soilML_str soilML(double precipit, double transp, double *cws, double soi
         awc = paw / layerDepth + wiltp;   
 
         /* This might look like a weird place to populate the structure, but is more convenient*/
-        tmp.cws[i] = awc;
-        tmp.hourlyWflux[i] =J_w;
+        cws[i] = awc;
+        soil->hourlyWflux[i] =J_w;
         if(wsFun == 0) {
             slp = 1/(fieldc - wiltp);
             intcpt = 1 - fieldc * slp;
@@ -1121,14 +1248,11 @@ struct soilML_str soilML(double precipit, double transp, double *cws, double soi
     if(wsPhoto > 1) wsPhoto = 1;
     if(wsSpleaf > 1) wsSpleaf = 1;
 
-    /* returning the structure */
-    tmp.rcoefPhoto = (wsPhotoCol/layers);
-    tmp.drainage = drainage;
-    tmp.Nleach = Nleach;
-    tmp.rcoefSpleaf = (wsSpleafCol/layers);
-    tmp.SoilEvapo = Sevap;
-
-    return(tmp);
+    soil->rcoefPhoto = (wsPhotoCol/layers);
+    soil->drainage = drainage;
+    soil->Nleach = Nleach;
+    soil->rcoefSpleaf = (wsSpleafCol/layers);
+    soil->SoilEvapo = Sevap;
 }
 
 /* Respiration. It is assumed that some of the energy produced by the
@@ -1225,15 +1349,15 @@ struct seqRD_str seqRootDepth(double to, int lengthOut ) {
 }
 
 
-struct rd_str rootDist(int layer, double rootDepth, double *depthsp, double rfl)
+/* One more than the number of layers that lie whole above rootDepth. The
+   roots of rootDist reach this many layers, and it is all rootDist
+   depends on rootDepth through. */
+int rootDist_layers(int layer, double rootDepth, double *depthsp)
 {
-    struct rd_str tmp;  
-    int i, j, k;
+    int i;
+    int rootLayers = 1;
     double layerDepth = 0.0;
     double CumLayerDepth = 0.0;
-    double CumRootDist = 1.0;
-    double rootDist[layer];
-    double ca = 0.0, a = 0.0;
 
     for(i=0;i<layer;i++) {
 
@@ -1246,23 +1370,39 @@ struct rd_str rootDist(int layer, double rootDepth, double *depthsp, double rfl)
         CumLayerDepth += layerDepth;
 
         if(rootDepth > CumLayerDepth) {
-            CumRootDist++;
+            rootLayers++;
         }
     }
+    return(rootLayers);
+}
+
+/* The fraction of the roots in each layer when they reach rootLayers
+   layers, following a Poisson distribution with lambda rootLayers * rfl */
+void rootDist_fractions(int layer, int rootLayers, double rfl, double *fractions)
+{
+    int j, k;
+    double ca = 0.0, a = 0.0;
 
     for(j=0;j<layer;j++) {
-        if(j < CumRootDist) { 
-            a = dpois(j+1,CumRootDist*rfl,0);
-            rootDist[j] = a;
+        if(j < rootLayers) { 
+            a = dpois(j+1,rootLayers*rfl,0);
+            fractions[j] = a;
             ca += a;
         } else {
-            rootDist[j] = 0;
+            fractions[j] = 0;
         }
     }
 
     for(k=0;k<layer;k++) {
-        tmp.rootDist[k] = rootDist[k] / ca; 
+        fractions[k] = fractions[k] / ca; 
     }
+}
+
+struct rd_str rootDist(int layer, double rootDepth, double *depthsp, double rfl)
+{
+    struct rd_str tmp;  
+
+    rootDist_fractions(layer, rootDist_layers(layer, rootDepth, depthsp), rfl, tmp.rootDist);
     return(tmp);
 }
 
@@ -1440,33 +1580,34 @@ void cropcent_dbp(double coefs[25],double TherPrds[6], double TherTime, struct c
 
 void initialize_biogro_results(struct BioGro_results_str *results, int soil_layers, int vector_size)
 {
-	int i;
-	for (i = 0; i < vector_size; i++) {
-		results->day_of_year[i] = 0;
-		results->hour[i] = 0;
-		results->CanopyAssim[i] = 0;
-		results->canopy_transpiration[i] = 0;
-		results->Leafy[i] = 0;
-		results->Stemy[i] = 0;
-		results->Rooty[i] = 0;
-		results->Rhizomey[i] = 0;
-		results->Grainy[i] = 0;
-		results->LAIc[i] = 0;
-		results->thermal_time[i] = 0;
-		results->soil_water_content[i] = 0;
-		results->stomata_cond_coefs[i] = 0;
-		results->leaf_reduction_coefs[i] = 0;
-		results->leaf_nitrogen[i] = 0;
-		results->above_ground_litter[i] = 0;
-		results->below_ground_litter[i] = 0;
-		results->vmax[i] = 0;
-		results->alpha[i] = 0;
-		results->specific_leaf_area[i] = 0;
-		results->min_nitro[i] = 0;
-		results->respiration[i] = 0;
-		results->soil_evaporation[i] = 0;
-		results->leaf_psim[i] = 0;
-	}
+	results->vector_size = vector_size;
+	results->soil_layers = soil_layers;
+
+	results->day_of_year = (double*)calloc(vector_size, sizeof(double));
+	results->hour = (double*)calloc(vector_size, sizeof(double));
+	results->CanopyAssim = (double*)calloc(vector_size, sizeof(double));
+	results->canopy_transpiration = (double*)calloc(vector_size, sizeof(double));
+	results->Leafy = (double*)calloc(vector_size, sizeof(double));
+	results->Stemy = (double*)calloc(vector_size, sizeof(double));
+	results->Rooty = (double*)calloc(vector_size, sizeof(double));
+	results->Rhizomey = (double*)calloc(vector_size, sizeof(double));
+	results->Grainy = (double*)calloc(vector_size, sizeof(double));
+	results->LAIc = (double*)calloc(vector_size, sizeof(double));
+	results->thermal_time = (double*)calloc(vector_size, sizeof(double));
+	results->soil_water_content = (double*)calloc(vector_size, sizeof(double));
+	results->stomata_cond_coefs = (double*)calloc(vector_size, sizeof(double));
+	results->leaf_reduction_coefs = (double*)calloc(vector_size, sizeof(double));
+	results->leaf_nitrogen = (double*)calloc(vector_size, sizeof(double));
+	results->above_ground_litter = (double*)calloc(vector_size, sizeof(double));
+	results->below_ground_litter = (double*)calloc(vector_size, sizeof(double));
+	results->vmax = (double*)calloc(vector_size, sizeof(double));
+	results->alpha = (double*)calloc(vector_size, sizeof(double));
+	results->specific_leaf_area = (double*)calloc(vector_size, sizeof(double));
+	results->min_nitro = (double*)calloc(vector_size, sizeof(double));
+	results->respiration = (double*)calloc(vector_size, sizeof(double));
+	results->soil_evaporation = (double*)calloc(vector_size, sizeof(double));
+	results->leaf_psim = (double*)calloc(vector_size, sizeof(double));
+
 	results->psim = (double*)calloc(soil_layers * vector_size, sizeof(double));
 	results->water_status = (double*)calloc(soil_layers * vector_size, sizeof(double));
 	results->root_distribution = (double*)calloc(soil_layers * vector_size, sizeof(double));
@@ -1474,11 +1615,92 @@ void initialize_biogro_results(struct BioGro_results_str *results, int soil_laye
 
 void free_biogro_results(struct BioGro_results_str *results)
 {
+	free(results->day_of_year);
+	free(results->hour);
+	free(results->CanopyAssim);
+	free(results->canopy_transpiration);
+	free(results->Leafy);
+	free(results->Stemy);
+	free(results->Rooty);
+	free(results->Rhizomey);
+	free(results->Grainy);
+	free(results->LAIc);
+	free(results->thermal_time);
+	free(results->soil_water_content);
+	free(results->stomata_cond_coefs);
+	free(results->leaf_reduction_coefs);
+	free(results->leaf_nitrogen);
+	free(results->above_ground_litter);
+	free(results->below_ground_litter);
+	free(results->vmax);
+	free(results->alpha);
+	free(results->specific_leaf_area);
+	free(results->min_nitro);
+	free(results->respiration);
+	free(results->soil_evaporation);
+	free(results->leaf_psim);
 	free(results->psim);
 	free(results->water_status);
 	free(results->root_distribution);
+
+	results->day_of_year = NULL;
+	results->hour = NULL;
+	results->CanopyAssim = NULL;
+	results->canopy_transpiration = NULL;
+	results->Leafy = NULL;
+	results->Stemy = NULL;
+	results->Rooty = NULL;
+	results->Rhizomey = NULL;
+	results->Grainy = NULL;
+	results->LAIc = NULL;
+	results->thermal_time = NULL;
+	results->soil_water_content = NULL;
+	results->stomata_cond_coefs = NULL;
+	results->leaf_reduction_coefs = NULL;
+	results->leaf_nitrogen = NULL;
+	results->above_ground_litter = NULL;
+	results->below_ground_litter = NULL;
+	results->vmax = NULL;
+	results->alpha = NULL;
+	results->specific_leaf_area = NULL;
+	results->min_nitro = NULL;
+	results->respiration = NULL;
+	results->soil_evaporation = NULL;
+	results->leaf_psim = NULL;
 	results->psim = NULL;
 	results->water_status = NULL;
 	results->root_distribution = NULL;
 }
 
+void initialize_biogro_workspace(struct BioGro_workspace *workspace, int soil_layers)
+{
+	workspace->soil_layers = soil_layers;
+
+	workspace->psim = (double*)calloc(soil_layers, sizeof(double));
+	workspace->water_status = (double*)calloc(soil_layers, sizeof(double));
+	workspace->root_distribution = (double*)calloc(soil_layers, sizeof(double));
+
+	workspace->defer_warnings = 0;
+	workspace->warnings = 0;
+	workspace->nan_steps = 0;
+	workspace->photo_solves = 0;
+	workspace->photo_iterations = 0;
+	workspace->solar = NULL;
+	workspace->campbell = NULL;
+	workspace->photo_surface = NULL;
+	workspace->canopy = NULL;
+}
+
+void free_biogro_workspace(struct BioGro_workspace *workspace)
+{
+	free(workspace->psim);
+	free(workspace->water_status);
+	free(workspace->root_distribution);
+
+	workspace->psim = NULL;
+	workspace->water_status = NULL;
+	workspace->root_distribution = NULL;
+
+	c4_surface_free(workspace->photo_surface);
+	workspace->photo_surface = NULL;
+}
@@ -35,6 +35,18 @@ struct Can_Str {
   double Assim;
   double Trans;
   double GrossAssim;
+  int photo_solves;     /* leaf photosynthesis solves that iterated */
+  int photo_iterations; /* passes of the Ci iteration over those solves */
+};
+
+/* Intercellular CO2 and assimilation of the sunlit and shaded leaves of
+   the last canopy solved, sunlit leaves of the layers first. CanAC and
+   c3CanAC start the next hour from them when leaves matches the canopy;
+   leaves is 0 before the first hour. */
+struct canopy_start {
+  int leaves;
+  double Ci[2 * MAXLAY];
+  double Assim[2 * MAXLAY];
 };
 
 struct ws_str {
@@ -47,6 +59,40 @@ struct ws_str {
 
 };
 
+/* The water of a column of soil layers, kept from one step to the next,
+   with what soilML and soilML_rootfront compute for it, which they update
+   in place. The arrays have one element for each of layers layers. See
+   soil_column.c. */
+struct soil_column {
+  int layers;
+  double *cws;         /* water content of each layer */
+  double *rootDist;    /* root biomass in each layer */
+  double *hourlyWflux; /* flow out of each layer in the last step */
+  double rcoefPhoto;
+  double rcoefSpleaf;
+  double drainage;
+  double Nleach;
+  double SoilEvapo;
+  /* The fraction of the roots in each layer, kept for as long as the
+     roots reach the same number of layers, see soil_root_fractions */
+  double *rootFraction;
+  int rootLayers;              /* layers rootFraction is for, 0 for none yet */
+  double rootRfl;              /* and the rfl it is for */
+  double rootDistComputations; /* times rootFraction has been computed */
+  /* The Campbell curves of the soil, see soil_campbell_table, unless
+     exactCampbell is set */
+  struct campbell_table *campbell;
+  /* A table of the curves shared with other columns, used instead of
+     campbell when it is for the same soil; not freed with the column */
+  const struct campbell_table *sharedCampbell;
+  int exactCampbell;
+};
+
+void initialize_soil_column(struct soil_column *soil, int layers);
+void free_soil_column(struct soil_column *soil);
+void copy_soil_column(struct soil_column *to, const struct soil_column *from);
+const double *soil_root_fractions(struct soil_column *soil, double rootDepth, double *depths, double rfl);
+
 struct soilML_str {
   double rcoefPhoto;
   double rcoefSpleaf;
@@ -97,6 +143,33 @@ struct soilText_str{
 
 struct soilText_str soilTchoose(int soiltype);
 
+/* The Campbell retention and conductivity curves of one soil at
+   CAMPBELL_NODES water contents from theta_min to saturation, with their
+   slopes, for cubic interpolation. See soil_campbell.c. */
+#define CAMPBELL_NODES 1025
+
+struct campbell_table {
+  double air_entry, b, Ks, satur; /* of the soil the table is for */
+  double theta_min, step;
+  double psim[CAMPBELL_NODES], dpsim[CAMPBELL_NODES];
+  double K[CAMPBELL_NODES], dK[CAMPBELL_NODES];
+  /* The largest relative errors of the interpolation */
+  double error_psim, error_K;
+  double builds;
+};
+
+const struct campbell_table *soil_campbell_table(struct soil_column *soil, struct soilText_str soTexS);
+const struct campbell_table *campbell_table_for(struct soilText_str soTexS);
+void campbell_curves(const struct campbell_table *table, struct soilText_str soTexS, double theta,
+                     double *psim, double *K);
+double campbell_psim(const struct campbell_table *table, struct soilText_str soTexS, double theta);
+
+/* Moves the water of a column between its layers for one hour by the
+   Richards equation, which soilML and soilML_rootfront do when hydrDist
+   is 2. See soil_richards.c. */
+int richards_redistribute(struct soil_column *soil, const double *depths, struct soilText_str soTexS,
+                          double *drainage);
+
 struct seqRD_str{
   double rootDepths[MAXLAY+1];
 };
@@ -107,6 +180,8 @@ struct rd_str{
   double rootDist[MAXLAY];
 };
 
+int rootDist_layers(int layer, double rootDepth, double *depths);
+void rootDist_fractions(int layer, int rootLayers, double rfl, double *fractions);
 struct rd_str rootDist(int layer, double rootDepth, double *depths, double rfl);
 
 struct frostParms {
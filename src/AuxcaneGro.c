@@ -14,13 +14,16 @@
 #include "AuxcaneGro.h"
 #include "c4photo.h"
 
-struct soilML_str soilML_rootfront(double precipit, double transp, double *cws, double soildepth, double *depths,
+/* soilML with the rooting depth given by the root front, which advances
+   at rootfrontvelocity after planting, unless optiontocalculaterootdepth
+   is 1. soil is updated in place as by soilML. */
+void soilML_rootfront(struct soil_column *soil, double precipit, double transp, double soildepth, double *depths,
 		double fieldc, double wiltp, double phi1, double phi2, struct soilText_str soTexS, int wsFun, int layers,
 		double rootDB, double LAI, double k, double AirTemp, double IRad, double winds, double RelH, int hydrDist,
 		double rfl, double rsec, double rsdf,int optiontocalculaterootdepth, double rootfrontvelocity ,double dap)
 {
-	struct rd_str root_distribution;
-	struct soilML_str tmp;
+	const double *root_fraction;
+	double *cws = soil->cws;
 	/* Constant */
 	/* const double G = 6.67428e-11;  m3 / (kg * s-2)  ##  http://en.wikipedia.org/wiki/Gravitational_constant */
 	const double g = 9.8; /* m / s-2  ##  http://en.wikipedia.org/wiki/Standard_gravity */
@@ -40,7 +43,7 @@ struct soilML_str soilML_rootfront(double precipit, double transp, double *cws,
 	double rootATdepth, rootDepth;
 	double EvapoTra = 0.0, oldEvapoTra = 0.0, Sevap = 0.0, Ctransp = 0.0;
 	double psim1 = 0.0, psim2 = 0.0, K_psim = 0.0, J_w = 0.0, dPsim = 0.0;
-	double theta_s = soTexS.satur; /* This is the saturated soil water content. Larger than FieldC.*/
+	const struct campbell_table *campbell = NULL;
 	int i;
 	int j = layers - 1; 
 
@@ -52,6 +55,8 @@ struct soilML_str soilML_rootfront(double precipit, double transp, double *cws,
 	if(wiltp < 0) {
 		wiltp = soTexS.wiltp;
 	}
+	if(hydrDist > 0)
+		campbell = soil_campbell_table(soil, soTexS);
 
 	/* rooting depth */
 	/* Crude empirical relationship between root biomass and rooting depth*/
@@ -63,7 +68,10 @@ struct soilML_str soilML_rootfront(double precipit, double transp, double *cws,
 
 	if(rootDepth > soildepth) rootDepth = soildepth;
 
-	root_distribution = rootDist(layers, rootDepth, &depths[0], rfl);
+	root_fraction = soil_root_fractions(soil, rootDepth, depths, rfl);
+
+	if(hydrDist == 2)
+		richards_redistribute(soil, depths, soTexS, &drainage);
 
 	/* unit conversion for precip */
 	waterIn = precipit * 1e-3; /* convert precip in mm to m*/
@@ -80,18 +88,20 @@ struct soilML_str soilML_rootfront(double precipit, double transp, double *cws,
 		}
 
 
-		if(hydrDist > 0) {
+		if(hydrDist == 2) {
+			/* Already moved by richards_redistribute */
+			J_w = soil->hourlyWflux[i];
+		} else if(hydrDist > 0) {
 			/* For this section see Campbell and Norman "Environmental BioPhysics" Chapter 9*/
 			/* First compute the matric potential */
-			psim1 = soTexS.air_entry * pow((cws[i]/theta_s),-soTexS.b) ; /* This is matric potential of current layer */
+			campbell_curves(campbell, soTexS, cws[i], &psim1, &K_psim); /* This is matric potential and hydraulic conductivity of current layer */
 			if(i > 0) {
-				psim2 = soTexS.air_entry * pow((cws[i-1]/theta_s), -soTexS.b) ; /* This is matric potential of next layer */
+				psim2 = campbell_psim(campbell, soTexS, cws[i-1]); /* This is matric potential of next layer */
 				dPsim = psim1 - psim2;
 				/* The substraction is from the layer i - (i-1). If this last term is positive then it will move upwards. If it is negative it will move downwards. Presumably this term is almost always positive. */
 			} else {
 				dPsim = 0;
 			}
-			K_psim = soTexS.Ks * pow((soTexS.air_entry/psim1), 2+3/soTexS.b); /* This is hydraulic conductivity */
 			J_w = K_psim * (dPsim/layerDepth) - g * K_psim ; /*  Campbell, pg 129 do not ignore the graviational effect*/
 			/* Notice that K_psim is positive because my
 			   reference system is reversed */
@@ -140,8 +150,8 @@ struct soilML_str soilML_rootfront(double precipit, double transp, double *cws,
 		}
 
 		/* Root Biomass */
-		rootATdepth = rootDB * root_distribution.rootDist[i];
-		tmp.rootDist[i] = rootATdepth;
+		rootATdepth = rootDB * root_fraction[i];
+		soil->rootDist[i] = rootATdepth;
 		/* Plant available water is only between current water status and permanent wilting point */
 		/* Plant available water */
 		paw = aw - wiltp * layerDepth;
@@ -155,13 +165,13 @@ struct soilML_str soilML_rootfront(double precipit, double transp, double *cws,
 			/* I assume that crop transpiration is distributed simlarly to
 			   root density.  In other words the crop takes up water proportionally
 			   to the amount of root in each respective layer.*/
-			Ctransp = transp*root_distribution.rootDist[0];
+			Ctransp = transp*root_fraction[0];
 			EvapoTra = Ctransp + Sevap;
 			Newpawha = (paw * 1e4) - EvapoTra / 0.9982; /* See the watstr function for this last number 0.9882 */
 			/* The first term in the rhs (paw * 1e4) is the m3 of water available in this layer.
 			   EvapoTra is the Mg H2O ha-1 of transpired and evaporated water. 1/0.9882 converts from Mg to m3 */
 		} else {
-			Ctransp = transp*root_distribution.rootDist[i];
+			Ctransp = transp*root_fraction[i];
 			EvapoTra = Ctransp;
 			Newpawha = (paw * 1e4) - (EvapoTra + oldEvapoTra);
 		}
@@ -176,7 +186,7 @@ struct soilML_str soilML_rootfront(double precipit, double transp, double *cws,
 		awc = paw / layerDepth + wiltp;   
 
 		/* This might look like a weird place to populate the structure, but is more convenient*/
-		tmp.cws[i] = awc;
+		cws[i] = awc;
 
 		if(wsFun == 0) {
 			slp = 1/(fieldc - wiltp);
@@ -214,14 +224,11 @@ struct soilML_str soilML_rootfront(double precipit, double transp, double *cws,
 	}
 
 
-	/* returning the structure */
-	tmp.rcoefPhoto = (wsPhotoCol/layers);
-	tmp.drainage = drainage;
-	tmp.Nleach = Nleach;
-	tmp.rcoefSpleaf = (wsSpleafCol/layers);
-	tmp.SoilEvapo = Sevap;
-
-	return(tmp);
+	soil->rcoefPhoto = (wsPhotoCol/layers);
+	soil->drainage = drainage;
+	soil->Nleach = Nleach;
+	soil->rcoefSpleaf = (wsSpleafCol/layers);
+	soil->SoilEvapo = Sevap;
 }
 
 
@@ -21,7 +21,7 @@ struct dbp_sugarcane_str SUGARCANE_DBP_CUADRA(double TT, double TT0, double TTse
 
 double seasonal (double maxLN, double minLN, double day, double daymaxLN, double dayinyear, double lat);
 
-struct soilML_str soilML_rootfront(double precipit, double transp, double *cws, double soildepth, double *depths,
+void soilML_rootfront(struct soil_column *soil, double precipit, double transp, double soildepth, double *depths,
         double fieldc, double wiltp, double phi1, double phi2, struct soilText_str soTexS, int wsFun, int layers,
         double rootDB, double LAI, double k, double AirTemp, double IRad, double winds, double RelH, int hydrDist,
         double rfl, double rsec, double rsdf, int optiontocalculaterootdepth, double rootfrontvelocity , double dap);
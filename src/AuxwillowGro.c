@@ -11,6 +11,7 @@
 #include "AuxwillowGro.h"
 #include "c3canopy.h"
 #include "c3EvapoTrans.h"
+#include "leaf_coupled.h"
 
 void createCanopy (struct canopy *canopy, int Nlayers, double LAItotal)
 {
@@ -20,15 +21,41 @@ void createCanopy (struct canopy *canopy, int Nlayers, double LAItotal)
    * allocate memory based on number of layers
    * initialize all the components of canopy structure
    * ***********************************************/
+  allocateCanopy(canopy, Nlayers);
+  resetCanopy(canopy, Nlayers, LAItotal);
+  return;
+}
+
+void allocateCanopy (struct canopy *canopy, int MaxLayers)
+{
+  /**********************************************
+   * Purpose:
+   * allocate memory for a canopy of up to MaxLayers layers,
+   * to be reused by resetCanopy for every step of a run
+   * ***********************************************/
+  canopy->MaxLayers=MaxLayers;
+  canopy->Nlayers=0;
+  canopy->ENV =  (struct canopyEnv*)malloc((MaxLayers+1)*sizeof(*canopy->ENV));
+  canopy->Leaf = (struct canopyLeaf*)malloc((MaxLayers+1)*sizeof(*canopy->Leaf));
+  canopy->OUT = (struct canopyoutput*)malloc((MaxLayers+1)*sizeof(*canopy->OUT));
+  return;
+}
+
+void resetCanopy (struct canopy *canopy, int Nlayers, double LAItotal)
+{
+  /**********************************************
+   * Purpose:
+   * initialize all the components of an allocated canopy
+   * structure in place, without allocating memory
+   * ***********************************************/
   int i;
+  if(Nlayers > canopy->MaxLayers)
+    error("the canopy has room for %d layers, not %d", canopy->MaxLayers, Nlayers);
   canopy->Nlayers=Nlayers;
   canopy->Idirtop=0.0;
   canopy->Idifftop=0.0;
   canopy->CosZenithAngle =0.0;
   canopy->LAItotal= LAItotal;
-  canopy->ENV =  (struct canopyEnv*)malloc((Nlayers+1)*sizeof(*canopy->ENV));
-  canopy->Leaf = (struct canopyLeaf*)malloc((Nlayers+1)*sizeof(*canopy->Leaf));
-  canopy->OUT = (struct canopyoutput*)malloc((Nlayers+1)*sizeof(*canopy->OUT));
   for (i =0; i<Nlayers; i++)
   {
       canopy->ENV[i].Idir=0.0;
@@ -78,7 +105,7 @@ void discretizeCanopy(struct canopy *canopy)
   return;
 }
 
-void getcanopylightme(struct canopy * canopy, double lat, double DOY, int td, double solarR)
+void getcanopylightme(struct canopy * canopy, const struct solar_table *solar, double lat, double DOY, int td, double solarR)
 {
   
   /***********************************************************************
@@ -88,6 +115,7 @@ void getcanopylightme(struct canopy * canopy, double lat, double DOY, int td, do
    * DOY:- Day of Year
    * td= Time of day
    * solarR :- Incoming Solar Radiation
+   * solar :- Table of lightME at lat, or NULL
    * Output:
    * canopy structure is updated for the following variables
    * Idirtop :- direct light at the top of the canopy
@@ -108,6 +136,18 @@ void getcanopylightme(struct canopy * canopy, double lat, double DOY, int td, do
         const double SolarConstant = 2650;
         const double atmP = 1e5;
 
+        /* lightME only moves the sun when it is less than 0.10 high, and
+           otherwise gives what is computed below */
+        if(solar != NULL && DOY == (int)DOY) {
+                struct Light_model light = solar_light(solar, lat, (int)DOY, td);
+                if(light.cosine_zenith_angle > 0.10) {
+                        canopy->Idirtop = light.irradiance_direct * solarR;
+                        canopy->Idifftop = light.irradiance_diffuse * solarR;
+                        canopy->CosZenithAngle = light.cosine_zenith_angle;
+                        return;
+                }
+        }
+
         omega = lat * DTR;
         delta0 = 360.0 * ((DOY + 10)/365.0);
         delta = -23.5 * cos(delta0*DTR);
@@ -266,6 +306,10 @@ void freecanopy(struct canopy *canopy)
   free(canopy->ENV);
   free(canopy->Leaf);
   free(canopy->OUT);
+  canopy->ENV=NULL;
+  canopy->Leaf=NULL;
+  canopy->OUT=NULL;
+  canopy->MaxLayers=0;
   return;
 }
 
@@ -273,14 +317,15 @@ struct Can_Str newc3CanAC(double LAI,int DOY, int hr,double solarR,double Temp,
 	             double RH,double WindSpeed,double lat,int nlayers, double Vmax,double Jmax,
 		     double Rd, double Catm, double o2, double b0, double b1,
                      double theta, double kd, double heightf,
-		     double leafN, double kpLN, double lnb0, double lnb1, int lnfun,double StomWS,int ws)
+		     double leafN, double kpLN, double lnb0, double lnb1, int lnfun,double StomWS,int ws,
+		     int coupled_leaf, const struct solar_table *solar, struct canopy *canopy)
          
 {
 
    struct ET_Str deepaktmp5_ET,deepaktmp6_ET; 
    struct c3_str deepaktmpc3;
    struct c3_str deepaktmpc32;
-   struct Can_Str ans;
+   struct Can_Str ans = {0, 0, 0};
 
 
   const double cf = 3600 * 1e-6 * 30 * 1e-6 * 10000;
@@ -318,57 +363,82 @@ struct Can_Str newc3CanAC(double LAI,int DOY, int hr,double solarR,double Temp,
 	/* 1e-6 converts g to Mg */
 	/* 10000 scales from meter squared to hectare */
 
-  struct canopy ccanopy;
-  createCanopy (&ccanopy,nlayers, LAI);  
-  discretizeCanopy(&ccanopy);
+  /* The canopy is reset in place, so that a run reusing one canopy for
+     every hour does not allocate; without one a canopy is made here */
+  struct canopy local_canopy;
+  struct canopy *ccanopy = canopy;
+  if(ccanopy == NULL) {
+    ccanopy = &local_canopy;
+    allocateCanopy(ccanopy, nlayers);
+  }
+  resetCanopy(ccanopy, nlayers, LAI);
+  discretizeCanopy(ccanopy);
   
-  getcanopylightme(&ccanopy,lat, DOY,hr,solarR);
-  getCanopysunML(&ccanopy,kd,chil,heightf);
-  getcanopyRHprof(&ccanopy, RH);
-  getcanopyWINDprofile(&ccanopy,WindSpeed);
-  getcanopyLNprof(&ccanopy,leafN,kpLN);
+  getcanopylightme(ccanopy,solar,lat, DOY,hr,solarR);
+  getCanopysunML(ccanopy,kd,chil,heightf);
+  getcanopyRHprof(ccanopy, RH);
+  getcanopyWINDprofile(ccanopy,WindSpeed);
+  getcanopyLNprof(ccanopy,leafN,kpLN);
 
-      for(i=0;i<(ccanopy.Nlayers);i++)
+      for(i=0;i<(ccanopy->Nlayers);i++)
     {
       	    //if(lnfun == 0){
       		    // vmax1 = Vmax; set but not used
       	    //}
             //else{
-      		    // vmax1 = ccanopy.Leaf[i].LeafN * lnb1 + lnb0; set but not used
+      		    // vmax1 = ccanopy->Leaf[i].LeafN * lnb1 + lnb0; set but not used
       	    //} 
      
-	    Leafsun = ccanopy.Leaf[i].LAI *ccanopy.Leaf[i].pLeafsun;
+	    Leafsun = ccanopy->Leaf[i].LAI *ccanopy->Leaf[i].pLeafsun;
    
-      deepaktmp5_ET= c3EvapoTrans(ccanopy.ENV[i].Idir,ccanopy.ENV[i].Itotal,Temp,ccanopy.ENV[i].RH,ccanopy.ENV[i].windspeed,ccanopy.Leaf[i].LAI,ccanopy.Leaf[i].heightf,
-  			                           Vmax,Jmax,Rd,b0,b1,Catm,o2,theta, StomWS, ws);
+      if(coupled_leaf) {
+        deepaktmpc3 = c3photoC_coupled(ccanopy->ENV[i].Idir,ccanopy->ENV[i].Itotal,Temp,ccanopy->ENV[i].RH,ccanopy->ENV[i].windspeed,ccanopy->Leaf[i].LAI,ccanopy->Leaf[i].heightf,
+                                       Vmax,Jmax,Rd,b0,b1,Catm,o2,theta,StomWS,ws,0,&deepaktmp5_ET);
+        ccanopy->OUT[i].sunlittemp=Temp + deepaktmp5_ET.Deltat;
+        ccanopy->OUT[i].sunlitTranspiration=deepaktmp5_ET.TransR;
+      } else {
+      deepaktmp5_ET= c3EvapoTrans(ccanopy->ENV[i].Idir,ccanopy->ENV[i].Itotal,Temp,ccanopy->ENV[i].RH,ccanopy->ENV[i].windspeed,ccanopy->Leaf[i].LAI,ccanopy->Leaf[i].heightf,
+  			                           Vmax,Jmax,Rd,b0,b1,Catm,o2,theta, StomWS, ws, NULL);
 	    TempIdir = Temp + deepaktmp5_ET.Deltat;
-      ccanopy.OUT[i].sunlittemp=TempIdir;
-      ccanopy.OUT[i].sunlitTranspiration=deepaktmp5_ET.TransR;
+      ccanopy->OUT[i].sunlittemp=TempIdir;
+      ccanopy->OUT[i].sunlitTranspiration=deepaktmp5_ET.TransR;
      
-      deepaktmpc3 = c3photoC(ccanopy.ENV[i].Idir,ccanopy.OUT[i].sunlittemp,ccanopy.ENV[i].RH,Vmax,Jmax,Rd,b0,b1,Catm,o2,theta,StomWS,ws);
-	    ccanopy.OUT[i].sunlitAnet=deepaktmpc3.Assim;
-      ccanopy.OUT[i].sunlitAgross=deepaktmpc3.GrossAssim;
-//      Rprintf("%f, %f,%f\n",deepaktmpc3.Assim,deepaktmpc3.GrossAssim,ccanopy.ENV[i].Idir);
-
-	    Leafshade = ccanopy.Leaf[i].LAI *ccanopy.Leaf[i].pLeafshade;
-      deepaktmp6_ET=c3EvapoTrans(ccanopy.ENV[i].Idiff,ccanopy.ENV[i].Itotal,Temp,ccanopy.ENV[i].RH,ccanopy.ENV[i].windspeed,ccanopy.Leaf[i].LAI,ccanopy.Leaf[i].heightf,
-    		 Vmax,Jmax,Rd,b0,b1,Catm,o2,theta, StomWS, ws);
+      deepaktmpc3 = c3photoC(ccanopy->ENV[i].Idir,ccanopy->OUT[i].sunlittemp,ccanopy->ENV[i].RH,Vmax,Jmax,Rd,b0,b1,Catm,o2,theta,StomWS,ws);
+      }
+      ans.photo_solves++;
+      ans.photo_iterations += deepaktmpc3.iterations;
+	    ccanopy->OUT[i].sunlitAnet=deepaktmpc3.Assim;
+      ccanopy->OUT[i].sunlitAgross=deepaktmpc3.GrossAssim;
+//      Rprintf("%f, %f,%f\n",deepaktmpc3.Assim,deepaktmpc3.GrossAssim,ccanopy->ENV[i].Idir);
+
+	    Leafshade = ccanopy->Leaf[i].LAI *ccanopy->Leaf[i].pLeafshade;
+      if(coupled_leaf) {
+        deepaktmpc32 = c3photoC_coupled(ccanopy->ENV[i].Idiff,ccanopy->ENV[i].Itotal,Temp,ccanopy->ENV[i].RH,ccanopy->ENV[i].windspeed,ccanopy->Leaf[i].LAI,ccanopy->Leaf[i].heightf,
+                                        Vmax,Jmax,Rd,b0,b1,Catm,o2,theta,StomWS,ws,0,&deepaktmp6_ET);
+        ccanopy->OUT[i].shadedtemp=Temp + deepaktmp6_ET.Deltat;
+        ccanopy->OUT[i].shadedTranspiration=deepaktmp6_ET.TransR;
+      } else {
+      deepaktmp6_ET=c3EvapoTrans(ccanopy->ENV[i].Idiff,ccanopy->ENV[i].Itotal,Temp,ccanopy->ENV[i].RH,ccanopy->ENV[i].windspeed,ccanopy->Leaf[i].LAI,ccanopy->Leaf[i].heightf,
+    		 Vmax,Jmax,Rd,b0,b1,Catm,o2,theta, StomWS, ws, NULL);
       TempIdiff=Temp + deepaktmp6_ET.Deltat;
-      ccanopy.OUT[i].shadedtemp=TempIdiff;
-      ccanopy.OUT[i].shadedTranspiration=deepaktmp6_ET.TransR;
-      deepaktmpc32=c3photoC(ccanopy.ENV[i].Idiff,ccanopy.OUT[i].shadedtemp,ccanopy.ENV[i].RH,Vmax,Jmax,Rd,b0,b1,Catm,o2,theta,StomWS,ws);
-	    ccanopy.OUT[i].shadedAnet=deepaktmpc32.Assim;
-      ccanopy.OUT[i].shadedAgross=deepaktmpc32.GrossAssim;
+      ccanopy->OUT[i].shadedtemp=TempIdiff;
+      ccanopy->OUT[i].shadedTranspiration=deepaktmp6_ET.TransR;
+      deepaktmpc32=c3photoC(ccanopy->ENV[i].Idiff,ccanopy->OUT[i].shadedtemp,ccanopy->ENV[i].RH,Vmax,Jmax,Rd,b0,b1,Catm,o2,theta,StomWS,ws);
+      }
+      ans.photo_solves++;
+      ans.photo_iterations += deepaktmpc32.iterations;
+	    ccanopy->OUT[i].shadedAnet=deepaktmpc32.Assim;
+      ccanopy->OUT[i].shadedAgross=deepaktmpc32.GrossAssim;
       
-     ccanopy.OUT[i].TotalAnet =Leafsun* ccanopy.OUT[i].sunlitAnet + Leafshade*ccanopy.OUT[i].shadedAnet;
-     ccanopy.OUT[i].TotalAgross=Leafsun* ccanopy.OUT[i].sunlitAgross + Leafshade*ccanopy.OUT[i].shadedAgross;
-     ccanopy.OUT[i].TotalTrans =Leafsun* ccanopy.OUT[i].sunlitTranspiration + Leafshade*ccanopy.OUT[i].shadedTranspiration;
+     ccanopy->OUT[i].TotalAnet =Leafsun* ccanopy->OUT[i].sunlitAnet + Leafshade*ccanopy->OUT[i].shadedAnet;
+     ccanopy->OUT[i].TotalAgross=Leafsun* ccanopy->OUT[i].sunlitAgross + Leafshade*ccanopy->OUT[i].shadedAgross;
+     ccanopy->OUT[i].TotalTrans =Leafsun* ccanopy->OUT[i].sunlitTranspiration + Leafshade*ccanopy->OUT[i].shadedTranspiration;
     
    
-		 CanopyA = CanopyA + ccanopy.OUT[i].TotalAnet;
-		 GCanopyA =GCanopyA+ ccanopy.OUT[i].TotalAgross;
-     CanopyT = GCanopyA+ ccanopy.OUT[i].TotalTrans;
-//     Rprintf("Inside Layers: net= %f, Gross=%f \n",ccanopy.OUT[i].TotalAnet,ccanopy.OUT[i].TotalAgross);
+		 CanopyA = CanopyA + ccanopy->OUT[i].TotalAnet;
+		 GCanopyA =GCanopyA+ ccanopy->OUT[i].TotalAgross;
+     CanopyT = GCanopyA+ ccanopy->OUT[i].TotalTrans;
+//     Rprintf("Inside Layers: net= %f, Gross=%f \n",ccanopy->OUT[i].TotalAnet,ccanopy->OUT[i].TotalAgross);
 	}
 	/*## These are micro mols of CO2 per m2 per sec for Assimilation
 	  ## and mili mols of H2O per m2 per sec for Transpiration
@@ -385,6 +455,9 @@ struct Can_Str newc3CanAC(double LAI,int DOY, int hr,double solarR,double Temp,
 	ans.Assim = cf * CanopyA ;
   ans.Trans= cf2 * CanopyT; 
   ans.GrossAssim=cf*GCanopyA;
+
+  if(ccanopy == &local_canopy)
+    freecanopy(ccanopy);
 //   Rprintf("output;-Net Assimilation = %f, Gross Assimilation = %f \n", CanopyA,GCanopyA );
 //  Rprintf("returning structure;-Net Assimilation = %f, Gross Assimilation = %f \n", ans.Assim, ans.GrossAssim);
 	return(ans);
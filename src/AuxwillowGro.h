@@ -65,7 +65,9 @@ SEXP willowGro(
         SEXP JMAXB1,           /*                                    55 */
         SEXP O2,               /*                                    55 */
         SEXP GROWTHRESP,       /*                                    57 */
-        SEXP STOMATAWS);       /*                                    58 */
+        SEXP STOMATAWS,        /*                                    58 */
+        SEXP WARM_START,       /* Warm start the photosynthesis solves  */
+        SEXP COUPLED_LEAF);    /* Solve leaf temperature and Ci together */
 
 #endif
 
@@ -7,8 +7,10 @@
 
 #include <R.h>
 #include <math.h>
+#include <string.h>
 #include <Rmath.h>
 #include "BioCro.h"
+#include "c4photo.h"
 #include "Century.h"
 
 void BioGro(
@@ -24,6 +26,11 @@ void BioGro(
         double chil,                  /* Chi, leaf angle distribution       10 */
         double leafwidth,             /* Width of a leaf                    11 */
         int et_equation,              /* Integer to indicate ET equation    12 */
+        int dark_canopy,              /* Dark canopy shortcut when solar is 0  */
+        int warm_start,               /* Warm start the photosynthesis solves  */
+        int coupled_leaf,             /* Solve leaf temperature and Ci together */
+        enum leaf_solver leaf_solver, /* How the leaves are solved             */
+        int gauss_layering,           /* Gauss-Legendre instead of equal layers */
         double heightf,               /* Height factor                      13 */
         int nlayers,                  /* Number of layers in the canopy     14 */
 		double initial_biomass[4],
@@ -70,52 +77,79 @@ void BioGro(
         struct nitroParms nitroP,     /* Nitrogen parameters                56 */
 		double StomataWS,
 		double (*leaf_n_limitation)(double, double, struct Model_state),
-    	struct BioGro_results_str *results)
+		struct BioGro_state *state,
+		struct BioGro_workspace *workspace,
+    	struct BioGro_sink *sink)
 {
-    double newLeafcol[8760];
-    double newStemcol[8760];
-    double newRootcol[8760];
-    double newRhizomecol[8760];
-
-	double Rhizome = initial_biomass[0];
-	double Stem = initial_biomass[1];
-	double Leaf = initial_biomass[2];
-	double Root = initial_biomass[3];
+    if (workspace->soil_layers < soilLayers)
+        error("the BioGro workspace is too small for this run");
+    if (state->soil_layers < soilLayers)
+        error("the BioGro state is too small for this run");
+
+    /* A state at index 0 starts a new run from the arguments. Otherwise the
+     * run resumes at state->index with what the state holds. */
+    if (state->index == 0) {
+        start_biogro_state(state, initial_biomass, Sp, centcoefs, soilcoefs[5], cws, soilLayers,
+                ileafn, vmax1, alpha1, StomataWS);
+    }
+    workspace->warnings = 0;
+    workspace->nan_steps = 0;
+    workspace->photo_solves = 0;
+    workspace->photo_iterations = 0;
+    state->soil.sharedCampbell = workspace->campbell;
+    sink->stop = 0;
+
+    /* Without memory for the surface the leaves are solved by the
+     * bracketed solver it would have been built from. */
+    if (leaf_solver == LEAF_SOLVER_SURFACE && workspace->photo_surface == NULL)
+        workspace->photo_surface = c4_surface_alloc();
+
+    /* Tissue produced each step, kept until it senesces. */
+    struct senescence_queue *leaf_cohorts = &state->leaf_cohorts;
+    struct senescence_queue *stem_cohorts = &state->stem_cohorts;
+    struct senescence_queue *root_cohorts = &state->root_cohorts;
+    struct senescence_queue *rhizome_cohorts = &state->rhizome_cohorts;
+
+	double Rhizome = state->rhizome;
+	double Stem = state->stem;
+	double Leaf = state->leaf;
+	double Root = state->root;
 
     int i, i3;
 
-    double LAI = 0.0, Grain = 0.0;
-    double TTc = 0.0;
+    double LAI = state->lai, Grain = state->grain;
+    double TTc = state->thermal_time;
     double kLeaf = 0.0, kStem = 0.0, kRoot = 0.0, kRhizome = 0.0, kGrain = 0.0;
-    double newLeaf = 0.0, newStem = 0.0, newRoot = 0.0, newRhizome = 0.0, newGrain = 0.0;
+    double newLeaf = state->new_leaf, newStem = state->new_stem, newRoot = state->new_root;
+    double newRhizome = state->new_rhizome, newGrain = state->new_grain;
 
 	struct Model_state current_state = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
     /* Variables needed for collecting litter */
-    double LeafLitter = centcoefs[20], StemLitter = centcoefs[21];
-    double RootLitter = centcoefs[22], RhizomeLitter = centcoefs[23];
+    double LeafLitter = state->leaf_litter, StemLitter = state->stem_litter;
+    double RootLitter = state->root_litter, RhizomeLitter = state->rhizome_litter;
     double LeafLitter_d = 0.0, StemLitter_d = 0.0;
     double RootLitter_d = 0.0, RhizomeLitter_d = 0.0;
     double ALitter = 0.0, BLitter = 0.0;
 
-    double *sti , *sti2, *sti3, *sti4;
+    double Senesced;
     double Remob;
-    int k = 0, q = 0, m = 0, n = 0;
-    int ri = 0;
+    int ri = state->rhizome_cohort_count;
 
     double LeafWS;
     double CanopyA, CanopyT;
     double LeafN_0 = ileafn;
-    double LeafN = ileafn; /* Need to set it because it is used by CanA before it is computed */
+    double LeafN = state->leaf_nitrogen;
     double iSp = Sp;
-    double vmax = vmax1;
-    double alpha = alpha1;
+    double vmax = state->vmax;
+    double alpha = state->alpha;
 
     /* Century */
-    double MinNitro = centcoefs[19];
+    double MinNitro = state->min_nitro;
     int doyNfert = centcoefs[18];
+    int centExponential = centcoefs[24] != 0;
     double Nfert;
-    double SCCs[9];
+    double *SCCs = state->SCCs;
     double Resp = 0.0;
 
     /* Maintenance respiration */
@@ -127,7 +161,7 @@ void BioGro(
     const double phi1 = soilcoefs[2];
     const double phi2 = soilcoefs[3];
     const double soilDepth = soilcoefs[4];
-    double waterCont = soilcoefs[5];
+    double waterCont = state->water_content;
     double soilEvap, TotEvap;
 
     const double seneLeaf = sencoefs[0];
@@ -136,20 +170,16 @@ void BioGro(
     const double seneRhizome = sencoefs[3];
 
     struct Can_Str Canopy = {0,0,0};
-    struct ws_str WaterS = {0, 0, 0, 0, 0, 0};
+    struct ws_str WaterS = state->water_stress;
     struct dbp_str dbpS;
-    struct soilML_str soilMLS;
+    struct soil_column *soil = &state->soil;
     struct soilText_str soTexS; /* , *soTexSp = &soTexS; */
+    const struct campbell_table *campbell;
     soTexS = soilTchoose(soilType);
 
-    LAI = Leaf * Sp;
-
-    /* Creation of pointers outside the loop */
-    sti = &newLeafcol[0]; /* This creates sti to be a pointer to the position 0
-                             in the newLeafcol vector */
-    sti2 = &newStemcol[0];
-    sti3 = &newRootcol[0];
-    sti4 = &newRhizomecol[0];
+    Sp = state->specific_leaf_area;
+    StomataWS = state->stomata_ws;
+    cws = soil->cws;
 
     /* Some soil related empirical coefficients */
     double rfl = secs[0];  /* root factor lambda */
@@ -159,37 +189,25 @@ void BioGro(
     double transpRes = soilcoefs[7]; /* Resistance to transpiration from soil to leaf */
     double leafPotTh = soilcoefs[8]; /* Leaf water potential threshold */
 
-	double water_status[soilLayers * vecsize];
-	double root_distribution[soilLayers * vecsize];
-	double psi[soilLayers * vecsize];
+	double *water_status = workspace->water_status;
+	double *root_distribution = workspace->root_distribution;
+	double *psi = workspace->psim;
     double cwsVecSum = 0.0;
 
     /* Parameters for calculating leaf water potential */
 	double LeafPsim = 0.0;
 
-    results->centS.SCs[0] = 0.0;
-    results->centS.SCs[1] = 0.0;
-    results->centS.SCs[2] = 0.0;
-    results->centS.SCs[3] = 0.0;
-    results->centS.SCs[4] = 0.0;
-    results->centS.SCs[5] = 0.0;
-    results->centS.SCs[6] = 0.0;
-    results->centS.SCs[7] = 0.0;
-    results->centS.SCs[8] = 0.0;
-    results->centS.Resp = 0.0;
-
-    SCCs[0] = centcoefs[0];
-    SCCs[1] = centcoefs[1];
-    SCCs[2] = centcoefs[2];
-    SCCs[3] = centcoefs[3];
-    SCCs[4] = centcoefs[4];
-    SCCs[5] = centcoefs[5];
-    SCCs[6] = centcoefs[6];
-    SCCs[7] = centcoefs[7];
-    SCCs[8] = centcoefs[8];
-
-
-    for(i = 0; i < vecsize; i++)
+    struct cenT_str centS = state->centS;
+    struct BioGro_step step;
+
+    step.soil_layers = soilLayers;
+    step.psim = psi;
+    step.water_status = water_status;
+    step.root_distribution = root_distribution;
+    step.centS = &centS;
+
+
+    for(i = state->index; i < vecsize; i++)
     {
         /* First calculate the elapsed Thermal Time*/
         if(temp[i] > tbase) {
@@ -198,12 +216,20 @@ void BioGro(
 
         /* Do the magic! Calculate growth*/
 
-        Canopy = CanAC(LAI, doy[i], hour[i],
-                solar[i], temp[i], rh[i], windspeed[i],
-                lat, nlayers, vmax, alpha, kparm, beta,
-                Rd, Catm, b0, b1, theta, kd, chil,
-                heightf, LeafN, kpLN, lnb0, lnb1, lnfun, upperT, lowerT,
-				nitroP, leafwidth, et_equation, StomataWS, ws);
+        if (workspace->canopy != NULL) {
+            Canopy = *workspace->canopy;
+        } else {
+            Canopy = CanAC(LAI, doy[i], hour[i],
+                    solar[i], temp[i], rh[i], windspeed[i],
+                    lat, nlayers, vmax, alpha, kparm, beta,
+                    Rd, Catm, b0, b1, theta, kd, chil,
+                    heightf, LeafN, kpLN, lnb0, lnb1, lnfun, upperT, lowerT,
+                    nitroP, leafwidth, et_equation, StomataWS, ws, dark_canopy, coupled_leaf, leaf_solver, gauss_layering,
+                    leaf_solver == LEAF_SOLVER_SURFACE ? workspace->photo_surface : NULL,
+                    workspace->solar, warm_start ? &state->canopy_start : NULL);
+        }
+        workspace->photo_solves += Canopy.photo_solves;
+        workspace->photo_iterations += Canopy.photo_iterations;
 
         CanopyA = Canopy.Assim * timestep;
         CanopyT = Canopy.Trans * timestep;
@@ -247,21 +273,30 @@ void BioGro(
 
         /* Inserting the multilayer model */
         if (soilLayers > 1) {
-            soilMLS = soilML(precip[i], CanopyT, cws, soilDepth, soilDepths, FieldC, WiltP,
+            soilML(soil, precip[i], CanopyT, soilDepth, soilDepths, FieldC, WiltP,
                     phi1, phi2, soTexS, wsFun, soilLayers, Root,
                     LAI, 0.68, temp[i], solar[i], windspeed[i], rh[i],
                     hydrDist, rfl, rsec, rsdf);
 
-            StomataWS = soilMLS.rcoefPhoto;
-            LeafWS = soilMLS.rcoefSpleaf;
-            soilEvap = soilMLS.SoilEvapo;
+            StomataWS = soil->rcoefPhoto;
+            LeafWS = soil->rcoefSpleaf;
+            soilEvap = soil->SoilEvapo;
 
             for(i3 = 0; i3 < soilLayers; i3++) {
-                cws[i3] = soilMLS.cws[i3];
                 cwsVecSum += cws[i3];
-				water_status[i3 + i*soilLayers] = soilMLS.cws[i3];
-                root_distribution[i3 + i*soilLayers] = soilMLS.rootDist[i3];
-				psi[i3 + i * soilLayers] = 0;
+				water_status[i3] = cws[i3];
+                root_distribution[i3] = soil->rootDist[i3];
+				psi[i3] = 0;
+            }
+            /* The leaf water potential of wsFun 4 starts from the soil
+             * water potential where the roots are */
+            if(wsFun == 4) {
+                campbell = soil_campbell_table(soil, soTexS);
+                WaterS.psim = 0;
+                for(i3 = 0; i3 < soilLayers; i3++) {
+                    psi[i3] = campbell_psim(campbell, soTexS, cws[i3]);
+                    WaterS.psim += soil->rootFraction[i3] * psi[i3];
+                }
             }
             waterCont = cwsVecSum / soilLayers;
             cwsVecSum = 0.0;
@@ -273,9 +308,9 @@ void BioGro(
             waterCont = WaterS.awc;
             StomataWS = WaterS.rcoefPhoto;
             LeafWS = WaterS.rcoefSpleaf;
-            water_status[i] = waterCont;
-			psi[i] = WaterS.psim;
-			root_distribution[i] = 0;
+            water_status[0] = waterCont;
+			psi[0] = WaterS.psim;
+			root_distribution[0] = 0;
         }
 
         /* An alternative way of computing water stress is by doing the leaf
@@ -335,8 +370,12 @@ void BioGro(
         }                
 
         if (ISNAN(kRhizome) || ISNAN(kLeaf) || ISNAN(kRoot) || ISNAN(kStem) || ISNAN(kGrain)) {
-            Rprintf("kLeaf %.2f, kStem %.2f, kRoot %.2f, kRhizome %.2f, kGrain %.2f \n", kLeaf, kStem, kRoot, kRhizome, kGrain);
-            Rprintf("iter %i \n", i);
+            if (workspace->defer_warnings) {
+                workspace->nan_steps++;
+            } else {
+                Rprintf("kLeaf %.2f, kStem %.2f, kRoot %.2f, kRhizome %.2f, kGrain %.2f \n", kLeaf, kStem, kRoot, kRhizome, kGrain);
+                Rprintf("iter %i \n", i);
+            }
         }
 
         /* Here I can insert the code for Nitrogen limitations on photosynthesis
@@ -387,13 +426,17 @@ void BioGro(
                as pointed out in that reference. */
 
             if(ISNAN(newLeaf)) {
-                Rprintf("LeafWS %.2f \n", LeafWS);
-                Rprintf("CanopyA %.2f \n", CanopyA);
+                if (workspace->defer_warnings) {
+                    workspace->nan_steps++;
+                } else {
+                    Rprintf("LeafWS %.2f \n", LeafWS);
+                    Rprintf("CanopyA %.2f \n", CanopyA);
+                }
             }
 
             newLeaf = resp(newLeaf, mrc1, temp[i]);
 
-            *(sti+i) = newLeaf; /* This populates the vector newLeafcol. It makes sense
+            put_senescence_queue(leaf_cohorts, i, newLeaf); /* It makes sense
                                    to use i because when kLeaf is negative no new leaf is
                                    being accumulated and thus would not be subjected to senescence */
         } else {
@@ -407,18 +450,18 @@ void BioGro(
         if (TTc < seneLeaf) {
             Leaf += newLeaf;
         } else {
-            Leaf += newLeaf - *(sti+k); /* This means that the new value of leaf is
+            Senesced = take_senescence_queue(leaf_cohorts);
+            Leaf += newLeaf - Senesced; /* This means that the new value of leaf is
                                            the previous value plus the newLeaf
                                            (Senescence might start when there is
-                                           still leaf being produced) minus the leaf
-                                           produced at the corresponding k.*/
-            Remob = *(sti+k) * 0.6;
-            LeafLitter += *(sti+k) * 0.4; /* Collecting the leaf litter */ 
+                                           still leaf being produced) minus the oldest
+                                           leaf that has not senesced yet.*/
+            Remob = Senesced * 0.6;
+            LeafLitter += Senesced * 0.4; /* Collecting the leaf litter */ 
             Rhizome += kRhizome * Remob;
             Stem += kStem * Remob;
             Root += kRoot * Remob;
             Grain += kGrain * Remob;
-            k++;
         }
 
         /* The specific leaf area declines with the growing season at least in
@@ -436,7 +479,7 @@ void BioGro(
         if (kStem >= 0) {
             newStem = CanopyA * kStem;
             newStem = resp(newStem, mrc1, temp[i]);
-            *(sti2+i) = newStem;
+            put_senescence_queue(stem_cohorts, i, newStem);
         } else {
             error("kStem should be positive");
         }
@@ -444,15 +487,15 @@ void BioGro(
         if (TTc < seneStem) {
             Stem += newStem;
         } else {
-            Stem += newStem - *(sti2+q);
-            StemLitter += *(sti2+q);
-            q++;
+            Senesced = take_senescence_queue(stem_cohorts);
+            Stem += newStem - Senesced;
+            StemLitter += Senesced;
         }
 
         if (kRoot > 0) {
             newRoot = CanopyA * kRoot;
             newRoot = resp(newRoot, mrc2, temp[i]);
-            *(sti3+i) = newRoot;
+            put_senescence_queue(root_cohorts, i, newRoot);
         } else {
             newRoot = Root * kRoot;
             Rhizome += kRhizome * -newRoot * 0.9;
@@ -464,22 +507,26 @@ void BioGro(
         if (TTc < seneRoot) {
             Root += newRoot;
         } else {
-            Root += newRoot - *(sti3+m);
-            RootLitter += *(sti3+m);
-            m++;
+            Senesced = take_senescence_queue(root_cohorts);
+            Root += newRoot - Senesced;
+            RootLitter += Senesced;
         }
 
         if (kRhizome > 0) {
             newRhizome = CanopyA * kRhizome;
             newRhizome = resp(newRhizome, mrc2, temp[i]);
-            *(sti4+ri) = newRhizome;
+            put_senescence_queue(rhizome_cohorts, ri, newRhizome);
             /* Here i will not work because the rhizome goes from being a source
                to a sink. I need its own index. Let's call it rhizome's i or ri.*/
             ri++;
         } else {
             if (Rhizome < 0) {
                 Rhizome = 1e-4;
-                warning("Rhizome became negative");
+                if (workspace->defer_warnings) {
+                    workspace->warnings++;
+                } else {
+                    warning("Rhizome became negative");
+                }
             }
 
             newRhizome = Rhizome * kRhizome;
@@ -492,9 +539,9 @@ void BioGro(
         if (TTc < seneRhizome) {
             Rhizome += newRhizome;
         } else {
-            Rhizome += newRhizome - *(sti4+n);
-            RhizomeLitter += *(sti4+n);
-            n++;
+            Senesced = take_senescence_queue(rhizome_cohorts);
+            Rhizome += newRhizome - Senesced;
+            RhizomeLitter += Senesced;
         }
 
         if ((kGrain < 1e-10) || (TTc < thermalp[4])) {
@@ -507,7 +554,7 @@ void BioGro(
             Grain += newGrain;
         }
 
-        if (i % 24*centTimestep == 0) {
+        if (i % (24*centTimestep) == 0) {
             LeafLitter_d = LeafLitter * ((0.1/30)*centTimestep);
             StemLitter_d = StemLitter * ((0.1/30)*centTimestep);
             RootLitter_d = RootLitter * ((0.1/30)*centTimestep);
@@ -518,7 +565,7 @@ void BioGro(
             RootLitter -= RootLitter_d;
             RhizomeLitter -= RhizomeLitter_d;
 
-            results->centS = Century(&LeafLitter_d, &StemLitter_d, &RootLitter_d, &RhizomeLitter_d,
+            centS = Century(&LeafLitter_d, &StemLitter_d, &RootLitter_d, &RhizomeLitter_d,
                     waterCont, temp[i], centTimestep, SCCs, WaterS.runoff,
                     Nfert, /* N fertilizer*/
                     MinNitro, /* initial Mineral nitrogen */
@@ -532,54 +579,88 @@ void BioGro(
                     centcoefs[15], /* Root litter N */
                     centcoefs[16], /* Rhizome litter N */
                     soilType,
-                    centks);
+                    centks,
+                    centExponential);
         }
 
-        MinNitro = results->centS.MinN; /* These should be kg / m^2 per week? */
-        Resp = results->centS.Resp;
-        SCCs[0] = results->centS.SCs[0];
-        SCCs[1] = results->centS.SCs[1];
-        SCCs[2] = results->centS.SCs[2];
-        SCCs[3] = results->centS.SCs[3];
-        SCCs[4] = results->centS.SCs[4];
-        SCCs[5] = results->centS.SCs[5];
-        SCCs[6] = results->centS.SCs[6];
-        SCCs[7] = results->centS.SCs[7];
-        SCCs[8] = results->centS.SCs[8];
+        MinNitro = centS.MinN; /* These should be kg / m^2 per week? */
+        Resp = centS.Resp;
+        SCCs[0] = centS.SCs[0];
+        SCCs[1] = centS.SCs[1];
+        SCCs[2] = centS.SCs[2];
+        SCCs[3] = centS.SCs[3];
+        SCCs[4] = centS.SCs[4];
+        SCCs[5] = centS.SCs[5];
+        SCCs[6] = centS.SCs[6];
+        SCCs[7] = centS.SCs[7];
+        SCCs[8] = centS.SCs[8];
 
         ALitter = LeafLitter + StemLitter;
         BLitter = RootLitter + RhizomeLitter;
 
-		results->day_of_year[i] = doy[i];
-		results->hour[i] = hour[i];
-        results->CanopyAssim[i] =  CanopyA;
-		results->canopy_transpiration[i] = CanopyT;
-        results->Leafy[i] = Leaf;
-        results->Stemy[i] = Stem;
-        results->Rooty[i] =  Root;
-        results->Rhizomey[i] = Rhizome;
-        results->Grainy[i] = Grain;
-        results->LAIc[i] = LAI;
-		results->thermal_time[i] = TTc;
-		results->soil_water_content[i] = waterCont;
-		results->stomata_cond_coefs[i] = StomataWS;
-		results->leaf_reduction_coefs[i] = LeafWS;
-		results->leaf_nitrogen[i] = LeafN;
-		results->above_ground_litter[i] = ALitter;
-		results->below_ground_litter[i] = BLitter;
-		results->vmax[i] = vmax;
-		results->alpha[i] = alpha;
-		results->specific_leaf_area[i] = Sp;
-		results->min_nitro[i] = MinNitro / (24 / centTimestep);
-		results->respiration[i] = Resp / (24*centTimestep);
-		results->soil_evaporation[i] = soilEvap;
-		results->leaf_psim[i] = LeafPsim;
-		for(int layer = 0; layer < soilLayers; layer++) {
-			results->psim[layer + i * soilLayers] = psi[layer + i * soilLayers];
-			results->water_status[layer + i * soilLayers] = water_status[layer + i * soilLayers];
-			results->root_distribution[layer + i * soilLayers] = root_distribution[layer + i * soilLayers];
+		step.value[BIOGRO_DAY_OF_YEAR] = doy[i];
+		step.value[BIOGRO_HOUR] = hour[i];
+		step.value[BIOGRO_CANOPY_ASSIM] = CanopyA;
+		step.value[BIOGRO_CANOPY_TRANSPIRATION] = CanopyT;
+		step.value[BIOGRO_LEAF] = Leaf;
+		step.value[BIOGRO_STEM] = Stem;
+		step.value[BIOGRO_ROOT] = Root;
+		step.value[BIOGRO_RHIZOME] = Rhizome;
+		step.value[BIOGRO_GRAIN] = Grain;
+		step.value[BIOGRO_LAI] = LAI;
+		step.value[BIOGRO_THERMAL_TIME] = TTc;
+		step.value[BIOGRO_SOIL_WATER_CONTENT] = waterCont;
+		step.value[BIOGRO_STOMATA_COND_COEFS] = StomataWS;
+		step.value[BIOGRO_LEAF_REDUCTION_COEFS] = LeafWS;
+		step.value[BIOGRO_LEAF_NITROGEN] = LeafN;
+		step.value[BIOGRO_ABOVE_GROUND_LITTER] = ALitter;
+		step.value[BIOGRO_BELOW_GROUND_LITTER] = BLitter;
+		step.value[BIOGRO_VMAX] = vmax;
+		step.value[BIOGRO_ALPHA] = alpha;
+		step.value[BIOGRO_SPECIFIC_LEAF_AREA] = Sp;
+		step.value[BIOGRO_MIN_NITRO] = MinNitro / (24.0 / centTimestep);
+		step.value[BIOGRO_RESPIRATION] = Resp / (24*centTimestep);
+		step.value[BIOGRO_SOIL_EVAPORATION] = soilEvap;
+		step.value[BIOGRO_LEAF_PSIM] = LeafPsim;
+
+		if (i % sink->interval == 0) {
+			sink->record(sink, i, &step);
+			if (sink->stop) {
+				i++;
+				break;
+			}
 		}
     }
+
+    state->index = i;
+    state->leaf = Leaf;
+    state->stem = Stem;
+    state->root = Root;
+    state->rhizome = Rhizome;
+    state->grain = Grain;
+    state->lai = LAI;
+    state->thermal_time = TTc;
+    state->new_leaf = newLeaf;
+    state->new_stem = newStem;
+    state->new_root = newRoot;
+    state->new_rhizome = newRhizome;
+    state->new_grain = newGrain;
+    state->leaf_litter = LeafLitter;
+    state->stem_litter = StemLitter;
+    state->root_litter = RootLitter;
+    state->rhizome_litter = RhizomeLitter;
+    state->min_nitro = MinNitro;
+    state->specific_leaf_area = Sp;
+    state->leaf_nitrogen = LeafN;
+    state->vmax = vmax;
+    state->alpha = alpha;
+    state->stomata_ws = StomataWS;
+    state->water_content = waterCont;
+    state->centS = centS;
+    state->water_stress = WaterS;
+    state->rhizome_cohort_count = ri;
+
+    if (sink->finish != NULL) sink->finish(sink, &step);
 }
 
 double sel_phen(int phen)
@@ -4,31 +4,37 @@
 #include "AuxBioCro.h"
 #include "Century.h"
 
+struct c4_surface;
+
+/* Channels are allocated by initialize_biogro_results() with one element per
+ * time step (vector_size). The soil matrices hold soil_layers * vector_size values. */
 struct BioGro_results_str {
-	double day_of_year[8760];
-	double hour[8760];
-	double CanopyAssim[8760];
-	double canopy_transpiration[8760];
-	double Leafy[8760];
-	double Stemy[8760];
-	double Rooty[8760];
-	double Rhizomey[8760];
-	double Grainy[8760];
-	double LAIc[8760];
-	double thermal_time[8760];
-	double soil_water_content[8760];
-	double stomata_cond_coefs[8760];
-	double leaf_reduction_coefs[8760];
-	double leaf_nitrogen[8760];
-	double above_ground_litter[8760];
-	double below_ground_litter[8760];
-	double vmax[8760];
-	double alpha[8760];
-	double specific_leaf_area[8760];
-	double min_nitro[8760];
-	double respiration[8760];
-	double soil_evaporation[8760];
-	double leaf_psim[8760];
+	int vector_size;
+	int soil_layers;
+	double *day_of_year;
+	double *hour;
+	double *CanopyAssim;
+	double *canopy_transpiration;
+	double *Leafy;
+	double *Stemy;
+	double *Rooty;
+	double *Rhizomey;
+	double *Grainy;
+	double *LAIc;
+	double *thermal_time;
+	double *soil_water_content;
+	double *stomata_cond_coefs;
+	double *leaf_reduction_coefs;
+	double *leaf_nitrogen;
+	double *above_ground_litter;
+	double *below_ground_litter;
+	double *vmax;
+	double *alpha;
+	double *specific_leaf_area;
+	double *min_nitro;
+	double *respiration;
+	double *soil_evaporation;
+	double *leaf_psim;
 	double *psim;
 	double *water_status;
 	double *root_distribution;
@@ -38,6 +44,190 @@ struct BioGro_results_str {
 void initialize_biogro_results(struct BioGro_results_str *results, int soil_layers, int vector_size);
 void free_biogro_results(struct BioGro_results_str *results);
 
+/* Scratch memory for BioGro. Allocate it once and pass it to every call; a
+ * run needs soil_layers >= soilLayers. The soil vectors hold the values of
+ * the current step. A workspace can only be used by one simulation at a
+ * time; set defer_warnings when running off the main thread, where R's
+ * warning() and Rprintf() must not be called. */
+struct BioGro_workspace {
+	int soil_layers;
+	double *psim;
+	double *water_status;
+	double *root_distribution;
+	int defer_warnings; /* if nonzero, count warnings instead of raising them */
+	int warnings;       /* warnings counted during the last run */
+	int nan_steps;      /* steps of the last run whose partitioning or new
+	                       leaf were NaN, printed unless defer_warnings */
+	double photo_solves;     /* leaf photosynthesis solves of the last run */
+	double photo_iterations; /* and their iterations, see Can_Str */
+	const struct solar_table *solar; /* for the latitude of the run, or NULL */
+	/* The Campbell curves of the soil of the run, shared with other runs,
+	 * or NULL for the soil column to build its own. See campbell_table_for. */
+	const struct campbell_table *campbell;
+	struct c4_surface *photo_surface; /* allocated by BioGro when first needed */
+	/* When not NULL, the canopy of the step at the index of the state,
+	 * computed by the caller, as BioGroEnsemble does in lockstep. BioGro
+	 * takes it instead of calling CanAC, so the call must run that one
+	 * step only. */
+	const struct Can_Str *canopy;
+};
+
+void initialize_biogro_workspace(struct BioGro_workspace *workspace, int soil_layers);
+void free_biogro_workspace(struct BioGro_workspace *workspace);
+
+/* Tissue produced at each step, waiting to senesce. Values are put at
+ * increasing steps and taken back one step at a time, oldest first; taken
+ * counts the steps taken so far. See senescence_queue.c. */
+struct senescence_queue {
+	double *values;
+	int capacity;
+	int start;
+	int count;
+	int taken;
+};
+
+void initialize_senescence_queue(struct senescence_queue *queue);
+void free_senescence_queue(struct senescence_queue *queue);
+void clear_senescence_queue(struct senescence_queue *queue);
+void put_senescence_queue(struct senescence_queue *queue, int step, double value);
+double take_senescence_queue(struct senescence_queue *queue);
+void copy_senescence_queue(struct senescence_queue *to, const struct senescence_queue *from);
+int senescence_queue_length(const struct senescence_queue *queue);
+double *save_senescence_queue(const struct senescence_queue *queue, double *buffer);
+const double *restore_senescence_queue(struct senescence_queue *queue, const double *buffer, int length);
+
+/* Everything a BioGro run carries from one step to the next. index is the
+ * next step to simulate. BioGro starts a state at index 0 from its
+ * arguments and resumes any other state where it stopped, so a run can be
+ * saved at some step and continued later, possibly more than once. */
+struct BioGro_state {
+	int index;
+	int soil_layers;
+	double leaf;
+	double stem;
+	double root;
+	double rhizome;
+	double grain;
+	double lai;
+	double thermal_time;
+	double new_leaf;
+	double new_stem;
+	double new_root;
+	double new_rhizome;
+	double new_grain;
+	double leaf_litter;
+	double stem_litter;
+	double root_litter;
+	double rhizome_litter;
+	double min_nitro;
+	double specific_leaf_area;
+	double leaf_nitrogen;
+	double vmax;
+	double alpha;
+	double stomata_ws;
+	double water_content;
+	double SCCs[9];
+	struct cenT_str centS;
+	struct ws_str water_stress;
+	struct soil_column soil; /* water of the soil layers */
+	struct senescence_queue leaf_cohorts;
+	struct senescence_queue stem_cohorts;
+	struct senescence_queue root_cohorts;
+	struct senescence_queue rhizome_cohorts;
+	int rhizome_cohort_count; /* rhizome is queued by growth step, not time step */
+	struct canopy_start canopy_start; /* last leaf solves, for warm starts */
+};
+
+void initialize_biogro_state(struct BioGro_state *state, int soil_layers);
+void free_biogro_state(struct BioGro_state *state);
+void start_biogro_state(struct BioGro_state *state, double initial_biomass[4], double Sp,
+		double centcoefs[], double water_content, double cws[], int soil_layers,
+		double ileafn, double vmax1, double alpha1, double StomataWS);
+void copy_biogro_state(struct BioGro_state *to, const struct BioGro_state *from);
+int biogro_state_length(const struct BioGro_state *state);
+void save_biogro_state(const struct BioGro_state *state, double *buffer);
+int restore_biogro_state(struct BioGro_state *state, const double *buffer, int length);
+
+/* Scalar outputs of one BioGro time step, in the order MisGro returns them. */
+enum biogro_channel {
+	BIOGRO_DAY_OF_YEAR,
+	BIOGRO_HOUR,
+	BIOGRO_CANOPY_ASSIM,
+	BIOGRO_CANOPY_TRANSPIRATION,
+	BIOGRO_LEAF,
+	BIOGRO_STEM,
+	BIOGRO_ROOT,
+	BIOGRO_RHIZOME,
+	BIOGRO_GRAIN,
+	BIOGRO_LAI,
+	BIOGRO_THERMAL_TIME,
+	BIOGRO_SOIL_WATER_CONTENT,
+	BIOGRO_STOMATA_COND_COEFS,
+	BIOGRO_LEAF_REDUCTION_COEFS,
+	BIOGRO_LEAF_NITROGEN,
+	BIOGRO_ABOVE_GROUND_LITTER,
+	BIOGRO_BELOW_GROUND_LITTER,
+	BIOGRO_VMAX,
+	BIOGRO_ALPHA,
+	BIOGRO_SPECIFIC_LEAF_AREA,
+	BIOGRO_MIN_NITRO,
+	BIOGRO_RESPIRATION,
+	BIOGRO_SOIL_EVAPORATION,
+	BIOGRO_LEAF_PSIM,
+	BIOGRO_CHANNELS
+};
+
+extern const char *biogro_channel_names[BIOGRO_CHANNELS];
+
+double *biogro_results_channel(struct BioGro_results_str *results, int channel);
+
+/* What BioGro hands to a sink after each step. The soil arrays have
+ * soil_layers elements and are only valid for the duration of the call. */
+struct BioGro_step {
+	double value[BIOGRO_CHANNELS];
+	int soil_layers;
+	const double *psim;
+	const double *water_status;
+	const double *root_distribution;
+	const struct cenT_str *centS;
+};
+
+/* A sink receives the output of BioGro as the simulation runs. record is
+ * called for every step whose index is a multiple of interval, and finish
+ * (if not NULL) once with the last step of the run. record may set stop to
+ * end the run after the current step; BioGro clears it when it starts. */
+struct BioGro_sink {
+	void (*record)(struct BioGro_sink *sink, int index, const struct BioGro_step *step);
+	void (*finish)(struct BioGro_sink *sink, const struct BioGro_step *last);
+	int interval;
+	int stop;
+	void *data;
+};
+
+void initialize_results_sink(struct BioGro_sink *sink, struct BioGro_results_str *results, int interval);
+
+#define BIOGRO_CHANNEL_BIT(channel) (1UL << (channel))
+#define BIOGRO_ALL_CHANNELS (BIOGRO_CHANNEL_BIT(BIOGRO_CHANNELS) - 1)
+
+/* Which part of the output a selected results sink keeps. Only the channels
+ * whose bit is set in channels are stored, and the soil layer matrices only
+ * when soil is set. If indices is not NULL only the n_indices steps it
+ * lists, in increasing order, are stored, step indices[j] going to slot j of
+ * results; otherwise step i goes to slot i / interval. */
+struct BioGro_results_selection {
+	struct BioGro_results_str *results;
+	unsigned long channels;
+	int soil;
+	const int *indices;
+	int n_indices;
+};
+
+void initialize_selected_results_sink(struct BioGro_sink *sink, struct BioGro_results_selection *selection, int interval);
+int biogro_results_slot(const struct BioGro_results_selection *selection, int index);
+void initialize_daily_sink(struct BioGro_sink *sink, struct BioGro_results_str *daily, int first_day, int interval);
+void free_daily_sink(struct BioGro_sink *sink);
+int initialize_file_sink(struct BioGro_sink *sink, const char *path, int interval);
+
 struct Model_state {
 	double leaf;
 	double stem;
@@ -64,9 +254,17 @@ struct Light_model {
 	double cosine_zenith_angle;
 };
 
+/* How the photosynthesis of the leaves of a C4 canopy is solved, in the
+ * order of the solver of photoParms. */
+enum leaf_solver {
+	LEAF_SOLVER_ITERATIVE, /* c4photoC, iterating on Ci */
+	LEAF_SOLVER_BRACKETED, /* c4photoC_bracketed */
+	LEAF_SOLVER_SURFACE    /* a table of bracketed solves, see c4photo_surface.c */
+};
+
 void BioGro(double lat, int doy[], int hr[], double solar[], double temp[], double rh[],
-        double windspeed[], double precip[], double kd, double chil, double leafwidth, int et_equation,
-        double heightf, int nlayers, double initial_biomass[4],
+        double windspeed[], double precip[], double kd, double chil, double leafwidth, int et_equation, int dark_canopy,
+        int warm_start, int coupled_leaf, enum leaf_solver leaf_solver, int gauss_layering, double heightf, int nlayers, double initial_biomass[4],
         double sencoefs[], int timestep, int vecsize,
         double Sp, double SpD, double dbpcoefs[25], double thermalp[], double tbase, double vmax1, 
         double alpha1, double kparm, double theta, double beta, double Rd, double Catm, double b0, double b1, 
@@ -74,27 +272,61 @@ void BioGro(double lat, int doy[], int hr[], double solar[], double temp[], doub
         double alphab1, double mresp[], int soilType, int wsFun, int ws, double centcoefs[],
         int centTimestep, double centks[], int soilLayers, double soilDepths[],
         double cws[], int hydrDist, double secs[], double kpLN, double lnb0, double lnb1, int lnfun , double upperT, double lowerT, struct nitroParms nitroP, double StomataWS,
-		double (*leaf_n_limitation)(double kLn, double leaf_n_0, struct Model_state current_state), struct BioGro_results_str *results);
+		double (*leaf_n_limitation)(double kLn, double leaf_n_0, struct Model_state current_state),
+		struct BioGro_state *state, struct BioGro_workspace *workspace, struct BioGro_sink *sink);
 
 struct Can_Str CanAC(double LAI, int DOY, int hr, double solarR, double Temp,
 		     double RH, double WindSpeed, double lat, int nlayers, double Vmax, double Alpha, 
 		     double Kparm, double beta, double Rd, double Catm, double b0, 
 		     double b1, double theta, double kd, double chil, double heightf,
 		     double leafN, double kpLN, double lnb0, double lnb1, int lnfun, double upperT,
-		     double lowerT, struct nitroParms nitroP, double leafwidth, int eteq, double StomataWS, int ws);
+		     double lowerT, struct nitroParms nitroP, double leafwidth, int eteq, double StomataWS, int ws, int dark_canopy,
+		     int coupled_leaf, enum leaf_solver leaf_solver, int gauss_layering, struct c4_surface *surface,
+		     const struct solar_table *solar, struct canopy_start *start);
+
+/* What CanAC takes that can differ between the scenarios of
+ * CanAC_scenarios: the canopy, its water stress and the parameters, surface
+ * and warm start of its leaves. */
+struct canopy_scenario {
+	double LAI;
+	double leafN;
+	double StomataWS;
+	double Vmax;
+	double Alpha;
+	double Kparm;
+	double theta;
+	double beta;
+	double Rd;
+	double Catm;
+	double b0;
+	double b1;
+	struct c4_surface *surface;
+	struct canopy_start *start;
+};
+
+void CanAC_scenarios(int scenarios, const struct canopy_scenario scenario[], int DOY, int hr,
+		     double solarR, double Temp, double RH, double WindSpeed, double lat, int nlayers,
+		     double kd, double chil, double heightf, double kpLN, int lnfun, double upperT,
+		     double lowerT, struct nitroParms nitroP, double leafwidth, int eteq, int ws,
+		     int dark_canopy, int coupled_leaf, enum leaf_solver leaf_solver, int gauss_layering,
+		     const struct solar_table *solar, struct Can_Str results[]);
          
 struct Can_Str c3CanAC(double LAI, int DOY, int hr, double solarR, double Temp,
                        double RH, double WindSpeed, double lat, int nlayers, double Vmax, double Jmax,
   	                   double Rd, double Catm, double o2, double b0, double b1,
                        double theta, double kd, double heightf,
-		                    double leafN, double kpLN, double lnb0, double lnb1, int lnfun, double StomataWS, int ws);
+		                    double leafN, double kpLN, double lnb0, double lnb1, int lnfun, double StomataWS, int ws,
+                       int coupled_leaf, const struct solar_table *solar, struct canopy_start *start);
                         
 /**************** This is new C function avoiding use of Global Variables****************************/
+/* canopy, from allocateCanopy, is reused when not NULL; see c3canopy.h */
+struct canopy;
  struct Can_Str newc3CanAC(double LAI, int DOY, int hr, double solarR, double Temp,
                double RH, double WindSpeed, double lat, int nlayers, double Vmax, double Jmax,
 		     double Rd, double Catm, double o2, double b0, double b1,
                      double theta, double kd, double heightf,
-		     double leafN, double kpLN, double lnb0, double lnb1, int lnfun, double StomWS, int ws);
+		     double leafN, double kpLN, double lnb0, double lnb1, int lnfun, double StomWS, int ws,
+		     int coupled_leaf, const struct solar_table *solar, struct canopy *canopy);
  /**********************************************************************************************/
 
          
@@ -110,7 +342,7 @@ struct ws_str watstr(double precipit, double evapo, double cws, double soildepth
 double SoilEvapo(double LAI, double k, double AirTemp, double DirectRad,
 		 double awc, double fieldc, double wiltp, double winds, double RelH, double rsec);
 
-struct soilML_str soilML(double precipit, double transp, double *cws, double soildepth,
+void soilML(struct soil_column *soil, double precipit, double transp, double soildepth,
 			 double *depths, double fieldc, double wiltp, double phi1, double phi2,
                          struct soilText_str soTexS, int wsFun, int layers, double rootDB,
 			 double LAI, double k, double AirTemp, double IRad, double winds, double RelH,
@@ -123,13 +355,30 @@ double TempToDdryA(double Temp);
 void RHprof(double RH, int nlayers, double* relative_humidity_profile);
 void WINDprof(double WindSpeed, double LAI, int nlayers, double* wind_speed_profile);
 struct Light_profile sunML(double Idir, double Idiff, double LAI, int nlayers, double cosTheta, double kd, double chil, double heightf);
+void gauss_layers(double LAI, int nlayers, double* depth, double* thickness);
+struct Light_profile sunML_at(double Idir, double Idiff, double LAI, int nlayers, const double* depth, const double* thickness,
+        double cosTheta, double kd, double chil, double heightf);
+void RHprof_at(double RH, double LAI, int nlayers, const double* depth, double* relative_humidity_profile);
+void WINDprof_at(double WindSpeed, int nlayers, const double* depth, double* wind_speed_profile);
+void LNprof_at(double LeafN, int nlayers, const double* depth, double kpLN, double* leafN_profile);
 struct Light_model lightME(double lat, int DOY, int td);
 
+/* lightME for every hour of every day at one latitude, shared by all the
+ * runs at that latitude. See solar_table.c. */
+#define SOLAR_TABLE_DAYS 366
+struct solar_table {
+	double lat;
+	struct Light_model light[SOLAR_TABLE_DAYS][24];
+};
+
+const struct solar_table *solar_table_for(double lat);
+struct Light_model solar_light(const struct solar_table *table, double lat, int DOY, int hr);
+
 struct cenT_str Century(double *LeafL, double *StemL, double *RootL, double *RhizL, double smoist, double stemp, int timestep, 
 			double SCs[9] , double leachWater, double Nfert, double MinN, double precip,
 			double LeafL_Ln, double StemL_Ln, double RootL_Ln, double RhizL_Ln,
 			double LeafL_N, double StemL_N, double RootL_N, double RhizL_N, int soilType,
-			double Ks_cf[8]);
+			double Ks_cf[8], int exponential);
 
 struct FL_str FmLcFun(double Lig, double Nit);
 
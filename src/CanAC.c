@@ -1,45 +1,87 @@
+#include <stddef.h>
 #include "BioCro.h"
 #include "c4photo.h"
+#include "leaf_coupled.h"
 
-struct Can_Str CanAC(
-		double LAI,
-        int DOY,
-        int hr,
-        double solarR,
-        double Temp,
-        double RH,
-        double WindSpeed,
-        double lat,
-        int nlayers,
-        double Vmax,
-        double Alpha,
-        double Kparm,
-        double beta,
-        double Rd,
-        double Catm,
-        double b0,
-        double b1,
-        double theta,
-        double kd,
-        double chil,
-        double heightf,
-        double leafN,
-        double kpLN,
-        double lnb0,
-        double lnb1,
-        int lnfun,
-        double upperT,
-        double lowerT,
-        struct nitroParms nitroP,
-        double leafwidth,
-        int eteq,
-        double StomataWS,
-        int ws)
+static void solve_leaves(enum leaf_solver leaf_solver, struct c4_surface *surface, int n, const double Qp[], const double Tl[], const double RH[],
+        const double vmax[], const double alpha[], const double Rd[],
+        double kparm, double theta, double beta, double bb0, double bb1,
+        double StomaWS, double Ca, int ws, double upperT, double lowerT,
+        const double start_Ci[], const double start_Assim[],
+        struct c4_str results[])
+{
+    /* Without a surface its leaves are solved by the bracketed solver it
+       would have been built from */
+    if(leaf_solver == LEAF_SOLVER_SURFACE && surface != NULL)
+        c4photoC_surface_batch(surface, n, Qp, Tl, RH, vmax, alpha, Rd, kparm, theta, beta, bb0, bb1,
+                StomaWS, Ca, ws, upperT, lowerT, results);
+    else if(leaf_solver == LEAF_SOLVER_BRACKETED || leaf_solver == LEAF_SOLVER_SURFACE)
+        c4photoC_bracketed_batch(n, Qp, Tl, RH, vmax, alpha, Rd, kparm, theta, beta, bb0, bb1,
+                StomaWS, Ca, ws, upperT, lowerT, results);
+    else
+        c4photoC_batch(n, Qp, Tl, RH, vmax, alpha, Rd, kparm, theta, beta, bb0, bb1,
+                StomaWS, Ca, ws, upperT, lowerT, start_Ci, start_Assim, results);
+}
+
+static void count_solves(struct Can_Str *ans, const struct c4_str photo[], int n)
+{
+    int i;
+    for(i=0; i<n; i++)
+    {
+        if(photo[i].iterations > 0) {
+            ans->photo_solves++;
+            ans->photo_iterations += photo[i].iterations;
+        }
+    }
+}
+
+/* The light, humidity, wind and leaf nitrogen of each layer. They depend
+   on the weather and on the LAI and leaf nitrogen of the canopy, but not
+   on the parameters of its leaves. */
+struct canopy_profiles {
+    struct Light_profile light;
+    double relative_humidity[MAXLAY];
+    double wind_speed[MAXLAY];
+    double leafN[MAXLAY];
+    double layerLAI[MAXLAY];
+};
+
+static void canopy_profiles(struct canopy_profiles *profiles, double Idir, double Idiff, double cosTh,
+        double LAI, double RH, double WindSpeed, int nlayers, double kd, double chil, double heightf,
+        double leafN, double kpLN, int gauss_layering)
+{
+    int i;
+    double LAIc;
+
+    if(gauss_layering) {
+        double depth[nlayers];
+        gauss_layers(LAI, nlayers, depth, profiles->layerLAI);
+        profiles->light = sunML_at(Idir, Idiff, LAI, nlayers, depth, profiles->layerLAI, cosTh, kd, chil, heightf);
+        RHprof_at(RH, LAI, nlayers, depth, profiles->relative_humidity);
+        WINDprof_at(WindSpeed, nlayers, depth, profiles->wind_speed);
+        LNprof_at(leafN, nlayers, depth, kpLN, profiles->leafN);
+    } else {
+        profiles->light = sunML(Idir, Idiff, LAI, nlayers, cosTh, kd, chil, heightf);
+
+        /* results from multilayer model */
+        LAIc = LAI / nlayers;
+        for(i=0; i<nlayers; i++) profiles->layerLAI[i] = LAIc;
+
+        /* Next I need the RH and wind profile */
+        RHprof(RH, nlayers, profiles->relative_humidity);
+        WINDprof(WindSpeed, LAI, nlayers, profiles->wind_speed);
+        LNprof(leafN, LAI, nlayers, kpLN, profiles->leafN);
+    }
+}
+
+/* The leaves of one scenario in a canopy with the given profiles */
+static struct Can_Str canopy_leaves(const struct canopy_profiles *profiles, const struct canopy_scenario *scenario,
+        double solarR, double Temp, int nlayers, int lnfun, double upperT, double lowerT,
+        struct nitroParms nitroP, double leafwidth, int eteq, int ws, int dark_canopy,
+        int coupled_leaf, enum leaf_solver leaf_solver)
 {
 
     struct Can_Str ans = {0, 0, 0};
-    struct ET_Str tmp5_ET, tmp6_ET;
-    struct c4_str temp_photo_results = {0, 0, 0, 0};
 
     const double cf = 3600 * 1e-6 * 30 * 1e-6 * 10000;
     /* For Assimilation */
@@ -58,11 +100,28 @@ struct Can_Str CanAC(
     /* 1e-6 - megagrams per  gram */
     /* 10000 - meters squared per hectare */
 
-    int i;
-    double Idir, Idiff, cosTh;
-    double LAIc;
-    double IDir, IDiff, Itot, rh, layerWindSpeed;
-    double TempIdir = 0.0, TempIdiff = 0.0, AssIdir = 0.0, AssIdiff = 0.0, GAssIdir = 0.0 , GAssIdiff = 0.0;
+    const struct Light_profile *light_profile = &profiles->light;
+    const double *relative_humidity_profile = profiles->relative_humidity;
+    const double *wind_speed_profile = profiles->wind_speed;
+    const double *leafN_profile = profiles->leafN;
+    const double *layerLAI = profiles->layerLAI;
+
+    const double Vmax = scenario->Vmax;
+    const double Kparm = scenario->Kparm;
+    const double theta = scenario->theta;
+    const double beta = scenario->beta;
+    const double Catm = scenario->Catm;
+    const double b0 = scenario->b0;
+    const double b1 = scenario->b1;
+    const double StomataWS = scenario->StomataWS;
+    double Alpha = scenario->Alpha;
+    double Rd = scenario->Rd;
+    struct c4_surface *surface = scenario->surface;
+    struct canopy_start *start = scenario->start;
+
+    int i, sun, shade;
+    int leaves = 2 * nlayers;
+    double Itot, layerWindSpeed;
     double pLeafsun, pLeafshade;
     double Leafsun = 0.0, Leafshade = 0.0;
 
@@ -72,28 +131,14 @@ struct Can_Str CanAC(
 
     double vmax1, leafN_lay;
 
-    struct Light_model light_model;
-    light_model = lightME(lat, DOY, hr);
-
-    Idir = light_model.irradiance_direct * solarR;
-    Idiff = light_model.irradiance_diffuse * solarR;
-    cosTh = light_model.cosine_zenith_angle;
-
-    struct Light_profile light_profile;
-    light_profile = sunML(Idir, Idiff, LAI, nlayers, cosTh, kd, chil, heightf);
-
-    /* results from multilayer model */
-    LAIc = LAI / nlayers;
-
-    /* Next I need the RH and wind profile */
-    double relative_humidity_profile[nlayers];
-    RHprof(RH, nlayers, relative_humidity_profile);
-
-    double wind_speed_profile[nlayers];
-    WINDprof(WindSpeed, LAI, nlayers, wind_speed_profile);
-
-    double leafN_profile[nlayers];
-    LNprof(leafN, LAI, nlayers, kpLN, leafN_profile);
+    /* One element per leaf: the sunlit leaves of the layers in the order
+       they are visited, followed by the shaded leaves */
+    double leafQp[leaves], leafTemp[leaves], leafRH[leaves];
+    double leafVmax[leaves], leafAlpha[leaves], leafRd[leaves];
+    struct c4_str leaf_photo[leaves];
+    struct ET_Str leaf_ET[leaves];
+    double leafCi[leaves], leafAssim[leaves];
+    const double *start_Ci = NULL, *start_Assim = NULL;
 
     for(i=0; i<nlayers; i++)
     {
@@ -109,37 +154,109 @@ struct Can_Str CanAC(
             Rd=nitroP.Rdb1*leafN_lay+nitroP.Rdb0;
         }
 
-        rh = relative_humidity_profile[current_layer];
-        layerWindSpeed = wind_speed_profile[current_layer];
-
-        IDir = light_profile.direct_irradiance[current_layer];
-        Itot = light_profile.total_irradiance[current_layer];
-        pLeafsun = light_profile.sunlit_fraction[current_layer];
-        CanHeight = light_profile.height[current_layer];
-        Leafsun = LAIc * pLeafsun;
-
-        temp_photo_results = c4photoC(IDir, Temp, rh, vmax1, Alpha, Kparm, theta, beta, Rd, b0, b1, StomataWS, Catm, ws, upperT, lowerT);
-        tmp5_ET = EvapoTrans2(IDir, Itot, Temp, rh, layerWindSpeed, LAIc, CanHeight, temp_photo_results.Gs, leafwidth, eteq);
-
-        TempIdir = Temp + tmp5_ET.Deltat;
-        temp_photo_results = c4photoC(IDir, TempIdir, rh, vmax1, Alpha, Kparm, theta, beta, Rd, b0, b1, StomataWS, Catm, ws, upperT, lowerT);
-        AssIdir = temp_photo_results.Assim;
-        GAssIdir =temp_photo_results.GrossAssim;
-
-        IDiff = light_profile.diffuse_irradiance[current_layer];
-        pLeafshade = light_profile.shaded_fraction[current_layer];
-        Leafshade = LAIc * pLeafshade;
-
-        temp_photo_results = c4photoC(IDiff, Temp, rh, vmax1, Alpha, Kparm, theta, beta, Rd, b0, b1, StomataWS, Catm, ws, upperT, lowerT);
-        tmp6_ET = EvapoTrans2(IDiff, Itot, Temp, rh, layerWindSpeed, LAIc, CanHeight, temp_photo_results.Gs, leafwidth, eteq);
-        TempIdiff = Temp + tmp6_ET.Deltat;
-        temp_photo_results = c4photoC(IDiff, TempIdiff, rh, vmax1, Alpha, Kparm, theta, beta, Rd, b0, b1, StomataWS, Catm, ws, upperT, lowerT);
-        AssIdiff = temp_photo_results.Assim;
-        GAssIdiff = temp_photo_results.GrossAssim;
-
-        CanopyA += Leafsun * AssIdir + Leafshade * AssIdiff;
-        CanopyT += Leafsun * tmp5_ET.TransR + Leafshade * tmp6_ET.TransR;
-        GCanopyA += Leafsun * GAssIdir + Leafshade * GAssIdiff;
+        sun = i;
+        shade = nlayers + i;
+        leafQp[sun] = light_profile->direct_irradiance[current_layer];
+        leafQp[shade] = light_profile->diffuse_irradiance[current_layer];
+        leafRH[sun] = leafRH[shade] = relative_humidity_profile[current_layer];
+        leafTemp[sun] = leafTemp[shade] = Temp;
+        leafVmax[sun] = leafVmax[shade] = vmax1;
+        leafAlpha[sun] = leafAlpha[shade] = Alpha;
+        leafRd[sun] = leafRd[shade] = Rd;
+    }
+
+    /* Layers with their own Vmax, alpha and Rd are not on one surface */
+    if(lnfun != 0) surface = NULL;
+
+    if(dark_canopy && solarR == 0) {
+        /* Without light sunlit and shaded leaves get the same inputs,
+           so one leaf gives both and c4photoC reduces to respiration */
+        for(i=0; i<nlayers; i++)
+        {
+            int current_layer = nlayers - 1 - i;
+            layerWindSpeed = wind_speed_profile[current_layer];
+            Itot = light_profile->total_irradiance[current_layer];
+            CanHeight = light_profile->height[current_layer];
+
+            leaf_photo[i] = c4photoC_dark(Temp, leafRH[i], leafVmax[i], leafAlpha[i], Kparm, theta, beta, leafRd[i], b0, b1, StomataWS, Catm, ws, upperT, lowerT);
+            leaf_ET[i] = EvapoTrans2(leafQp[i], Itot, Temp, leafRH[i], layerWindSpeed, layerLAI[current_layer], CanHeight, leaf_photo[i].Gs, leafwidth, eteq);
+            leaf_photo[i] = c4photoC_dark(Temp + leaf_ET[i].Deltat, leafRH[i], leafVmax[i], leafAlpha[i], Kparm, theta, beta, leafRd[i], b0, b1, StomataWS, Catm, ws, upperT, lowerT);
+
+            leaf_photo[nlayers + i] = leaf_photo[i];
+            leaf_ET[nlayers + i] = leaf_ET[i];
+        }
+    } else if(coupled_leaf) {
+        if(start != NULL && start->leaves == leaves) start_Ci = start->Ci;
+        for(i=0; i<leaves; i++)
+        {
+            int current_layer = nlayers - 1 - i % nlayers;
+            layerWindSpeed = wind_speed_profile[current_layer];
+            Itot = light_profile->total_irradiance[current_layer];
+            CanHeight = light_profile->height[current_layer];
+
+            leaf_photo[i] = c4photoC_coupled(leafQp[i], Itot, Temp, leafRH[i], layerWindSpeed, layerLAI[current_layer], CanHeight,
+                    leafwidth, eteq, leafVmax[i], leafAlpha[i], Kparm, theta, beta, leafRd[i], b0, b1,
+                    StomataWS, Catm, ws, upperT, lowerT, start_Ci != NULL ? start_Ci[i] : 0, &leaf_ET[i]);
+        }
+        count_solves(&ans, leaf_photo, leaves);
+    } else {
+        /* Stomatal conductance at air temperature, then the leaf
+           temperature it gives, then photosynthesis at that temperature */
+        if(start != NULL && start->leaves == leaves) {
+            start_Ci = start->Ci;
+            start_Assim = start->Assim;
+        }
+        solve_leaves(leaf_solver, surface, leaves, leafQp, leafTemp, leafRH, leafVmax, leafAlpha, leafRd,
+                Kparm, theta, beta, b0, b1, StomataWS, Catm, ws, upperT, lowerT,
+                start_Ci, start_Assim, leaf_photo);
+        count_solves(&ans, leaf_photo, leaves);
+
+        for(i=0; i<leaves; i++)
+        {
+            int current_layer = nlayers - 1 - i % nlayers;
+            layerWindSpeed = wind_speed_profile[current_layer];
+            Itot = light_profile->total_irradiance[current_layer];
+            CanHeight = light_profile->height[current_layer];
+
+            leaf_ET[i] = EvapoTrans2(leafQp[i], Itot, Temp, leafRH[i], layerWindSpeed, layerLAI[current_layer], CanHeight, leaf_photo[i].Gs, leafwidth, eteq);
+            leafTemp[i] = Temp + leaf_ET[i].Deltat;
+            leafCi[i] = leaf_photo[i].Ci;
+            leafAssim[i] = leaf_photo[i].Assim;
+        }
+
+        if(start != NULL) {
+            start_Ci = leafCi;
+            start_Assim = leafAssim;
+        }
+        solve_leaves(leaf_solver, surface, leaves, leafQp, leafTemp, leafRH, leafVmax, leafAlpha, leafRd,
+                Kparm, theta, beta, b0, b1, StomataWS, Catm, ws, upperT, lowerT,
+                start_Ci, start_Assim, leaf_photo);
+        count_solves(&ans, leaf_photo, leaves);
+    }
+
+    if(start != NULL) {
+        start->leaves = leaves;
+        for(i=0; i<leaves; i++)
+        {
+            start->Ci[i] = leaf_photo[i].Ci;
+            start->Assim[i] = leaf_photo[i].Assim;
+        }
+    }
+
+    for(i=0; i<nlayers; i++)
+    {
+        int current_layer = nlayers - 1 - i;
+        sun = i;
+        shade = nlayers + i;
+
+        pLeafsun = light_profile->sunlit_fraction[current_layer];
+        Leafsun = layerLAI[current_layer] * pLeafsun;
+        pLeafshade = light_profile->shaded_fraction[current_layer];
+        Leafshade = layerLAI[current_layer] * pLeafshade;
+
+        CanopyA += Leafsun * leaf_photo[sun].Assim + Leafshade * leaf_photo[shade].Assim;
+        CanopyT += Leafsun * leaf_ET[sun].TransR + Leafshade * leaf_ET[shade].TransR;
+        GCanopyA += Leafsun * leaf_photo[sun].GrossAssim + Leafshade * leaf_photo[shade].GrossAssim;
     }
     /*## These are micromoles of CO2 per m2 per sec for Assimilation
 ## and mili mols of H2O per m2 per sec for Transpiration
@@ -158,3 +275,147 @@ struct Can_Str CanAC(
     return(ans);
 }
 
+/* CanAC for several scenarios at one hour of one site, results[k] being
+   the canopy of scenario[k]. The position of the sun is found once and
+   the profiles of the layers are computed for the first scenario and
+   again only for a scenario whose LAI or leaf nitrogen differ from those
+   of the one before it, so scenarios with the same canopy should be next
+   to each other. Each scenario is otherwise solved as by CanAC. */
+void CanAC_scenarios(
+        int scenarios,
+        const struct canopy_scenario scenario[],
+        int DOY,
+        int hr,
+        double solarR,
+        double Temp,
+        double RH,
+        double WindSpeed,
+        double lat,
+        int nlayers,
+        double kd,
+        double chil,
+        double heightf,
+        double kpLN,
+        int lnfun,
+        double upperT,
+        double lowerT,
+        struct nitroParms nitroP,
+        double leafwidth,
+        int eteq,
+        int ws,
+        int dark_canopy,
+        int coupled_leaf,
+        enum leaf_solver leaf_solver,
+        int gauss_layering,
+        const struct solar_table *solar,
+        struct Can_Str results[])
+{
+    int k;
+    double Idir, Idiff, cosTh;
+    struct canopy_profiles profiles;
+
+    struct Light_model light_model;
+    light_model = solar_light(solar, lat, DOY, hr);
+
+    Idir = light_model.irradiance_direct * solarR;
+    Idiff = light_model.irradiance_diffuse * solarR;
+    cosTh = light_model.cosine_zenith_angle;
+
+    for(k=0; k<scenarios; k++)
+    {
+        if(k == 0 || scenario[k].LAI != scenario[k-1].LAI || scenario[k].leafN != scenario[k-1].leafN)
+            canopy_profiles(&profiles, Idir, Idiff, cosTh, scenario[k].LAI, RH, WindSpeed, nlayers,
+                    kd, chil, heightf, scenario[k].leafN, kpLN, gauss_layering);
+        results[k] = canopy_leaves(&profiles, &scenario[k], solarR, Temp, nlayers, lnfun, upperT, lowerT,
+                nitroP, leafwidth, eteq, ws, dark_canopy, coupled_leaf, leaf_solver);
+    }
+}
+
+/* When start is not NULL the photosynthesis solves start from an earlier
+   solve of the same leaf: the solve at air temperature from the last call
+   and the solve at leaf temperature from the one at air temperature. The
+   last solve of each leaf is stored back into start. With NULL every solve
+   starts from the usual guess.
+
+   With coupled_leaf the leaf temperature, conductance and assimilation of
+   each leaf are solved together by c4photoC_coupled instead, and start
+   only gives the Ci to start from. Otherwise with LEAF_SOLVER_BRACKETED
+   the photosynthesis solves are those of c4photoC_bracketed, which need
+   no start.
+
+   With gauss_layering the nlayers layers are the nodes of Gauss-Legendre
+   quadrature over the LAI, see gauss_layers, instead of equal slices of
+   it.
+
+   With LEAF_SOLVER_SURFACE, when surface is not NULL and every layer has
+   the same Vmax, alpha and Rd (lnfun 0), the photosynthesis solves are
+   read from it instead, see c4photoC_surface_batch; otherwise they are
+   those of c4photoC_bracketed.
+
+   The light at the top of the canopy is looked up in solar, which may be
+   NULL, see solar_light. */
+struct Can_Str CanAC(
+		double LAI,
+        int DOY,
+        int hr,
+        double solarR,
+        double Temp,
+        double RH,
+        double WindSpeed,
+        double lat,
+        int nlayers,
+        double Vmax,
+        double Alpha,
+        double Kparm,
+        double beta,
+        double Rd,
+        double Catm,
+        double b0,
+        double b1,
+        double theta,
+        double kd,
+        double chil,
+        double heightf,
+        double leafN,
+        double kpLN,
+        double lnb0,
+        double lnb1,
+        int lnfun,
+        double upperT,
+        double lowerT,
+        struct nitroParms nitroP,
+        double leafwidth,
+        int eteq,
+        double StomataWS,
+        int ws,
+        int dark_canopy,
+        int coupled_leaf,
+        enum leaf_solver leaf_solver,
+        int gauss_layering,
+        struct c4_surface *surface,
+        const struct solar_table *solar,
+        struct canopy_start *start)
+{
+    struct canopy_scenario scenario;
+    struct Can_Str ans;
+
+    scenario.LAI = LAI;
+    scenario.leafN = leafN;
+    scenario.StomataWS = StomataWS;
+    scenario.Vmax = Vmax;
+    scenario.Alpha = Alpha;
+    scenario.Kparm = Kparm;
+    scenario.theta = theta;
+    scenario.beta = beta;
+    scenario.Rd = Rd;
+    scenario.Catm = Catm;
+    scenario.b0 = b0;
+    scenario.b1 = b1;
+    scenario.surface = surface;
+    scenario.start = start;
+
+    CanAC_scenarios(1, &scenario, DOY, hr, solarR, Temp, RH, WindSpeed, lat, nlayers, kd, chil, heightf,
+            kpLN, lnfun, upperT, lowerT, nitroP, leafwidth, eteq, ws, dark_canopy, coupled_leaf,
+            leaf_solver, gauss_layering, solar, &ans);
+    return(ans);
+}
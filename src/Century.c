@@ -6,9 +6,109 @@
 #include <R.h>
 #include <Rinternals.h>
 #include <math.h>
+#include <float.h>
 #include "Century.h"
 #include "AuxBioCro.h"
 
+/* Pools of the exponential step. The litter of the step and the surface
+   and root litter pools are split as in the explicit step, and each part
+   decomposes at its own rate. RESPIRED and MINERALIZED collect the C
+   respired and the N mineralized during the step. */
+enum century_pool {
+  LEAF_STRUCTURAL, STEM_STRUCTURAL, LEAF_LIGNIN, STEM_LIGNIN,
+  LEAF_METABOLIC, STEM_METABOLIC,
+  ROOT_STRUCTURAL, RHIZ_STRUCTURAL, ROOT_LIGNIN, RHIZ_LIGNIN,
+  ROOT_METABOLIC, RHIZ_METABOLIC,
+  SURFACE_MICROBE, SOIL_MICROBE, SLOW, PASSIVE,
+  LEACHED, RESPIRED, MINERALIZED, CENTURY_POOLS
+};
+/* The pools before LEACHED decompose */
+#define CENTURY_DECAYING LEACHED
+/* Terms of the series are added until they change the pools by less than
+   this fraction, or this many have been added */
+#define CENTURY_SERIES_TOLERANCE DBL_EPSILON
+#define CENTURY_MAX_TERMS 40
+
+/* A pool decomposes at rate k per step. The fraction resp of what
+   decomposes is respired, mineralizing resp / CN of N, and the rest goes
+   to the pools in to, in the shares given. */
+struct century_flow {
+  double k;
+  double resp;
+  double CN;
+  int to[3];
+  double share[3];
+};
+
+static void set_flow(struct century_flow *flow, double k, double resp, double CN,
+                     int to0, int to1, int to2, const double share[3])
+{
+  flow->k = k;
+  flow->resp = resp;
+  flow->CN = CN;
+  flow->to[0] = to0;
+  flow->to[1] = to1;
+  flow->to[2] = to2;
+  flow->share[0] = share[0];
+  flow->share[1] = share[1];
+  flow->share[2] = share[2];
+}
+
+/* The rate of change of the pools x with the flows frozen over the step */
+static void century_rates(const struct century_flow flows[], const double x[], double dx[])
+{
+  double d;
+  int i, j;
+
+  for(i = 0; i < CENTURY_POOLS; i++) dx[i] = 0.0;
+  for(i = 0; i < CENTURY_DECAYING; i++){
+    d = flows[i].k * x[i];
+    dx[i] -= d;
+    dx[RESPIRED] += flows[i].resp * d;
+    dx[MINERALIZED] += flows[i].resp * d / flows[i].CN;
+    for(j = 0; j < 3; j++)
+      if(flows[i].to[j] >= 0)
+        dx[flows[i].to[j]] += flows[i].share[j] * (1 - flows[i].resp) * d;
+  }
+}
+
+/* Advances the pools x over one step with the flows frozen, x = exp(A) x
+   for the linear system of century_rates. The exponential is applied as
+   its Taylor series in substeps short enough that the norm of the system
+   over each is at most one (Al-Mohy and Higham 2011 SIAM J. Sci. Comput.
+   33:488), so the terms fall at least as fast as 1 / n! and the result is
+   exact to rounding for any length of step. */
+static void century_exponential(const struct century_flow flows[], double x[])
+{
+  double term[CENTURY_POOLS], next[CENTURY_POOLS];
+  double norm = 0.0, column, size, change;
+  int i, j, n, substep, substeps;
+
+  /* The 1-norm of the system, its largest column sum */
+  for(i = 0; i < CENTURY_DECAYING; i++){
+    column = 1 + flows[i].resp + flows[i].resp / fabs(flows[i].CN);
+    for(j = 0; j < 3; j++)
+      if(flows[i].to[j] >= 0) column += fabs(flows[i].share[j]) * (1 - flows[i].resp);
+    if(flows[i].k * column > norm) norm = flows[i].k * column;
+  }
+  substeps = norm > 1 ? (int)ceil(norm) : 1;
+
+  for(substep = 0; substep < substeps; substep++){
+    for(i = 0; i < CENTURY_POOLS; i++) term[i] = x[i];
+    for(n = 1; n <= CENTURY_MAX_TERMS; n++){
+      century_rates(flows, term, next);
+      size = change = 0.0;
+      for(i = 0; i < CENTURY_POOLS; i++){
+        term[i] = next[i] / (substeps * n);
+        x[i] += term[i];
+        size += fabs(x[i]);
+        change += fabs(term[i]);
+      }
+      if(change <= CENTURY_SERIES_TOLERANCE * size) break;
+    }
+  }
+}
+
 /* 
 
 Begining of the Centurty function In this function the input should be
@@ -39,7 +139,8 @@ struct cenT_str Century(double *LeafL,
 			double RootL_N, 
 			double RhizL_N, 
 			int soilType, 
-	                double Ks_cf[8]){
+	                double Ks_cf[8],
+			int exponential){
 
   /* Converting Mg ha^-1 to g m^-2 */
   /* 1 Mg = 1e6 grams*/
@@ -123,6 +224,7 @@ struct cenT_str Century(double *LeafL,
   const double respC8 = 0.55;
 
   double Ks[8];
+  int i;
   
   /*  Tm is the effect of soil texture on active SOM turnover */
   double Tm = 1 - 0.75 * T;
@@ -163,7 +265,9 @@ struct cenT_str Century(double *LeafL,
        Ks[5] = Ks_cf[5] / 365 ; 
        Ks[6] = Ks_cf[6] / 365 ; 
        Ks[7] = Ks_cf[7] / 365 ;  
-     } 
+     }else{
+       for(i = 0; i < 8; i++) Ks[i] = Ks_cf[i] * timestep / 365 ;
+     }
 
 /* Nitrogen processes 
     N deposition */
@@ -187,6 +291,9 @@ struct cenT_str Century(double *LeafL,
   if(timestep == 1){
      Na /=  365;
      Nf /=  365;
+  }else{
+     Na *= timestep / 365.0;
+     Nf *= timestep / 365.0;
   }
 
 /*   Rprintf("Na : %f \n",Na); */
@@ -260,6 +367,99 @@ struct cenT_str Century(double *LeafL,
   SC3_Root = SC3_Root - SC3_Root_Ln;
   SC3_Rhiz = SC3_Rhiz - SC3_Rhiz_Ln;
 
+  if(exponential){
+    double x[CENTURY_POOLS];
+    struct century_flow flows[CENTURY_DECAYING];
+    const double whole[3] = {1, 0, 0};
+    double from6[3], from7[3];
+
+    C_ap = 0.003 + 0.032 * Tc;
+    C_al = leachWater / 18.0 * (0.01 + 0.04 * Ts);
+    C_sp = 0.003 - 0.009 *Tc;
+    from6[0] = C_ap;
+    from6[1] = C_al;
+    from6[2] = 1 - C_ap - C_al;
+    from7[0] = C_sp;
+    from7[1] = 1 - C_sp;
+    from7[2] = 0;
+
+    x[LEAF_STRUCTURAL] = SC1_Leaf + 0.3 * SC1;
+    x[STEM_STRUCTURAL] = SC1_Stem + 0.7 * SC1;
+    x[LEAF_LIGNIN] = SC1_Leaf_Ln;
+    x[STEM_LIGNIN] = SC1_Stem_Ln;
+    x[LEAF_METABOLIC] = SC2_Leaf + 0.3 * SC2;
+    x[STEM_METABOLIC] = SC2_Stem + 0.7 * SC2;
+    x[ROOT_STRUCTURAL] = SC3_Root + 0.3 * SC3;
+    x[RHIZ_STRUCTURAL] = SC3_Rhiz + 0.7 * SC3;
+    x[ROOT_LIGNIN] = SC3_Root_Ln;
+    x[RHIZ_LIGNIN] = SC3_Rhiz_Ln;
+    x[ROOT_METABOLIC] = SC4_Root + 0.3 * SC4;
+    x[RHIZ_METABOLIC] = SC4_Rhiz + 0.7 * SC4;
+    x[SURFACE_MICROBE] = SC5;
+    x[SOIL_MICROBE] = SC6;
+    x[SLOW] = SC7;
+    x[PASSIVE] = SC8;
+    x[LEACHED] = SC9;
+    x[RESPIRED] = x[MINERALIZED] = 0.0;
+
+    /* The rates, respiration and C to N ratios of the flows of the
+       explicit step */
+    set_flow(&flows[LEAF_STRUCTURAL], Ks[0] * FmLc_Leaf.Lc * Abiot, respC1_5, CN_surface, SURFACE_MICROBE, -1, -1, whole);
+    set_flow(&flows[STEM_STRUCTURAL], Ks[0] * FmLc_Stem.Lc * Abiot, respC2_5, CN_surface, SURFACE_MICROBE, -1, -1, whole);
+    set_flow(&flows[LEAF_LIGNIN], Ks[0] * FmLc_Leaf.Lc * Abiot, respC1_7, CN_surface, SLOW, -1, -1, whole);
+    set_flow(&flows[STEM_LIGNIN], Ks[0] * FmLc_Stem.Lc * Abiot, respC1_7, CN_surface, SLOW, -1, -1, whole);
+    set_flow(&flows[LEAF_METABOLIC], Ks[4] * Abiot, respC1_5, CN_surface, SURFACE_MICROBE, -1, -1, whole);
+    set_flow(&flows[STEM_METABOLIC], Ks[4] * Abiot, respC2_5, CN_surface, SURFACE_MICROBE, -1, -1, whole);
+    set_flow(&flows[ROOT_STRUCTURAL], Ks[1] * FmLc_Root.Lc * Abiot, respC3_6, CN_active, SOIL_MICROBE, -1, -1, whole);
+    set_flow(&flows[RHIZ_STRUCTURAL], Ks[1] * FmLc_Rhiz.Lc * Abiot, respC4_6, CN_active, SOIL_MICROBE, -1, -1, whole);
+    set_flow(&flows[ROOT_LIGNIN], Ks[1] * FmLc_Root.Lc * Abiot, respC3_7, CN_slow, SLOW, -1, -1, whole);
+    set_flow(&flows[RHIZ_LIGNIN], Ks[1] * FmLc_Rhiz.Lc * Abiot, respC3_7, CN_slow, SLOW, -1, -1, whole);
+    set_flow(&flows[ROOT_METABOLIC], Ks[5] * Abiot, respC3_6, CN_active, SOIL_MICROBE, -1, -1, whole);
+    set_flow(&flows[RHIZ_METABOLIC], Ks[5] * Abiot, respC4_6, CN_active, SOIL_MICROBE, -1, -1, whole);
+    set_flow(&flows[SURFACE_MICROBE], Ks[3] * Abiot, respC5_7, CN_slow, SLOW, -1, -1, whole);
+    set_flow(&flows[SOIL_MICROBE], Ks[2] * Abiot * Tm, respC6, CN_slow, PASSIVE, LEACHED, SLOW, from6);
+    set_flow(&flows[SLOW], Ks[6] * Abiot, respC7, CN_slow, PASSIVE, SOIL_MICROBE, -1, from7);
+    set_flow(&flows[PASSIVE], Ks[7] * Abiot, respC8, CN_passive, SOIL_MICROBE, -1, -1, whole);
+
+    century_exponential(flows, x);
+
+    SC1 = x[LEAF_STRUCTURAL] + x[STEM_STRUCTURAL] + x[LEAF_LIGNIN] + x[STEM_LIGNIN];
+    SC2 = x[LEAF_METABOLIC] + x[STEM_METABOLIC];
+    SC3 = x[ROOT_STRUCTURAL] + x[RHIZ_STRUCTURAL] + x[ROOT_LIGNIN] + x[RHIZ_LIGNIN];
+    SC4 = x[ROOT_METABOLIC] + x[RHIZ_METABOLIC];
+
+    tmp.SCs[0] = SC1 / cf;
+    tmp.SCs[1] = SC2 / cf;
+    tmp.SCs[2] = SC3 / cf;
+    tmp.SCs[3] = SC4 / cf;
+    tmp.SCs[4] = x[SURFACE_MICROBE] / cf;
+    tmp.SCs[5] = x[SOIL_MICROBE] / cf;
+    tmp.SCs[6] = x[SLOW] / cf;
+    tmp.SCs[7] = x[PASSIVE] / cf;
+    tmp.SCs[8] = x[LEACHED] / cf;
+
+    /* Each pool holds the N of its C at the C to N ratio of its flows */
+    tmp.SNs[0] = SC1 / CN_structural / cf;
+    tmp.SNs[1] = SC2 / CN_surface / cf;
+    tmp.SNs[2] = SC3 / CN_structural / cf;
+    tmp.SNs[3] = SC4 / CN_active / cf;
+    tmp.SNs[4] = x[SURFACE_MICROBE] / CN_surface / cf;
+    tmp.SNs[5] = x[SOIL_MICROBE] / CN_active / cf;
+    tmp.SNs[6] = x[SLOW] / CN_slow / cf;
+    tmp.SNs[7] = x[PASSIVE] / CN_passive / cf;
+    tmp.SNs[8] = x[LEACHED] / CN_passive / cf;
+
+    tmp.MinN = MinN + x[MINERALIZED];
+    tmp.Resp = x[RESPIRED];
+
+    *LeafL /= cf;
+    *StemL /= cf;
+    *RootL /= cf;
+    *RhizL /= cf;
+
+    return(tmp);
+  }
+
 /*    T is silt plus clay content 
     Ls is fraction of structural C that is lignin 
 
@@ -49,7 +49,8 @@ struct cenT_str Century(double *LeafL,
 			double RootL_N, 
 			double RhizL_N, 
 			int soilType, 
-	                double Ks_cf[8]);
+	                double Ks_cf[8],
+			int exponential);
 
 double AbiotEff(double smoist, double stemp);
 #endif
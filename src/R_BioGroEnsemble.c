@@ -0,0 +1,457 @@
+/*
+ *  BioCro/src/R_BioGroEnsemble.c
+ *
+ *  Runs BioGro for many parameter sets against one weather series. The
+ *  weather and all parameters that are not varied are shared read-only by
+ *  the members; each thread has its own workspace and state.
+ *
+ */
+
+#include <R.h>
+#include <Rmath.h>
+#include <Rinternals.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "Century.h"
+#include "crocent.h"
+#include "BioCro.h"
+#include "c4photo.h"
+
+/* Columns of the parameter matrix: the 25 dry biomass partitioning
+ * coefficients followed by the photosynthesis parameters. */
+#define ENSEMBLE_DBP 25
+#define ENSEMBLE_PARMS (ENSEMBLE_DBP + 9)
+
+/* Writes the requested channels of one member into row member of the
+ * members x columns output matrices. */
+struct ensemble_sink_data {
+	int member;
+	int members;
+	int columns;
+	int n_outputs;
+	const int *channels;
+	double **outputs;
+};
+
+static void record_ensemble(struct BioGro_sink *sink, int index, const struct BioGro_step *step)
+{
+	struct ensemble_sink_data *data = (struct ensemble_sink_data*)sink->data;
+	int j = index / sink->interval;
+	int o;
+
+	if (j >= data->columns) return;
+
+	for (o = 0; o < data->n_outputs; o++) {
+		data->outputs[o][data->member + j * data->members] = step->value[data->channels[o]];
+	}
+}
+
+/* Whether BioGro could reach error() or Rprintf() with the weather and
+ * coefficients that all members share. Neither may be called from the
+ * threads, so such an ensemble runs on the main thread, in lockstep. The
+ * checks are conservative. The leaf radiation limit of the energy balance
+ * is checked against the beam light of a sunlit leaf plus all the diffuse
+ * light and the most beam light scattered at any depth, 0.042 of the beam
+ * (see sunML), which no leaf exceeds. The explicit Century step is checked
+ * against its largest rate with the abiotic effect at its largest. NaN in
+ * the partitioning or new leaf of a member is counted by the workspace
+ * instead. */
+static int shared_inputs_reach_errors(int vecsize, const int doy[], const int hr[], const double solar[],
+        const double temp[], const double rh[], const double windspeed[], const double precip[],
+        double lat, double chil, const struct solar_table *geometry,
+        const double centcoefs[], int centTimestep, const double centks[])
+{
+    struct Light_model light;
+    double Ibeam, Idiff, k, step;
+    int i;
+
+    for (i = 0; i < vecsize; i++) {
+        if (ISNAN(solar[i]) || ISNAN(temp[i]) || ISNAN(rh[i]) || ISNAN(windspeed[i]) || ISNAN(precip[i]))
+            return 1;
+        if (rh[i] > 1 || TempToSWVC(temp[i]) < 0)
+            return 1;
+
+        light = solar_light(geometry, lat, doy[i], hr[i]);
+        Ibeam = light.irradiance_direct * solar[i] * light.cosine_zenith_angle;
+        Idiff = light.irradiance_diffuse * solar[i];
+        k = fabs(sqrt(pow(chil, 2) + pow(tan(acos(light.cosine_zenith_angle)), 2)) /
+                (chil + 1.744 * pow(chil + 1.183, -0.733)));
+        if ((Ibeam * (k + 0.042) + Idiff) * 0.235 > 650)
+            return 1;
+    }
+
+    if (centcoefs[24] == 0) {
+        step = centTimestep == 7 ? 1.0 / 52 : centTimestep / 365.0;
+        for (i = 0; i < 8; i++) {
+            if (centks[i] * step * 1.0087 * 1.0267 > 1)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+SEXP BioGroEnsemble(
+        SEXP LAT,              /* Latitude                            1 */
+        SEXP DOY,              /* Day of the year                     2 */
+        SEXP HR,               /* Hour of the day                     3 */
+        SEXP SOLAR,            /* Solar Radiation                     4 */
+        SEXP TEMP,             /* Temperature                         5 */
+        SEXP RH,               /* Relative humidity                   6 */
+        SEXP WINDSPEED,        /* Wind Speed                          7 */
+        SEXP PRECIP,           /* Precipitation                       8 */
+        SEXP KD,               /* K D (ext coeff diff)                9 */
+        SEXP CHIL,             /* Chi, leaf angle distribution       10 */
+        SEXP LEAFWIDTH,        /* Width of a leaf                    11 */
+        SEXP ET_EQUATION,      /* Integer to indicate ET equation    12 */
+        SEXP HEIGHTF,          /* Height factor                      13 */
+        SEXP NLAYERS,          /* Number of layers in the canopy     14 */
+		SEXP INITIAL_BIOMASS,
+        SEXP SENCOEFS,         /* sene coefs                         17 */
+        SEXP TIMESTEP,         /* time step                          18 */
+        SEXP VECSIZE,          /* vector size                        19 */
+        SEXP SPLEAF,           /* Spec Leaf Area                     20 */
+        SEXP SPD,              /* Spec Lefa Area Dec                 21 */
+        SEXP DBPCOEFS,         /* Dry Bio Coefs                      22 */
+        SEXP THERMALP,         /* Themal Periods                     23 */
+		SEXP THERMAL_BASE_TEMP,/* Base temperature of GDD               */
+        SEXP VMAX,             /* Vmax of photo                      24 */
+        SEXP ALPHA,            /* Quantum yield                      25 */
+        SEXP KPARM,            /* k parameter (photo)                26 */
+        SEXP THETA,            /* theta param (photo)                27 */
+        SEXP BETA,             /* beta param  (photo)                28 */
+        SEXP RD,               /* Dark Resp   (photo)                29 */
+        SEXP CATM,             /* CO2 atmosph                        30 */
+        SEXP B0,               /* Int (Ball-Berry)                   31 */
+        SEXP B1,               /* Slope (Ball-Berry)                 32 */
+        SEXP SOILCOEFS,        /* Soil Coefficients                  33 */
+        SEXP ILEAFN,           /* Ini Leaf Nitrogen                  34 */
+        SEXP KLN,              /* Decline in Leaf Nitr               35 */
+        SEXP VMAXB1,           /* Effect of N on Vmax                36 */
+        SEXP ALPHAB1,          /* Effect of N on alpha               37 */
+        SEXP MRESP,            /* Maintenance resp                   38 */
+        SEXP SOILTYPE,         /* Soil type                          39 */
+        SEXP WSFUN,            /* Water Stress Func                  40 */
+        SEXP WS,               /* Water stress flag                  41 */
+        SEXP CENTCOEFS,        /* Century coefficients               42 */
+        SEXP CENTTIMESTEP,     /* Century timestep                   43 */
+        SEXP CENTKS,           /* Century decomp rates               44 */
+        SEXP SOILLAYERS,       /* # soil layers                      45 */
+        SEXP SOILDEPTHS,       /* Soil Depths                        46 */
+        SEXP CWS,              /* Current water status               47 */
+        SEXP HYDRDIST,         /* Hydraulic dist flag                48 */
+        SEXP SECS,             /* Soil empirical coefs               49 */
+        SEXP KPLN,             /* Leaf N decay                       50 */
+        SEXP LNB0,             /* Leaf N Int                         51 */
+        SEXP LNB1,             /* Leaf N slope                       52 */
+        SEXP LNFUN,            /* Leaf N func flag                   53 */
+        SEXP UPPERTEMP,        /* Upper photoParm temperature limit  54 */
+        SEXP LOWERTEMP,        /* Lower photoParm temperature limit  55 */
+        SEXP NNITROP,          /* Nitrogen parameters                56 */
+		SEXP STOMWS,
+        SEXP DARK_CANOPY,      /* Dark canopy shortcut when solar is 0  */
+        SEXP WARM_START,       /* Warm start the photosynthesis solves  */
+        SEXP COUPLED_LEAF,     /* Solve leaf temperature and Ci together */
+        SEXP LEAF_SOLVER,      /* How the leaves are solved             */
+        SEXP GAUSS_LAYERING,   /* Gauss-Legendre instead of equal layers */
+        SEXP PARMS,            /* members x 34 parameter matrix         */
+        SEXP OUTPUTS,          /* Channels to return (0 based)          */
+        SEXP INTERVAL,         /* Keep one step in every interval       */
+        SEXP NTHREADS,         /* Number of threads                     */
+        SEXP LOCKSTEP)         /* Advance the members together          */
+{
+    /* Creating pointers to avoid calling functions REAL and INTEGER so much */
+    double lat = REAL(LAT)[0];
+    int *doy = INTEGER(DOY);
+    int *hr = INTEGER(HR);
+    double *solar = REAL(SOLAR);
+    double *temp = REAL(TEMP);
+    double *rh = REAL(RH);
+    double *windspeed = REAL(WINDSPEED);
+    double *precip = REAL(PRECIP);
+    double kd = REAL(KD)[0];
+    double chil = REAL(CHIL)[0];
+    double leafwidth = REAL(LEAFWIDTH)[0];
+    int et_equation = REAL(ET_EQUATION)[0]; /* It comes as a REAL but I use an integer from here on */
+    int dark_canopy = INTEGER(DARK_CANOPY)[0];
+    int warm_start = INTEGER(WARM_START)[0];
+    int coupled_leaf = INTEGER(COUPLED_LEAF)[0];
+    enum leaf_solver leaf_solver = INTEGER(LEAF_SOLVER)[0];
+    int gauss_layering = INTEGER(GAUSS_LAYERING)[0];
+    double heightf = REAL(HEIGHTF)[0];
+    int nlayers = INTEGER(NLAYERS)[0];
+	double *initial_biomass = REAL(INITIAL_BIOMASS);
+    double *sencoefs = REAL(SENCOEFS);
+    int timestep = INTEGER(TIMESTEP)[0];
+    int vecsize = length(DOY);
+    double Sp = REAL(SPLEAF)[0];
+    double SpD = REAL(SPD)[0];
+    double *thermalp = REAL(THERMALP);
+	double thermal_base_temperature = REAL(THERMAL_BASE_TEMP)[0];
+    double *soilcoefs = REAL(SOILCOEFS);
+    /* Evaluate the Campbell curves exactly instead of from a table */
+    int exact_campbell = length(SOILCOEFS) > 9 && soilcoefs[9] != 0;
+    double ileafn = REAL(ILEAFN)[0];
+    double kLN = REAL(KLN)[0];
+    double vmaxb1 = REAL(VMAXB1)[0];
+    double alphab1 = REAL(ALPHAB1)[0];
+    double *mresp = REAL(MRESP);
+    int soilType = INTEGER(SOILTYPE)[0];
+    int wsFun = INTEGER(WSFUN)[0];
+    int ws = INTEGER(WS)[0];
+    double *centcoefs = REAL(CENTCOEFS);
+    int centTimestep = INTEGER(CENTTIMESTEP)[0];
+    double *centks = REAL(CENTKS);
+    int soilLayers = INTEGER(SOILLAYERS)[0];
+    double *soilDepths = REAL(SOILDEPTHS);
+    double *cws = REAL(CWS);
+    int hydrDist = INTEGER(HYDRDIST)[0];
+    double *secs = REAL(SECS);
+    double kpLN = REAL(KPLN)[0];
+    double lnb0 = REAL(LNB0)[0];
+    double lnb1 = REAL(LNB1)[0];
+    int lnfun = INTEGER(LNFUN)[0];
+    double upperT = REAL(UPPERTEMP)[0];
+    double lowerT = REAL(LOWERTEMP)[0];
+	double StomWS = REAL(STOMWS)[0];
+    struct nitroParms nitrop;
+    nitrop.ileafN = REAL(NNITROP)[0];
+    nitrop.kln = REAL(NNITROP)[1];
+    nitrop.Vmaxb1 = REAL(NNITROP)[2];
+    nitrop.Vmaxb0 = REAL(NNITROP)[3];
+    nitrop.alphab1 = REAL(NNITROP)[4];
+    nitrop.alphab0 = REAL(NNITROP)[5];
+    nitrop.Rdb1 = REAL(NNITROP)[6];
+    nitrop.Rdb0 = REAL(NNITROP)[7];
+    nitrop.kpLN = REAL(NNITROP)[8];
+    nitrop.lnb0 = REAL(NNITROP)[9];
+    nitrop.lnb1 = REAL(NNITROP)[10];
+    nitrop.lnFun = (int)REAL(NNITROP)[11];
+    nitrop.maxln = REAL(NNITROP)[12];
+    nitrop.minln = REAL(NNITROP)[13];
+    nitrop.daymaxln = REAL(NNITROP)[14];
+
+    double *parms = REAL(PARMS);
+    int members = nrows(PARMS);
+    int n_outputs = length(OUTPUTS);
+    int *channels = INTEGER(OUTPUTS);
+    int interval = INTEGER(INTERVAL)[0];
+    int nthreads = INTEGER(NTHREADS)[0];
+    int lockstep = INTEGER(LOCKSTEP)[0];
+    int columns;
+    int member, o, stage;
+    int warnings = 0, nan_steps = 0;
+
+    SEXP lists, names, mat;
+
+    if (ncols(PARMS) != ENSEMBLE_PARMS)
+        error("the parameter matrix should have %d columns", ENSEMBLE_PARMS);
+    if (interval < 1) interval = 1;
+    if (nthreads < 1) nthreads = 1;
+    for (o = 0; o < n_outputs; o++) {
+        if (channels[o] < 0 || channels[o] >= BIOGRO_CHANNELS)
+            error("unknown output channel %d", channels[o]);
+    }
+    /* error() cannot be called from the threads, so check what BioGro
+     * would stop on before starting them. */
+    for (member = 0; member < members; member++) {
+        for (stage = 0; stage < 6; stage++) {
+            if (parms[member + 4 * stage * members] < 0)
+                error("kStem should be positive (member %d)", member + 1);
+        }
+    }
+
+    columns = (vecsize - 1) / interval + 1;
+
+    PROTECT(lists = allocVector(VECSXP, n_outputs));
+    PROTECT(names = allocVector(STRSXP, n_outputs));
+
+    double **outputs = (double**)R_alloc(n_outputs, sizeof(double*));
+    for (o = 0; o < n_outputs; o++) {
+        mat = allocMatrix(REALSXP, members, columns);
+        SET_VECTOR_ELT(lists, o, mat);
+        SET_STRING_ELT(names, o, mkChar(biogro_channel_names[channels[o]]));
+        outputs[o] = REAL(mat);
+    }
+
+    /* Every member is at the same site, so they all share one table of
+       the sun and one of the Campbell curves of the soil */
+    const struct solar_table *solar_geometry = solar_table_for(lat);
+    const struct campbell_table *campbell = exact_campbell ? NULL : campbell_table_for(soilTchoose(soilType));
+
+    if (shared_inputs_reach_errors(vecsize, doy, hr, solar, temp, rh, windspeed, precip, lat, chil,
+                solar_geometry, centcoefs, centTimestep, centks))
+        lockstep = 1;
+
+    if (lockstep) {
+        /* The members advance one step at a time on one thread. At each
+         * step the canopies of all of them are computed by one call of
+         * CanAC_scenarios, which finds the sun once and shares the layer
+         * profiles between members whose canopies are alike, and then each
+         * member runs that step with its own canopy. */
+        struct BioGro_workspace *workspaces = (struct BioGro_workspace*)R_alloc(members, sizeof(struct BioGro_workspace));
+        struct BioGro_state *states = (struct BioGro_state*)R_alloc(members, sizeof(struct BioGro_state));
+        struct BioGro_sink *sinks = (struct BioGro_sink*)R_alloc(members, sizeof(struct BioGro_sink));
+        struct ensemble_sink_data *data = (struct ensemble_sink_data*)R_alloc(members, sizeof(struct ensemble_sink_data));
+        struct canopy_scenario *scenarios = (struct canopy_scenario*)R_alloc(members, sizeof(struct canopy_scenario));
+        struct Can_Str *canopies = (struct Can_Str*)R_alloc(members, sizeof(struct Can_Str));
+        double *member_parms = (double*)R_alloc(members * ENSEMBLE_PARMS, sizeof(double));
+        double *dbp;
+        const double *p;
+        int i, m, c;
+
+        for (m = 0; m < members; m++) {
+            for (c = 0; c < ENSEMBLE_PARMS; c++) member_parms[m * ENSEMBLE_PARMS + c] = parms[m + c * members];
+            p = member_parms + m * ENSEMBLE_PARMS + ENSEMBLE_DBP;
+
+            initialize_biogro_workspace(&workspaces[m], soilLayers);
+            initialize_biogro_state(&states[m], soilLayers);
+            states[m].soil.exactCampbell = exact_campbell;
+            workspaces[m].defer_warnings = 1;
+            workspaces[m].solar = solar_geometry;
+            workspaces[m].campbell = campbell;
+            if (leaf_solver == LEAF_SOLVER_SURFACE) workspaces[m].photo_surface = c4_surface_alloc();
+            /* BioGro would start the state on its first step, but the
+             * canopy of that step is needed before */
+            start_biogro_state(&states[m], initial_biomass, Sp, centcoefs, soilcoefs[5], cws, soilLayers,
+                    ileafn, p[0], p[1], StomWS);
+
+            data[m].member = m;
+            data[m].members = members;
+            data[m].columns = columns;
+            data[m].n_outputs = n_outputs;
+            data[m].channels = channels;
+            data[m].outputs = outputs;
+
+            sinks[m].record = record_ensemble;
+            sinks[m].finish = NULL;
+            sinks[m].interval = interval;
+            sinks[m].stop = 0;
+            sinks[m].data = &data[m];
+        }
+
+        for (i = 0; i < vecsize; i++) {
+            for (m = 0; m < members; m++) {
+                p = member_parms + m * ENSEMBLE_PARMS + ENSEMBLE_DBP;
+                scenarios[m].LAI = states[m].lai;
+                scenarios[m].leafN = states[m].leaf_nitrogen;
+                scenarios[m].StomataWS = states[m].stomata_ws;
+                scenarios[m].Vmax = states[m].vmax;
+                scenarios[m].Alpha = states[m].alpha;
+                scenarios[m].Kparm = p[2];
+                scenarios[m].theta = p[3];
+                scenarios[m].beta = p[4];
+                scenarios[m].Rd = p[5];
+                scenarios[m].Catm = p[6];
+                scenarios[m].b0 = p[7];
+                scenarios[m].b1 = p[8];
+                scenarios[m].surface = workspaces[m].photo_surface;
+                scenarios[m].start = warm_start ? &states[m].canopy_start : NULL;
+            }
+
+            CanAC_scenarios(members, scenarios, doy[i], hr[i], solar[i], temp[i], rh[i], windspeed[i],
+                    lat, nlayers, kd, chil, heightf, kpLN, lnfun, upperT, lowerT, nitrop, leafwidth,
+                    et_equation, ws, dark_canopy, coupled_leaf, leaf_solver, gauss_layering,
+                    solar_geometry, canopies);
+
+            for (m = 0; m < members; m++) {
+                dbp = member_parms + m * ENSEMBLE_PARMS;
+                p = dbp + ENSEMBLE_DBP;
+                workspaces[m].canopy = &canopies[m];
+
+                BioGro(lat, doy, hr, solar, temp, rh,
+                        windspeed, precip, kd, chil,
+                        leafwidth, et_equation, dark_canopy, warm_start, coupled_leaf, leaf_solver, gauss_layering, heightf, nlayers, initial_biomass,
+                        sencoefs, timestep, i + 1,
+                        Sp, SpD, dbp, thermalp, thermal_base_temperature,
+                        p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7], p[8],
+                        soilcoefs, ileafn, kLN,
+                        vmaxb1, alphab1, mresp, soilType, wsFun,
+                        ws, centcoefs, centTimestep, centks,
+                        soilLayers, soilDepths, cws, hydrDist,
+                        secs, kpLN, lnb0, lnb1, lnfun, upperT, lowerT, nitrop, StomWS,
+                        biomass_leaf_nitrogen_limitation, &states[m], &workspaces[m], &sinks[m]);
+
+                warnings += workspaces[m].warnings;
+                nan_steps += workspaces[m].nan_steps;
+            }
+        }
+
+        for (m = 0; m < members; m++) {
+            free_biogro_workspace(&workspaces[m]);
+            free_biogro_state(&states[m]);
+        }
+    } else {
+#ifdef _OPENMP
+        #pragma omp parallel num_threads(nthreads) reduction(+:warnings,nan_steps)
+#endif
+        {
+            struct BioGro_workspace workspace;
+            struct BioGro_state state;
+            struct BioGro_sink sink;
+            struct ensemble_sink_data data;
+            double dbpcoefs[ENSEMBLE_DBP];
+            const double *p;
+            int m, c;
+
+            initialize_biogro_workspace(&workspace, soilLayers);
+            initialize_biogro_state(&state, soilLayers);
+            state.soil.exactCampbell = exact_campbell;
+            workspace.defer_warnings = 1;
+            workspace.solar = solar_geometry;
+            workspace.campbell = campbell;
+
+            data.members = members;
+            data.columns = columns;
+            data.n_outputs = n_outputs;
+            data.channels = channels;
+            data.outputs = outputs;
+
+            sink.record = record_ensemble;
+            sink.finish = NULL;
+            sink.interval = interval;
+            sink.stop = 0;
+            sink.data = &data;
+
+#ifdef _OPENMP
+            #pragma omp for schedule(dynamic)
+#endif
+            for (m = 0; m < members; m++) {
+                double member_parms[ENSEMBLE_PARMS];
+
+                for (c = 0; c < ENSEMBLE_PARMS; c++) member_parms[c] = parms[m + c * members];
+                memcpy(dbpcoefs, member_parms, ENSEMBLE_DBP * sizeof(double));
+                p = member_parms + ENSEMBLE_DBP;
+                data.member = m;
+                state.index = 0;
+
+                BioGro(lat, doy, hr, solar, temp, rh,
+                        windspeed, precip, kd, chil,
+                        leafwidth, et_equation, dark_canopy, warm_start, coupled_leaf, leaf_solver, gauss_layering, heightf, nlayers, initial_biomass,
+                        sencoefs, timestep, vecsize,
+                        Sp, SpD, dbpcoefs, thermalp, thermal_base_temperature,
+                        p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7], p[8],
+                        soilcoefs, ileafn, kLN,
+                        vmaxb1, alphab1, mresp, soilType, wsFun,
+                        ws, centcoefs, centTimestep, centks,
+                        soilLayers, soilDepths, cws, hydrDist,
+                        secs, kpLN, lnb0, lnb1, lnfun, upperT, lowerT, nitrop, StomWS,
+                        biomass_leaf_nitrogen_limitation, &state, &workspace, &sink);
+
+                warnings += workspace.warnings;
+                nan_steps += workspace.nan_steps;
+            }
+
+            free_biogro_workspace(&workspace);
+            free_biogro_state(&state);
+        }
+    }
+
+    if (warnings > 0) warning("Rhizome became negative (%d times across the ensemble)", warnings);
+    if (nan_steps > 0) warning("partitioning or new leaf were NaN (%d steps across the ensemble)", nan_steps);
+
+    setAttrib(lists, R_NamesSymbol, names);
+    UNPROTECT(2);
+    return(lists);
+}
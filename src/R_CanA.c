@@ -42,7 +42,10 @@ SEXP CanA(
 		SEXP UPPERTEMP,
 		SEXP LOWERTEMP,
 		SEXP NNITROP,
-		SEXP LEAFWIDTH)
+		SEXP LEAFWIDTH,
+		SEXP DARK_CANOPY,
+		SEXP LEAF_SOLVER,
+		SEXP GAUSS_LAYERING)
 {
   double LAI = REAL(Lai)[0];
   int DOY = INTEGER(Doy)[0];
@@ -76,6 +79,9 @@ SEXP CanA(
   double leafwidth = REAL(LEAFWIDTH)[0];
   double eteq = 0.0;
   double stomataws = REAL(STOMATAWS)[0];
+  int dark_canopy = INTEGER(DARK_CANOPY)[0];
+  enum leaf_solver leaf_solver = INTEGER(LEAF_SOLVER)[0];
+  int gauss_layering = INTEGER(GAUSS_LAYERING)[0];
 
   SEXP lists;
   SEXP names;
@@ -117,7 +123,7 @@ SEXP CanA(
 		  b0, b1, theta, kd, chil,
 		  heightf, leafN, kpLN, lnb0, lnb1,
 		  lnfun, upperT, lowerT, nitroP, leafwidth,
-		  eteq, stomataws, ws);
+		  eteq, stomataws, ws, dark_canopy, 0, leaf_solver, gauss_layering, NULL, solar_table_for(lat), NULL);
 
     if(ISNAN(ans.Assim)) {
         error("Something is NA \n");
@@ -11,6 +11,20 @@
 #include "Century.h"
 #include "crocent.h"
 #include "BioCro.h"
+#include "c4photo.h"
+#include "solver_stats.h"
+
+/* The day of the year step index falls on, counted from the first day of
+   the run. */
+static int day_slot(const int *doy, int index)
+{
+    int i, day = 0;
+
+    for (i = 1; i <= index; i++) {
+        if (doy[i] != doy[i - 1]) day++;
+    }
+    return day;
+}
 
 SEXP MisGro(
         SEXP LAT,              /* Latitude                            1 */
@@ -69,7 +83,15 @@ SEXP MisGro(
         SEXP UPPERTEMP,        /* Upper photoParm temperature limit  54 */
         SEXP LOWERTEMP,        /* Lower photoParm temperature limit  55 */
         SEXP NNITROP,          /* Nitrogen parameters                56 */
-		SEXP STOMWS)
+		SEXP STOMWS,
+        SEXP DARK_CANOPY,      /* Dark canopy shortcut when solar is 0  */
+        SEXP WARM_START,       /* Warm start the photosynthesis solves  */
+        SEXP COUPLED_LEAF,     /* Solve leaf temperature and Ci together */
+        SEXP LEAF_SOLVER,      /* How the leaves are solved             */
+        SEXP GAUSS_LAYERING,   /* Gauss-Legendre instead of equal layers */
+        SEXP DAILY,            /* Daily aggregates instead of each step */
+        SEXP OUTPUT_FILE,      /* File the steps are written to, or empty */
+        SEXP STATE)            /* Saved state to resume from, or empty  */
 {
     /* Creating pointers to avoid calling functions REAL and INTEGER so much */
     double lat = REAL(LAT)[0];
@@ -84,12 +106,20 @@ SEXP MisGro(
     double chil = REAL(CHIL)[0];
     double leafwidth = REAL(LEAFWIDTH)[0];
     int et_equation = REAL(ET_EQUATION)[0]; /* It comes as a REAL but I use an integer from here on */
+    int dark_canopy = INTEGER(DARK_CANOPY)[0];
+    int warm_start = INTEGER(WARM_START)[0];
+    int coupled_leaf = INTEGER(COUPLED_LEAF)[0];
+    enum leaf_solver leaf_solver = INTEGER(LEAF_SOLVER)[0];
+    int gauss_layering = INTEGER(GAUSS_LAYERING)[0];
     double heightf = REAL(HEIGHTF)[0];
     int nlayers = INTEGER(NLAYERS)[0];
 	double *initial_biomass = REAL(INITIAL_BIOMASS);
     double *sencoefs = REAL(SENCOEFS);
     int timestep = INTEGER(TIMESTEP)[0];
     int vecsize;
+    int daily = INTEGER(DAILY)[0];
+    int to_file = length(OUTPUT_FILE) > 0;
+    int rows, first_day = 0;
     double Sp = REAL(SPLEAF)[0]; 
     double SpD = REAL(SPD)[0];
     double *dbpcoefs = REAL(DBPCOEFS);
@@ -105,6 +135,8 @@ SEXP MisGro(
     double b0 = REAL(B0)[0];
     double b1 = REAL(B1)[0];
     double *soilcoefs = REAL(SOILCOEFS);
+    /* Evaluate the Campbell curves exactly instead of from a table */
+    int exact_campbell = length(SOILCOEFS) > 9 && soilcoefs[9] != 0;
     double ileafn = REAL(ILEAFN)[0];
     double kLN = REAL(KLN)[0];
     double vmaxb1 = REAL(VMAXB1)[0];
@@ -179,109 +211,206 @@ SEXP MisGro(
     SEXP SCpools;
     SEXP SNpools;
     SEXP LeafPsimVec;
+    SEXP StateVec;
+    SEXP PhotoIterations, PhotoNames;
+    SEXP PhotoSurface, SurfaceNames;
+    SEXP RootDistComputations;
+    SEXP CampbellErrors, CampbellNames;
 
     vecsize = length(DOY);
-    PROTECT(lists = allocVector(VECSXP,29));
-    PROTECT(names = allocVector(STRSXP,29));
+    /* A row for each step, for each day, or none when the steps go to a file */
+    rows = to_file ? 0 : daily ? day_slot(doy, vecsize - 1) + 1 : vecsize;
+    PROTECT(lists = allocVector(VECSXP,30));
+    PROTECT(names = allocVector(STRSXP,30));
 
-    PROTECT(DayofYear = allocVector(REALSXP,vecsize));
-    PROTECT(Hour = allocVector(REALSXP,vecsize));
-    PROTECT(CanopyAssim = allocVector(REALSXP,vecsize));
-    PROTECT(CanopyTrans = allocVector(REALSXP,vecsize));
-    PROTECT(Leafy = allocVector(REALSXP,vecsize));
-    PROTECT(Stemy = allocVector(REALSXP,vecsize));
-    PROTECT(Rooty = allocVector(REALSXP,vecsize));
-    PROTECT(Rhizomey = allocVector(REALSXP,vecsize));
-    PROTECT(Grainy = allocVector(REALSXP,vecsize));
-    PROTECT(LAIc = allocVector(REALSXP,vecsize));
-    PROTECT(TTTc = allocVector(REALSXP,vecsize));
-    PROTECT(SoilWatCont = allocVector(REALSXP,vecsize));
-    PROTECT(StomatalCondCoefs = allocVector(REALSXP,vecsize));
-    PROTECT(LeafReductionCoefs = allocVector(REALSXP,vecsize));
-    PROTECT(LeafNitrogen = allocVector(REALSXP,vecsize));
-    PROTECT(AboveLitter = allocVector(REALSXP,vecsize));
-    PROTECT(BelowLitter = allocVector(REALSXP,vecsize));
-    PROTECT(VmaxVec = allocVector(REALSXP,vecsize));
-    PROTECT(AlphaVec = allocVector(REALSXP,vecsize));
-    PROTECT(SpVec = allocVector(REALSXP,vecsize));
-    PROTECT(MinNitroVec = allocVector(REALSXP,vecsize));
-    PROTECT(RespVec = allocVector(REALSXP,vecsize));
-    PROTECT(SoilEvaporation = allocVector(REALSXP,vecsize));
-    PROTECT(cwsMat = allocMatrix(REALSXP,soilLayers,vecsize));
-    PROTECT(psimMat = allocMatrix(REALSXP,soilLayers,vecsize));
-    PROTECT(rdMat = allocMatrix(REALSXP,soilLayers,vecsize));
+    PROTECT(DayofYear = allocVector(REALSXP,rows));
+    PROTECT(Hour = allocVector(REALSXP,rows));
+    PROTECT(CanopyAssim = allocVector(REALSXP,rows));
+    PROTECT(CanopyTrans = allocVector(REALSXP,rows));
+    PROTECT(Leafy = allocVector(REALSXP,rows));
+    PROTECT(Stemy = allocVector(REALSXP,rows));
+    PROTECT(Rooty = allocVector(REALSXP,rows));
+    PROTECT(Rhizomey = allocVector(REALSXP,rows));
+    PROTECT(Grainy = allocVector(REALSXP,rows));
+    PROTECT(LAIc = allocVector(REALSXP,rows));
+    PROTECT(TTTc = allocVector(REALSXP,rows));
+    PROTECT(SoilWatCont = allocVector(REALSXP,rows));
+    PROTECT(StomatalCondCoefs = allocVector(REALSXP,rows));
+    PROTECT(LeafReductionCoefs = allocVector(REALSXP,rows));
+    PROTECT(LeafNitrogen = allocVector(REALSXP,rows));
+    PROTECT(AboveLitter = allocVector(REALSXP,rows));
+    PROTECT(BelowLitter = allocVector(REALSXP,rows));
+    PROTECT(VmaxVec = allocVector(REALSXP,rows));
+    PROTECT(AlphaVec = allocVector(REALSXP,rows));
+    PROTECT(SpVec = allocVector(REALSXP,rows));
+    PROTECT(MinNitroVec = allocVector(REALSXP,rows));
+    PROTECT(RespVec = allocVector(REALSXP,rows));
+    PROTECT(SoilEvaporation = allocVector(REALSXP,rows));
+    PROTECT(cwsMat = allocMatrix(REALSXP,soilLayers,rows));
+    PROTECT(psimMat = allocMatrix(REALSXP,soilLayers,rows));
+    PROTECT(rdMat = allocMatrix(REALSXP,soilLayers,rows));
     PROTECT(SCpools = allocVector(REALSXP,9));
     PROTECT(SNpools = allocVector(REALSXP,9));
-    PROTECT(LeafPsimVec = allocVector(REALSXP,vecsize));
+    PROTECT(LeafPsimVec = allocVector(REALSXP,rows));
+
+    /* BioGro writes straight into the R vectors. */
+    struct BioGro_results_str results;
+    struct BioGro_sink sink;
+    struct BioGro_workspace workspace;
+    struct BioGro_state state;
+    int channel, j, skipped;
+
+    results.vector_size = rows;
+    results.soil_layers = soilLayers;
+    results.day_of_year = REAL(DayofYear);
+    results.hour = REAL(Hour);
+    results.CanopyAssim = REAL(CanopyAssim);
+    results.canopy_transpiration = REAL(CanopyTrans);
+    results.Leafy = REAL(Leafy);
+    results.Stemy = REAL(Stemy);
+    results.Rooty = REAL(Rooty);
+    results.Rhizomey = REAL(Rhizomey);
+    results.Grainy = REAL(Grainy);
+    results.LAIc = REAL(LAIc);
+    results.thermal_time = REAL(TTTc);
+    results.soil_water_content = REAL(SoilWatCont);
+    results.stomata_cond_coefs = REAL(StomatalCondCoefs);
+    results.leaf_reduction_coefs = REAL(LeafReductionCoefs);
+    results.leaf_nitrogen = REAL(LeafNitrogen);
+    results.above_ground_litter = REAL(AboveLitter);
+    results.below_ground_litter = REAL(BelowLitter);
+    results.vmax = REAL(VmaxVec);
+    results.alpha = REAL(AlphaVec);
+    results.specific_leaf_area = REAL(SpVec);
+    results.min_nitro = REAL(MinNitroVec);
+    results.respiration = REAL(RespVec);
+    results.soil_evaporation = REAL(SoilEvaporation);
+    results.leaf_psim = REAL(LeafPsimVec);
+    results.psim = REAL(psimMat);
+    results.water_status = REAL(cwsMat);
+    results.root_distribution = REAL(rdMat);
+
+    initialize_biogro_workspace(&workspace, soilLayers);
+    SOLVER_STATS(solver_stats_reset());
+    workspace.solar = solar_table_for(lat);
+    initialize_biogro_state(&state, soilLayers);
+    state.soil.exactCampbell = exact_campbell;
+
+    if (length(STATE) > 0) {
+        if (!restore_biogro_state(&state, REAL(STATE), length(STATE)) || state.index > vecsize) {
+            free_biogro_state(&state);
+            free_biogro_workspace(&workspace);
+            error("the saved state does not match this run");
+        }
+        /* Steps before the saved state are not simulated again, nor the
+           days that ended before it. */
+        if (daily && state.index < vecsize) first_day = day_slot(doy, state.index);
+        skipped = to_file ? 0 : daily ? first_day : state.index;
+        for (channel = 0; channel < BIOGRO_CHANNELS; channel++) {
+            for (j = 0; j < skipped; j++) biogro_results_channel(&results, channel)[j] = NA_REAL;
+        }
+        for (j = 0; j < soilLayers * skipped; j++) {
+            results.psim[j] = NA_REAL;
+            results.water_status[j] = NA_REAL;
+            results.root_distribution[j] = NA_REAL;
+        }
+    }
 
-    struct BioGro_results_str *results = (struct BioGro_results_str*)malloc(sizeof(struct BioGro_results_str));
-    initialize_biogro_results(results, soilLayers, vecsize);
+    if (to_file) {
+        if (!initialize_file_sink(&sink, CHAR(STRING_ELT(OUTPUT_FILE, 0)), 1)) {
+            free_biogro_state(&state);
+            free_biogro_workspace(&workspace);
+            error("cannot open file '%s'", CHAR(STRING_ELT(OUTPUT_FILE, 0)));
+        }
+    } else if (daily) {
+        initialize_daily_sink(&sink, &results, first_day, 1);
+    } else {
+        initialize_results_sink(&sink, &results, 1);
+    }
 
     BioGro(lat, doy, hr, solar, temp, rh,
             windspeed, precip, kd, chil,
-            leafwidth, et_equation, heightf, nlayers, initial_biomass,
+            leafwidth, et_equation, dark_canopy, warm_start, coupled_leaf, leaf_solver, gauss_layering, heightf, nlayers, initial_biomass,
             sencoefs, timestep, vecsize,
             Sp, SpD, dbpcoefs, thermalp, thermal_base_temperature,
             vmax1, alpha1, kparm, theta, beta, Rd, Catm, b0, b1, soilcoefs, ileafn, kLN,
             vmaxb1, alphab1, mresp, soilType, wsFun,
             ws, centcoefs, centTimestep, centks,
             soilLayers, soilDepths, cws, hydrDist,
-            secs, kpLN, lnb0, lnb1, lnfun, upperT, lowerT, nitrop, StomWS, biomass_leaf_nitrogen_limitation, results);
+            secs, kpLN, lnb0, lnb1, lnfun, upperT, lowerT, nitrop, StomWS, biomass_leaf_nitrogen_limitation, &state, &workspace, &sink);
 
+    PROTECT(StateVec = allocVector(REALSXP, biogro_state_length(&state)));
+    save_biogro_state(&state, REAL(StateVec));
 
-    for(int i = 0; i < vecsize; i++) {
-        REAL(DayofYear)[i] = results->day_of_year[i];
-        REAL(Hour)[i] = results->hour[i];
-        REAL(CanopyAssim)[i] = results->CanopyAssim[i];
-        REAL(CanopyTrans)[i] = results->canopy_transpiration[i];
-        REAL(Leafy)[i] = results->Leafy[i];
-        REAL(Stemy)[i] = results->Stemy[i];
-        REAL(Rooty)[i] = results->Rooty[i];
-        REAL(Rhizomey)[i] = results->Rhizomey[i];
-        REAL(Grainy)[i] = results->Grainy[i];
-        REAL(LAIc)[i] = results->LAIc[i];
-        REAL(TTTc)[i] = results->thermal_time[i];
-        REAL(SoilWatCont)[i] = results->soil_water_content[i];
-        REAL(StomatalCondCoefs)[i] = results->stomata_cond_coefs[i];
-        REAL(LeafReductionCoefs)[i] = results->leaf_reduction_coefs[i];
-        REAL(LeafNitrogen)[i] = results->leaf_nitrogen[i];
-        REAL(AboveLitter)[i] = results->above_ground_litter[i];
-        REAL(BelowLitter)[i] = results->below_ground_litter[i];
-        REAL(VmaxVec)[i] = results->vmax[i];
-        REAL(AlphaVec)[i] = results->alpha[i];
-        REAL(SpVec)[i] = results->specific_leaf_area[i];
-        REAL(MinNitroVec)[i] = results->min_nitro[i];
-        REAL(RespVec)[i] = results->respiration[i];
-        REAL(SoilEvaporation)[i] = results->soil_evaporation[i];
-        REAL(LeafPsimVec)[i] = results->leaf_psim[i];
+    /* Leaf photosynthesis solves and their average number of iterations */
+    PROTECT(PhotoIterations = allocVector(REALSXP, 2));
+    PROTECT(PhotoNames = allocVector(STRSXP, 2));
+    REAL(PhotoIterations)[0] = workspace.photo_solves;
+    REAL(PhotoIterations)[1] = workspace.photo_solves > 0 ? workspace.photo_iterations / workspace.photo_solves : 0.0;
+    SET_STRING_ELT(PhotoNames, 0, mkChar("solves"));
+    SET_STRING_ELT(PhotoNames, 1, mkChar("iterations"));
+    setAttrib(PhotoIterations, R_NamesSymbol, PhotoNames);
 
-        for(int layer = 0; layer < soilLayers; layer++) {
-            REAL(psimMat)[layer + i * soilLayers] = results->psim[layer + i * soilLayers];
-            REAL(cwsMat)[layer + i * soilLayers] = results->water_status[layer + i * soilLayers];
-            REAL(rdMat)[layer + i * soilLayers] = results->root_distribution[layer + i * soilLayers];
-        }
+    /* How the response surface of solver "surface" was used, and the
+       largest errors it was measured to have */
+    struct c4_surface *surface = workspace.photo_surface;
+    int used_surface = surface != NULL;
+    const char *surface_names[6] = {"builds", "solves", "lookups", "fallbacks", "assimError", "gsError"};
+    PROTECT(PhotoSurface = allocVector(REALSXP, 6));
+    PROTECT(SurfaceNames = allocVector(STRSXP, 6));
+    for (j = 0; j < 6; j++) SET_STRING_ELT(SurfaceNames, j, mkChar(surface_names[j]));
+    setAttrib(PhotoSurface, R_NamesSymbol, SurfaceNames);
+    if (surface != NULL) {
+        REAL(PhotoSurface)[0] = surface->builds;
+        REAL(PhotoSurface)[1] = surface->solves;
+        REAL(PhotoSurface)[2] = surface->lookups;
+        REAL(PhotoSurface)[3] = surface->fallbacks;
+        REAL(PhotoSurface)[4] = surface->error_Assim;
+        REAL(PhotoSurface)[5] = surface->error_Gs;
     }
 
+    /* How many times the distribution of the roots was computed: at the
+       start, and again whenever the roots reached another layer */
+    PROTECT(RootDistComputations = ScalarReal(state.soil.rootDistComputations));
+
+    /* The largest relative errors of the table of the Campbell curves of
+       the soil, when the run used one */
+    const struct campbell_table *campbell = state.soil.campbell;
+    int used_campbell = campbell != NULL;
+    PROTECT(CampbellErrors = allocVector(REALSXP, 2));
+    PROTECT(CampbellNames = allocVector(STRSXP, 2));
+    SET_STRING_ELT(CampbellNames, 0, mkChar("psimError"));
+    SET_STRING_ELT(CampbellNames, 1, mkChar("KError"));
+    setAttrib(CampbellErrors, R_NamesSymbol, CampbellNames);
+    if (campbell != NULL) {
+        REAL(CampbellErrors)[0] = campbell->error_psim;
+        REAL(CampbellErrors)[1] = campbell->error_K;
+    }
+
+    if (daily && !to_file) free_daily_sink(&sink);
+    free_biogro_state(&state);
+    free_biogro_workspace(&workspace);
+
     /* Populating the results of the Century model */
-    REAL(SCpools)[0] = results->centS.SCs[0];
-    REAL(SCpools)[1] = results->centS.SCs[1];
-    REAL(SCpools)[2] = results->centS.SCs[2];
-    REAL(SCpools)[3] = results->centS.SCs[3];
-    REAL(SCpools)[4] = results->centS.SCs[4];
-    REAL(SCpools)[5] = results->centS.SCs[5];
-    REAL(SCpools)[6] = results->centS.SCs[6];
-    REAL(SCpools)[7] = results->centS.SCs[7];
-    REAL(SCpools)[8] = results->centS.SCs[8];
+    REAL(SCpools)[0] = state.centS.SCs[0];
+    REAL(SCpools)[1] = state.centS.SCs[1];
+    REAL(SCpools)[2] = state.centS.SCs[2];
+    REAL(SCpools)[3] = state.centS.SCs[3];
+    REAL(SCpools)[4] = state.centS.SCs[4];
+    REAL(SCpools)[5] = state.centS.SCs[5];
+    REAL(SCpools)[6] = state.centS.SCs[6];
+    REAL(SCpools)[7] = state.centS.SCs[7];
+    REAL(SCpools)[8] = state.centS.SCs[8];
 
-    REAL(SNpools)[0] = results->centS.SNs[0];
-    REAL(SNpools)[1] = results->centS.SNs[1];
-    REAL(SNpools)[2] = results->centS.SNs[2];
-    REAL(SNpools)[3] = results->centS.SNs[3];
-    REAL(SNpools)[4] = results->centS.SNs[4];
-    REAL(SNpools)[5] = results->centS.SNs[5];
-    REAL(SNpools)[6] = results->centS.SNs[6];
-    REAL(SNpools)[7] = results->centS.SNs[7];
-    REAL(SNpools)[8] = results->centS.SNs[8];
+    REAL(SNpools)[0] = state.centS.SNs[0];
+    REAL(SNpools)[1] = state.centS.SNs[1];
+    REAL(SNpools)[2] = state.centS.SNs[2];
+    REAL(SNpools)[3] = state.centS.SNs[3];
+    REAL(SNpools)[4] = state.centS.SNs[4];
+    REAL(SNpools)[5] = state.centS.SNs[5];
+    REAL(SNpools)[6] = state.centS.SNs[6];
+    REAL(SNpools)[7] = state.centS.SNs[7];
+    REAL(SNpools)[8] = state.centS.SNs[8];
 
     SET_VECTOR_ELT(lists, 0, DayofYear);
     SET_VECTOR_ELT(lists, 1, Hour);
@@ -312,6 +441,7 @@ SEXP MisGro(
     SET_VECTOR_ELT(lists, 26, SCpools);
     SET_VECTOR_ELT(lists, 27, SNpools);
     SET_VECTOR_ELT(lists, 28, LeafPsimVec);
+    SET_VECTOR_ELT(lists, 29, StateVec);
 
     SET_STRING_ELT(names,0,mkChar("DayofYear"));
     SET_STRING_ELT(names,1,mkChar("Hour"));
@@ -342,9 +472,19 @@ SEXP MisGro(
     SET_STRING_ELT(names,26,mkChar("SCpools"));
     SET_STRING_ELT(names,27,mkChar("SNpools"));
     SET_STRING_ELT(names,28,mkChar("LeafPsimVec"));
+    SET_STRING_ELT(names,29,mkChar("state"));
     setAttrib(lists,R_NamesSymbol,names);
-    UNPROTECT(31);
-    free_biogro_results(results);
+    setAttrib(lists, install("photoIterations"), PhotoIterations);
+    if (used_surface) setAttrib(lists, install("photoSurface"), PhotoSurface);
+    setAttrib(lists, install("rootDistComputations"), RootDistComputations);
+    if (used_campbell) setAttrib(lists, install("campbellTable"), CampbellErrors);
+#ifdef BIOCRO_SOLVER_STATS
+    SEXP SolverStats;
+    PROTECT(SolverStats = solver_stats_list());
+    setAttrib(lists, install("solverStats"), SolverStats);
+    UNPROTECT(1);
+#endif
+    UNPROTECT(39);
     return(lists);
 }
 
@@ -7,6 +7,7 @@
 
 #include <R.h>
 #include <Rmath.h>
+#include <string.h>
 #include "BioCro.h"
 
 /* Here I will include a function which calculates the RSS */
@@ -70,6 +71,105 @@ double RSS_BG(double oStem[], double oLeaf[],
 	RSS = RSS1 + RSS2 + RSS3 + RSS4 + RSS5 + RSS6;
 	return(RSS);
 }
+
+/* A sink that computes the RSS of RSS_BG while BioGro runs. Steps are
+ * passed on to a keep-all sink and every observation is added, in the order
+ * of RSS_BG, once the step it was taken at has been simulated. The terms
+ * are never negative, so the RSS so far can only grow; when it already
+ * rejects the proposal the run is stopped. */
+
+struct fit_sink_data {
+	struct BioGro_sink results;
+	struct BioGro_results_str *sim;
+	double *oStem, *oLeaf, *oRoot, *oRhizome, *oGrain, *oLAI;
+	int *index;
+	int *slot; /* where the step of each observation is kept in sim */
+	int n1dat;
+	int next;
+	double stage_thermal_time;
+	int stage_start; /* first step at stage_thermal_time, -1 until seen */
+	double rss[6]; /* Stem, Leaf, Rhizome, Root, LAI and Grain, as in RSS_BG */
+	int annealing; /* 1 for simulated annealing, 0 for Metropolis */
+	int early_stop;
+	double old_rss, temperature, u;
+};
+
+static double fit_rss(const struct fit_sink_data *fit)
+{
+	return(fit->rss[0] + fit->rss[1] + fit->rss[2] + fit->rss[3] + fit->rss[4] + fit->rss[5]);
+}
+
+/* The acceptance tests of both parts of SABioGro for a proposal with RSS
+ * rss. If a proposal is rejected so is every proposal with a larger RSS. */
+static int fit_rejects(const struct fit_sink_data *fit, double rss)
+{
+	if(fit->annealing){
+		return(!(rss < (fit->old_rss - fit->temperature * log(fit->u))));
+	}
+	return(!(exp(-rss) / exp(-fit->old_rss) > fit->u));
+}
+
+static void add_term(double *rss, double obs, double sim)
+{
+	double diff;
+
+	if(obs >= 0){
+		diff = obs - sim;
+		*rss += pow(diff,2);
+	}
+}
+
+static void record_fit(struct BioGro_sink *sink, int index, const struct BioGro_step *step)
+{
+	struct fit_sink_data *fit = (struct fit_sink_data*)sink->data;
+	struct BioGro_results_str *sim = fit->sim;
+	int k, ind, added = 0;
+
+	fit->results.record(&fit->results, index, step);
+
+	/* Thermal time does not depend on the coefficients, so this is the
+	 * same for every run. */
+	if(fit->stage_start < 0 && step->value[BIOGRO_THERMAL_TIME] >= fit->stage_thermal_time){
+		fit->stage_start = index;
+	}
+
+	while(fit->next < fit->n1dat && fit->index[fit->next] <= index){
+		k = fit->next++;
+		ind = fit->slot[k];
+		add_term(&fit->rss[0], fit->oStem[k], sim->Stemy[ind]);
+		add_term(&fit->rss[1], fit->oLeaf[k], sim->Leafy[ind]);
+		add_term(&fit->rss[2], fit->oRhizome[k], sim->Rhizomey[ind]);
+		add_term(&fit->rss[3], fit->oRoot[k], sim->Rooty[ind]);
+		add_term(&fit->rss[4], fit->oLAI[k], sim->LAIc[ind]);
+		add_term(&fit->rss[5], fit->oGrain[k], sim->Grainy[ind]);
+		added = 1;
+	}
+
+	if(added && fit->early_stop && fit_rejects(fit, fit_rss(fit))){
+		sink->stop = 1;
+	}
+}
+
+static void finish_fit(struct BioGro_sink *sink, const struct BioGro_step *last)
+{
+	struct fit_sink_data *fit = (struct fit_sink_data*)sink->data;
+
+	fit->results.finish(&fit->results, last);
+}
+
+/* Called before every run with the values the proposal will be tested
+ * against. */
+static void start_fit(struct fit_sink_data *fit, double old_rss, double temperature, double u, int early_stop)
+{
+	int c;
+
+	fit->next = 0;
+	for(c = 0; c < 6; c++) fit->rss[c] = 0.0;
+	fit->old_rss = old_rss;
+	fit->temperature = temperature;
+	fit->u = u;
+	fit->early_stop = early_stop;
+}
 #include <Rinternals.h>
 
 /* First pass the observed data and then the simulated */
@@ -96,7 +196,8 @@ SEXP SABioGro(SEXP oTHERMAL, SEXP oSTEM, SEXP oLEAF,
 	      SEXP SCALE, SEXP SD, SEXP PHEN, 
 	      SEXP SOILLAYERS, SEXP SOILDEPTHS, 
 	      SEXP CWS, SEXP HYDRDIST, SEXP SECS, 
-	      SEXP NCOEFS, SEXP LNFUN,SEXP UPPERTEMP, SEXP LOWERTEMP,SEXP NNITROP, SEXP STOMWS)
+	      SEXP NCOEFS, SEXP LNFUN,SEXP UPPERTEMP, SEXP LOWERTEMP,SEXP NNITROP, SEXP STOMWS,
+	      SEXP RESUME, SEXP EARLYSTOP)
 {
        
 	// compatibility with CanAC to pass alpha parameters
@@ -119,11 +220,49 @@ SEXP SABioGro(SEXP oTHERMAL, SEXP oSTEM, SEXP oLEAF,
 	nitroparms.minln=REAL(NNITROP)[13];
 	nitroparms.daymaxln=REAL(NNITROP)[14];
 
+	/* Only the biomass and LAI at the steps with observations are kept. */
+	int *steps = (int*)malloc(INTEGER(NDATA)[0] * sizeof(int));
+	memcpy(steps, INTEGER(INDEX), INTEGER(NDATA)[0] * sizeof(int));
+	R_isort(steps, INTEGER(NDATA)[0]);
 	struct BioGro_results_str *results = (struct BioGro_results_str*)malloc(sizeof(struct BioGro_results_str));
-    initialize_biogro_results(results, INTEGER(SOILLAYERS)[0], INTEGER(VECSIZE)[0]);
+    initialize_biogro_results(results, INTEGER(SOILLAYERS)[0], INTEGER(NDATA)[0]);
+	struct BioGro_results_selection selection;
+	selection.results = results;
+	selection.channels = BIOGRO_CHANNEL_BIT(BIOGRO_LEAF) | BIOGRO_CHANNEL_BIT(BIOGRO_STEM) |
+		BIOGRO_CHANNEL_BIT(BIOGRO_ROOT) | BIOGRO_CHANNEL_BIT(BIOGRO_RHIZOME) |
+		BIOGRO_CHANNEL_BIT(BIOGRO_GRAIN) | BIOGRO_CHANNEL_BIT(BIOGRO_LAI);
+	selection.soil = 0;
+	selection.indices = steps;
+	selection.n_indices = INTEGER(NDATA)[0];
+	struct fit_sink_data fit;
+	initialize_selected_results_sink(&fit.results, &selection, 1);
+	fit.sim = results;
+	int *slot = (int*)malloc(INTEGER(NDATA)[0] * sizeof(int));
+	struct BioGro_sink sink;
+	sink.record = record_fit;
+	sink.finish = finish_fit;
+	sink.interval = 1;
+	sink.stop = 0;
+	sink.data = &fit;
+	/* Allocated once; every BioGro call below reuses it. */
+	struct BioGro_workspace workspace;
+	initialize_biogro_workspace(&workspace, INTEGER(SOILLAYERS)[0]);
+	workspace.solar = solar_table_for(REAL(LAT)[0]);
+	struct BioGro_state state;
+	initialize_biogro_state(&state, INTEGER(SOILLAYERS)[0]);
+	/* Only the coefficients of stage phen and later are sampled, so every
+	 * run is identical up to the step at which stage phen starts. The state
+	 * at that step is kept and later runs resume from it as long as the
+	 * coefficients of the earlier stages have not changed. */
+	struct BioGro_state prefix;
+	initialize_biogro_state(&prefix, INTEGER(SOILLAYERS)[0]);
+	double prefix_coefs[25];
+	int prefix_index = -1, prefix_ready = 0, prefix_length, stop;
+	int resume = INTEGER(RESUME)[0]; /* 0 runs every proposal from the first step */
+	int early_stop = INTEGER(EARLYSTOP)[0]; /* 0 completes every run */
 
 	/* Index variables */
-	int j,k,m;
+	int j,m;
 	int niter, niter2, iters = 0, iters2 = 0;
 	int accept = 0;
 	int n1 = 0, n2 = 0;
@@ -174,13 +313,11 @@ SEXP SABioGro(SEXP oTHERMAL, SEXP oSTEM, SEXP oLEAF,
 	/* Picking the simulation */
 	int ind;
 	// double sCanopyAssim[Ndat]; unused
-    double sStemy[Ndat], sLeafy[Ndat];
-	double sRhizomey[Ndat], sRooty[Ndat], sGrainy[Ndat],  sLAIy[Ndat];
 	double oStemy[Ndat], oLeafy[Ndat];
 	double oRhizomey[Ndat], oRooty[Ndat], oGrainy[Ndat], oLAIy[Ndat];
 	/* more vairbles */
 	double rss = 0.0, oldRss;
-	double U , mr;
+	double U;
 
 	/* Yet more */
 	double index = 0;
@@ -343,10 +480,27 @@ SEXP SABioGro(SEXP oTHERMAL, SEXP oSTEM, SEXP oLEAF,
 	GetRNGstate();
 
 	oldRss = 1e6;
+	fit.annealing = 1;
 	/* This is a good part to start the optimization */
 
         /* determining the n1dat */
 	n1dat = INTEGER(N1DAT)[phen-1];
+	prefix_length = 4 * (phen - 1);
+
+	fit.oStem = oStemy;
+	fit.oLeaf = oLeafy;
+	fit.oRoot = oRooty;
+	fit.oRhizome = oRhizomey;
+	fit.oGrain = oGrainy;
+	fit.oLAI = oLAIy;
+	fit.index = INTEGER(INDEX);
+	for(m=0;m<Ndat;m++){
+		slot[m] = biogro_results_slot(&selection, INTEGER(INDEX)[m]);
+	}
+	fit.slot = slot;
+	fit.n1dat = n1dat;
+	fit.stage_thermal_time = phen > 1 ? REAL(THERMALP)[phen-2] : 0.0;
+	fit.stage_start = -1;
 
 	for(iters=0;iters<niter;iters++){
 
@@ -563,38 +717,46 @@ SEXP SABioGro(SEXP oTHERMAL, SEXP oSTEM, SEXP oLEAF,
 		/* 	Rprintf("dbpcoef %.i %.3f \n",p,dbpcoef[p]); */
 		/* } */
 
-		BioGro(lati,INTEGER(DOY),INTEGER(HR),REAL(SOLAR),REAL(TEMP),REAL(RH),
-		       REAL(WINDSPEED),REAL(PRECIP), REAL(KD)[0], REAL(CHILHF)[0], REAL(CHILHF)[2], REAL(CHILHF)[3], 
-		       REAL(CHILHF)[1],nlayers, initial_biomass,
-		       REAL(SENESCTIME),INTEGER(TIMESTEP)[0],vecsize,
-		       REAL(SP)[0], REAL(SPD)[0], dbpcoef, REAL(THERMALP), REAL(THERMAL_BASE_TEMP)[0],
-		       vmax,alpha,kparm,theta,beta,Rd,Ca,b0,b1, REAL(SOILCOEFS), LeafN, kLN,
-		       vmaxb1, alphab1, REAL(MRESP), INTEGER(SOILTYPE)[0], INTEGER(WSFUN)[0],
-		       INTEGER(WS)[0], REAL(CENTCOEFS), INTEGER(CENTTIMESTEP)[0], REAL(CENTKS),
-		       INTEGER(SOILLAYERS)[0], REAL(SOILDEPTHS), REAL(CWS), INTEGER(HYDRDIST)[0], 
-		       REAL(SECS), REAL(NCOEFS)[0], REAL(NCOEFS)[1], REAL(NCOEFS)[2], INTEGER(LNFUN)[0],upperT,lowerT,nitroparms, StomWS, thermal_leaf_nitrogen_limitation, results);
-
-		/* pick the needed elements for the SSE */
-		for(k=0; k<Ndat; k++) {
-			ind = INTEGER(INDEX)[k];
-			// sCanopyAssim[k] = results->CanopyAssim[ind];
-			sLeafy[k] = results->Leafy[ind];
-			sStemy[k] = results->Stemy[ind];
-			sRooty[k] = results->Rooty[ind];
-			sRhizomey[k] = results->Rhizomey[ind];
-			sGrainy[k] = results->Grainy[ind];
-			sLAIy[k] = results->LAIc[ind];
+		/* BioGro draws no random numbers, so drawing U before the run
+		 * leaves the sequence unchanged. The outputs returned come from
+		 * the last run, which is not stopped early. */
+		U = runif(0,1);
+		start_fit(&fit, oldRss, saTemp, U, early_stop && (iters < niter - 1 || niter2 > 0));
+		if (prefix_ready && memcmp(prefix_coefs, dbpcoef, prefix_length * sizeof(double)) == 0) {
+			copy_biogro_state(&state, &prefix);
+		} else {
+			/* The run overwrites the outputs the saved state relies on. */
+			state.index = 0;
+			prefix_ready = 0;
 		}
+		do {
+			stop = (state.index == 0 && prefix_index > 0) ? prefix_index : vecsize;
+			BioGro(lati,INTEGER(DOY),INTEGER(HR),REAL(SOLAR),REAL(TEMP),REAL(RH),
+			       REAL(WINDSPEED),REAL(PRECIP), REAL(KD)[0], REAL(CHILHF)[0], REAL(CHILHF)[2], REAL(CHILHF)[3], REAL(CHILHF)[4], REAL(CHILHF)[5], REAL(CHILHF)[6], REAL(CHILHF)[7], REAL(CHILHF)[8],
+			       REAL(CHILHF)[1],nlayers, initial_biomass,
+			       REAL(SENESCTIME),INTEGER(TIMESTEP)[0],stop,
+			       REAL(SP)[0], REAL(SPD)[0], dbpcoef, REAL(THERMALP), REAL(THERMAL_BASE_TEMP)[0],
+			       vmax,alpha,kparm,theta,beta,Rd,Ca,b0,b1, REAL(SOILCOEFS), LeafN, kLN,
+			       vmaxb1, alphab1, REAL(MRESP), INTEGER(SOILTYPE)[0], INTEGER(WSFUN)[0],
+			       INTEGER(WS)[0], REAL(CENTCOEFS), INTEGER(CENTTIMESTEP)[0], REAL(CENTKS),
+			       INTEGER(SOILLAYERS)[0], REAL(SOILDEPTHS), REAL(CWS), INTEGER(HYDRDIST)[0], 
+			       REAL(SECS), REAL(NCOEFS)[0], REAL(NCOEFS)[1], REAL(NCOEFS)[2], INTEGER(LNFUN)[0],upperT,lowerT,nitroparms, StomWS, thermal_leaf_nitrogen_limitation, &state, &workspace, &sink);
+			/* The first complete run tells where stage phen starts. */
+			if (prefix_index < 0 && !sink.stop) {
+				prefix_index = (resume && phen > 1 && fit.stage_start > 0) ? fit.stage_start : 0;
+			}
+			if (stop < vecsize && !sink.stop) {
+				copy_biogro_state(&prefix, &state);
+				memcpy(prefix_coefs, dbpcoef, prefix_length * sizeof(double));
+				prefix_ready = 1;
+			}
+		} while (stop < vecsize && !sink.stop);
 
-
-		rss = RSS_BG(oStemy,oLeafy,oRooty,oRhizomey,oGrainy,oLAIy,
-			     sStemy,sLeafy,sRooty,sRhizomey,sGrainy,sLAIy,
-			     n1dat);
-
+		/* For a run that was stopped this is the RSS up to that step. */
+		rss = fit_rss(&fit);
 
 		REAL(RssVec)[iters] = rss;
-		U = runif(0,1);
-		if(rss < (oldRss - saTemp *log(U))){
+		if(!fit_rejects(&fit, rss)){
 			accept++;
 			oldRss = rss;
 			if((accept%coolSamp)==0){
@@ -637,6 +799,7 @@ SEXP SABioGro(SEXP oTHERMAL, SEXP oSTEM, SEXP oLEAF,
 
 	}
 
+	fit.annealing = 0;
 	for(iters2=0;iters2<niter2;iters2++){
 
 		index = sel_phen(phen);
@@ -849,38 +1012,43 @@ SEXP SABioGro(SEXP oTHERMAL, SEXP oSTEM, SEXP oLEAF,
 		dbpcoef[23] = kRhizome_6;
 		dbpcoef[24] = kGrain_6;
  
-		BioGro(lati,INTEGER(DOY),INTEGER(HR),REAL(SOLAR),REAL(TEMP),REAL(RH),
-		       REAL(WINDSPEED),REAL(PRECIP), REAL(KD)[0], REAL(CHILHF)[0], REAL(CHILHF)[2], REAL(CHILHF)[3], 
-		       REAL(CHILHF)[1],nlayers, initial_biomass,
-		       REAL(SENESCTIME),INTEGER(TIMESTEP)[0],vecsize,
-		       REAL(SP)[0], REAL(SPD)[0], dbpcoef, REAL(THERMALP), REAL(THERMAL_BASE_TEMP)[0],
-		       vmax,alpha,kparm,theta,beta,Rd,Ca,b0,b1, REAL(SOILCOEFS), LeafN, kLN,
-		       vmaxb1, alphab1, REAL(MRESP), INTEGER(SOILTYPE)[0], INTEGER(WSFUN)[0],
-		       INTEGER(WS)[0], REAL(CENTCOEFS), INTEGER(CENTTIMESTEP)[0], REAL(CENTKS),
-		       INTEGER(SOILLAYERS)[0], REAL(SOILDEPTHS), REAL(CWS), INTEGER(HYDRDIST)[0],
-		       REAL(SECS), REAL(NCOEFS)[0], REAL(NCOEFS)[1], REAL(NCOEFS)[2], INTEGER(LNFUN)[0],upperT,lowerT,nitroparms, StomWS, thermal_leaf_nitrogen_limitation, results);
-
-		/* pick the needed elements for the SSE */
-		for(k=0;k<Ndat;k++){
-			ind = INTEGER(INDEX)[k];
-			// sCanopyAssim[k] = results->CanopyAssim[ind]; unused
-			sLeafy[k] = results->Leafy[ind];
-			sStemy[k] = results->Stemy[ind];
-			sRooty[k] = results->Rooty[ind];
-			sRhizomey[k] = results->Rhizomey[ind];
-			sLAIy[k] = results->LAIc[ind];
+		U = runif(0,1);
+		start_fit(&fit, oldRss, saTemp, U, early_stop && iters2 < niter2 - 1);
+		if (prefix_ready && memcmp(prefix_coefs, dbpcoef, prefix_length * sizeof(double)) == 0) {
+			copy_biogro_state(&state, &prefix);
+		} else {
+			/* The run overwrites the outputs the saved state relies on. */
+			state.index = 0;
+			prefix_ready = 0;
 		}
+		do {
+			stop = (state.index == 0 && prefix_index > 0) ? prefix_index : vecsize;
+			BioGro(lati,INTEGER(DOY),INTEGER(HR),REAL(SOLAR),REAL(TEMP),REAL(RH),
+			       REAL(WINDSPEED),REAL(PRECIP), REAL(KD)[0], REAL(CHILHF)[0], REAL(CHILHF)[2], REAL(CHILHF)[3], REAL(CHILHF)[4], REAL(CHILHF)[5], REAL(CHILHF)[6], REAL(CHILHF)[7], REAL(CHILHF)[8],
+			       REAL(CHILHF)[1],nlayers, initial_biomass,
+			       REAL(SENESCTIME),INTEGER(TIMESTEP)[0],stop,
+			       REAL(SP)[0], REAL(SPD)[0], dbpcoef, REAL(THERMALP), REAL(THERMAL_BASE_TEMP)[0],
+			       vmax,alpha,kparm,theta,beta,Rd,Ca,b0,b1, REAL(SOILCOEFS), LeafN, kLN,
+			       vmaxb1, alphab1, REAL(MRESP), INTEGER(SOILTYPE)[0], INTEGER(WSFUN)[0],
+			       INTEGER(WS)[0], REAL(CENTCOEFS), INTEGER(CENTTIMESTEP)[0], REAL(CENTKS),
+			       INTEGER(SOILLAYERS)[0], REAL(SOILDEPTHS), REAL(CWS), INTEGER(HYDRDIST)[0],
+			       REAL(SECS), REAL(NCOEFS)[0], REAL(NCOEFS)[1], REAL(NCOEFS)[2], INTEGER(LNFUN)[0],upperT,lowerT,nitroparms, StomWS, thermal_leaf_nitrogen_limitation, &state, &workspace, &sink);
+			/* The first complete run tells where stage phen starts. */
+			if (prefix_index < 0 && !sink.stop) {
+				prefix_index = (resume && phen > 1 && fit.stage_start > 0) ? fit.stage_start : 0;
+			}
+			if (stop < vecsize && !sink.stop) {
+				copy_biogro_state(&prefix, &state);
+				memcpy(prefix_coefs, dbpcoef, prefix_length * sizeof(double));
+				prefix_ready = 1;
+			}
+		} while (stop < vecsize && !sink.stop);
 
-		rss = RSS_BG(oStemy,oLeafy,oRooty,oRhizomey,oGrainy,oLAIy,
-			     sStemy,sLeafy,sRooty,sRhizomey,sGrainy,sLAIy,
-			     n1dat);
+		rss = fit_rss(&fit);
 
 		REAL(RssVec2)[iters2] = rss;
 
-		mr = exp(-rss) / exp(-oldRss);
-
-		U = runif(0,1); 
-		if(mr > U){ 
+		if(!fit_rejects(&fit, rss)){
 			n2++;
 			/* accept the coefficients */
 			oldkLeaf_1 = dbpcoef[0];
@@ -991,7 +1159,7 @@ SEXP SABioGro(SEXP oTHERMAL, SEXP oSTEM, SEXP oLEAF,
 	REAL(SAtemp)[0] = saTemp;
 
 	for(j=0;j<Ndat;j++){
-		ind = INTEGER(INDEX)[j];
+		ind = slot[j];
 		REAL(simStem)[j] = results->Stemy[ind];
 		REAL(simLeaf)[j] = results->Leafy[ind];
 		REAL(simRhiz)[j] = results->Rhizomey[ind];
@@ -1063,6 +1231,12 @@ SEXP SABioGro(SEXP oTHERMAL, SEXP oSTEM, SEXP oLEAF,
 
 	UNPROTECT(25);
 	free_biogro_results(results);
+	free(results);
+	free(steps);
+	free(slot);
+	free_biogro_workspace(&workspace);
+	free_biogro_state(&state);
+	free_biogro_state(&prefix);
 	return(lists);
 }
 
@@ -69,7 +69,7 @@ SEXP c3CanA(SEXP Lai,
 			RH, WindSpeed, lat, nlayers, vmax,
 			jmax, Rd, Catm, o2, b0,
 			b1, theta, kd, heightf, leafN,
-			kpLN, lnb0, lnb1, lnfun, StomataWS, ws);
+			kpLN, lnb0, lnb1, lnfun, StomataWS, ws, 0, solar_table_for(lat), NULL);
 
     if(ISNAN(ans.Assim)) {
         error("Something is NA \n");
@@ -4,8 +4,11 @@
 #include <Rinternals.h>
 #include "c4photo.h"
 
+/* Leaves solved together by the batch solver of c4photo */
+#define C4_BATCH_LEAVES 256
+
 SEXP c4photo(SEXP Qp, SEXP Tl, SEXP RH, SEXP VMAX, SEXP ALPHA,
-	     SEXP KPAR, SEXP THETA, SEXP BETA, SEXP RD, SEXP CA, SEXP B0, SEXP B1, SEXP STOMWS, SEXP WS,SEXP UPPERTEMP, SEXP LOWERTEMP)
+	     SEXP KPAR, SEXP THETA, SEXP BETA, SEXP RD, SEXP CA, SEXP B0, SEXP B1, SEXP STOMWS, SEXP WS,SEXP UPPERTEMP, SEXP LOWERTEMP, SEXP SOLVER)
 {
 	struct c4_str tmp;
 
@@ -35,6 +38,7 @@ SEXP c4photo(SEXP Qp, SEXP Tl, SEXP RH, SEXP VMAX, SEXP ALPHA,
 	SEXP ASSV;
   SEXP GASSV;
 	SEXP CiV;
+	SEXP ItV;
 
 
 	nq = length(Qp);
@@ -47,6 +51,7 @@ SEXP c4photo(SEXP Qp, SEXP Tl, SEXP RH, SEXP VMAX, SEXP ALPHA,
 	PROTECT(ASSV = allocVector(REALSXP,nq));
   PROTECT(GASSV = allocVector(REALSXP,nq));
 	PROTECT(CiV = allocVector(REALSXP,nq));
+	PROTECT(ItV = allocVector(INTSXP,nq));
   
 	double *pt_Qp = REAL(Qp);
 	double *pt_Tl = REAL(Tl);
@@ -54,16 +59,51 @@ SEXP c4photo(SEXP Qp, SEXP Tl, SEXP RH, SEXP VMAX, SEXP ALPHA,
 	double *pt_CA = REAL(CA);
   
 	int ws = INTEGER(WS)[0];
+	int solver = INTEGER(SOLVER)[0]; /* 0 iterative, 1 bracketed, 2 batch */
 
 	double *pt_GSV = REAL(GsV);
 	double *pt_ASSV = REAL(ASSV);
     double *pt_GASSV = REAL(GASSV);
 	double *pt_CiV = REAL(CiV);
+	int *pt_ITV = INTEGER(ItV);
+	if(solver == 2){
+		/* Consecutive leaves with the same Catm are solved together, at
+		   most C4_BATCH_LEAVES at a time */
+		double vmaxV[C4_BATCH_LEAVES], alphaV[C4_BATCH_LEAVES], RdV[C4_BATCH_LEAVES];
+		struct c4_str batch[C4_BATCH_LEAVES];
+		int j, n;
+
+		for(j = 0; j < C4_BATCH_LEAVES; j++){
+			vmaxV[j] = vmax;
+			alphaV[j] = alpha;
+			RdV[j] = Rd;
+		}
+		for(i = 0; i < nq ; i += n)
+		{
+			for(n = 1; n < C4_BATCH_LEAVES && i + n < nq && pt_CA[i + n] == pt_CA[i]; n++);
+			c4photoC_batch(n, pt_Qp + i, pt_Tl + i, pt_RH + i, vmaxV, alphaV, RdV,
+				       K, theta, beta, Bet0, Bet1, StomWS,
+				       pt_CA[i], ws, upperT, lowerT, NULL, NULL, batch);
+			for(j = 0; j < n; j++){
+				pt_GSV[i + j] = batch[j].Gs;
+				pt_ASSV[i + j] = batch[j].Assim;
+				pt_GASSV[i + j] = batch[j].GrossAssim;
+				pt_CiV[i + j] = batch[j].Ci;
+				pt_ITV[i + j] = batch[j].iterations;
+			}
+		}
+	}else{
 	/* Start of the loop */
 	for(i = 0; i < nq ; i++)
 	{
 
-		tmp = c4photoC(*(pt_Qp+i), *(pt_Tl+i), *(pt_RH+i),
+		if(solver == 1)
+			tmp = c4photoC_bracketed(*(pt_Qp+i), *(pt_Tl+i), *(pt_RH+i),
+				       vmax, alpha, K,theta, beta, Rd,
+				       Bet0, Bet1, StomWS,
+				       *(pt_CA+i), ws,upperT,lowerT);
+		else
+			tmp = c4photoC(*(pt_Qp+i), *(pt_Tl+i), *(pt_RH+i),
 			       vmax, alpha, K,theta, beta, Rd, /*\ref{parm:Vmax}\ref{parm:Rd}*/
 			       Bet0, Bet1, StomWS, 
 			       *(pt_CA+i), ws,upperT,lowerT);
@@ -72,9 +112,11 @@ SEXP c4photo(SEXP Qp, SEXP Tl, SEXP RH, SEXP VMAX, SEXP ALPHA,
 		*(pt_ASSV + i) = tmp.Assim;    
     *(pt_GASSV + i) = tmp.GrossAssim; 
 		*(pt_CiV + i) = tmp.Ci;    
+		*(pt_ITV + i) = tmp.iterations;
 /* Here it is using the REAL function every time */
 /* I should change this to a pointer too at some point */ 
 	}
+	}
 
 	SET_VECTOR_ELT(lists,0,GsV);
 	SET_VECTOR_ELT(lists,1,ASSV);
@@ -85,7 +127,8 @@ SEXP c4photo(SEXP Qp, SEXP Tl, SEXP RH, SEXP VMAX, SEXP ALPHA,
 	SET_STRING_ELT(names,2,mkChar("Ci"));
   SET_STRING_ELT(names,3,mkChar("GrossAssim"));
 	setAttrib(lists,R_NamesSymbol,names);
-	UNPROTECT(6);   
+	setAttrib(lists, install("iterations"), ItV);
+	UNPROTECT(7);   
 	return(lists);
 }
 
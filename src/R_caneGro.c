@@ -24,6 +24,7 @@
 #include "Century.h"
 #include "BioCro.h"
 #include "AuxcaneGro.h"
+#include "solver_stats.h"
 //#include "CanA_3D_Structure.h"
 
 SEXP caneGro(SEXP LAT,                 /* Latitude                  1 */ 
@@ -304,30 +305,6 @@ SEXP caneGro(SEXP LAT,                 /* Latitude                  1 */
     }
     /*********************************************************/
 
-    double *newLeafcol = (double*)malloc(vecsize*sizeof(double));
-    if(newLeafcol==NULL) { 
-        Rprintf("Out of Memory for newLeafcol\n");
-        return((SEXP)1);
-    }
-
-    double *newStemcol = (double*)malloc(vecsize*sizeof(double));
-    if(newStemcol==NULL) { 
-        Rprintf("Out of Memory for newStemcol\n");
-        return((SEXP)1);
-    }
-
-    double *newRootcol = (double*)malloc(vecsize*sizeof(double));
-    if(newRootcol==NULL) { 
-        Rprintf("Out of Memory for newRootcol\n");
-        return((SEXP)1);
-    }
-
-    double *newRhizomecol = (double*)malloc(vecsize*sizeof(double));
-    if(newRhizomecol==NULL) { 
-        Rprintf("Out of Memory for newRhizomecol\n");
-        return((SEXP)1);
-    }
-
     ///////////////////////////////////////////////////////////
 
     int i, i3;
@@ -346,11 +323,7 @@ SEXP caneGro(SEXP LAT,                 /* Latitude                  1 */
     // double RootLitter_d = 0.0, RhizomeLitter_d = 0.0; unused
     double ALitter = 0.0, BLitter = 0.0;
 
-    double *sti, *sti3, *sti4; 
-    // double *sti2; unused
     // double Remob; unused
-    // int k = 0, q = 0, m = 0, n = 0; unused
-    int ri = 0;
 
     double StomataWS = 1, LeafWS = 1;
     double CanopyA, CanopyT;
@@ -382,10 +355,16 @@ SEXP caneGro(SEXP LAT,                 /* Latitude                  1 */
     struct dbp_sugarcane_str dbpS;
     struct dbp_str dbpS_old;
     // struct cenT_str centS;  unused
-    struct soilML_str soilMLS;
     struct soilText_str soTexS; /* , *soTexSp = &soTexS; */
     soTexS = soilTchoose(soilType);
 
+    /* The soil layers start from cws and are updated in place by soilML */
+    struct soil_column soil;
+    initialize_soil_column(&soil, soilLayers);
+    for(i3 = 0; i3 < soilLayers; i3++) soil.cws[i3] = cws[i3];
+    /* Evaluate the Campbell curves exactly instead of from a table */
+    soil.exactCampbell = length(SOILCOEFS) > 9 && soilcoefs[9] != 0;
+
     Rhizome = iRhizome;
     /* It is useful to assume that there is a small amount of
        leaf area at the begining of the growing season. */
@@ -396,13 +375,6 @@ SEXP caneGro(SEXP LAT,                 /* Latitude                  1 */
     Root = Rhizome * 0.001;
     LAI = Leaf * Sp;
 
-    /* Creation of pointers outside the loop */
-    sti = &newLeafcol[0]; /* This creates sti to be a pointer to the position 0
-                             in the newLeafcol vector */
-    // sti2 = &newStemcol[0]; unused
-    sti3 = &newRootcol[0];
-    sti4 = &newRhizomecol[0];
-
     /* Some soil related empirical coefficients */
     double rfl = secs[0];  /* root factor lambda */
     double rsec = secs[1]; /* radiation soil evaporation coefficient */
@@ -493,6 +465,9 @@ SEXP caneGro(SEXP LAT,                 /* Latitude                  1 */
         Rd = nitrop.Rdb1 * LeafN + nitrop.Rdb0;
     }
 
+    const struct solar_table *solar_geometry = solar_table_for(lat);
+    SOLVER_STATS(solver_stats_reset());
+
     for(i = 0; i < vecsize; i++)
     {
         /* First calculate the elapsed Thermal Time*/
@@ -507,7 +482,7 @@ SEXP caneGro(SEXP LAT,                 /* Latitude                  1 */
                 lat, nlayers, vmax, alpha, kparm, beta,
                 Rd, Catm, b0, b1, theta, kd, chil,
                 heightf, LeafN, kpLN, lnb0, lnb1, nitrop.lnFun, upperT, lowerT,
-				nitrop, 0.04, 0, StomataWS, ws);
+				nitrop, 0.04, 0, StomataWS, ws, 0, 0, 0, 0, NULL, solar_geometry, NULL);
 
         // CanopyA = Canopy.Assim * timestep;
         CanopyA = Canopy.GrossAssim * timestep;
@@ -538,20 +513,19 @@ SEXP caneGro(SEXP LAT,                 /* Latitude                  1 */
 
         /* Inserting the multilayer model */
         if(soilLayers > 1) {
-            soilMLS = soilML(precip[i], CanopyT, cws, soilDepth, soilDepths, FieldC, WiltP,
+            soilML(&soil, precip[i], CanopyT, soilDepth, soilDepths, FieldC, WiltP,
                     phi1, phi2, soTexS, wsFun, soilLayers, Root, 
                     LAI, 0.68, temp[i], solar[i], windspeed[i], rh[i], 
                     hydrDist, rfl, rsec, rsdf);
 
-            StomataWS = soilMLS.rcoefPhoto;
-            LeafWS = soilMLS.rcoefSpleaf;
-            soilEvap = soilMLS.SoilEvapo;
+            StomataWS = soil.rcoefPhoto;
+            LeafWS = soil.rcoefSpleaf;
+            soilEvap = soil.SoilEvapo;
 
             for(i3 = 0; i3 < soilLayers; i3++) {
-                cws[i3] = soilMLS.cws[i3];
-                cwsVecSum += cws[i3];
-				water_status[i3 + i*soilLayers] = soilMLS.cws[i3];
-                root_distribution[i3 + i*soilLayers] = soilMLS.rootDist[i3];
+                cwsVecSum += soil.cws[i3];
+				water_status[i3 + i*soilLayers] = soil.cws[i3];
+                root_distribution[i3 + i*soilLayers] = soil.rootDist[i3];
 				psi[i3 + i * soilLayers] = 0;
             }
             waterCont = cwsVecSum / soilLayers;
@@ -677,7 +651,6 @@ SEXP caneGro(SEXP LAT,                 /* Latitude                  1 */
 
             if(kLeaf >= 0) {
                 newLeaf =  dailyassim * kLeaf;
-                *(sti+i) = newLeaf; 
             } else {
                 warning("kleaf is negative");
             }
@@ -722,7 +695,6 @@ SEXP caneGro(SEXP LAT,                 /* Latitude                  1 */
                 if(newRoot>=dailyRootResp)
                 {
                     newRoot = newRoot;
-                    *(sti3+i) = newRoot;
                 } else {
                     newRoot = 0.0;
                     newSugar = newRoot-dailyRootResp; //Stem growth can not be negative. Set it zero and rest is taken care by sugar
@@ -746,12 +718,9 @@ SEXP caneGro(SEXP LAT,                 /* Latitude                  1 */
 
             if(kSeedcane > 0) {
                 newSeedcane = dailyassim * kSeedcane ;	
-                if(newSeedcane>0) {
-                    *(sti4+ri) = newSeedcane;
-                } else {
+                if(!(newSeedcane>0)) {
                     newSeedcane = 0;
                 }
-                ri++;
             } else {
                 if(Seedcane < 0) {
                     Seedcane = 1e-4;
@@ -985,12 +954,15 @@ SEXP caneGro(SEXP LAT,                 /* Latitude                  1 */
     SET_STRING_ELT(names,40,mkChar("moisturecontent"));
     SET_STRING_ELT(names,41,mkChar("dayafterplanting"));
     setAttrib(lists,R_NamesSymbol,names);
+#ifdef BIOCRO_SOLVER_STATS
+    SEXP SolverStats;
+    PROTECT(SolverStats = solver_stats_list());
+    setAttrib(lists, install("solverStats"), SolverStats);
+    UNPROTECT(1);
+#endif
     UNPROTECT(44);  /* 34= 32+2, 2 comes from the very first two PROTECT statement for variable list and name */
+    free_soil_column(&soil);
 
-    free(newLeafcol);
-    free(newStemcol);
-    free(newRootcol);
-    free(newRhizomecol);
     return(lists);
 }
 
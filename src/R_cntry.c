@@ -24,7 +24,8 @@ SEXP cntry(SEXP LEAFL,           /* 1 */
 	   SEXP ROOTLN,          /* 19 */ 
 	   SEXP RHIZLN,          /* 20 */ 
 	   SEXP SOILTYPE,        /* 21 */ 
-	   SEXP KS){          /* 22 */ 
+	   SEXP KS,              /* 22 */ 
+	   SEXP EXPONENTIAL){    /* 23 */ 
 
   struct cenT_str tmp;
 
@@ -69,7 +70,8 @@ SEXP cntry(SEXP LEAFL,           /* 1 */
 		REAL(ROOTLN)[0], 
 		REAL(RHIZLN)[0], 
 		INTEGER(SOILTYPE)[0], 
-		REAL(KS));
+		REAL(KS),
+		INTEGER(EXPONENTIAL)[0]);
 
   REAL(MinN)[0] = tmp.MinN;
   REAL(Resp)[0] = tmp.Resp;
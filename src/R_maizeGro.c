@@ -161,9 +161,11 @@ SEXP maizeGro(
     PROTECT(SNpools = allocVector(REALSXP,9));
     PROTECT(LeafPsimVec = allocVector(REALSXP,vecsize));
 
-    double newLeafcol[8760];
-    double newStemcol[8760];
-    double newRootcol[8760];
+    /* Tissue produced each step, kept until it senesces. */
+    struct senescence_queue leaf_cohorts, stem_cohorts, root_cohorts;
+    initialize_senescence_queue(&leaf_cohorts);
+    initialize_senescence_queue(&stem_cohorts);
+    initialize_senescence_queue(&root_cohorts);
 
     int i, i2, i3, i4;
 
@@ -171,9 +173,8 @@ SEXP maizeGro(
     double TTc = 0.0, TTc_V10 = 0.0;
     double kLeaf, kStem, kRoot, kGrain;
     double newLeaf, newStem, newRoot, newGrain;
+    int q = 0; /* steps with canopy assimilation so far */
 
-    double *sti, *sti2, *sti3;
-    int k = 0, j = 0, q = 0, m = 0;
 
     double StomWS = 1, LeafWS = 1;
     double CanopyA, CanopyT;
@@ -202,15 +203,9 @@ SEXP maizeGro(
     struct ws_str WaterS = {0, 0, 0, 0, 0, 0};
     struct maize_dbp_str dbpS;
     struct lai_str tmpLAI;
-    struct soilML_str soilMLS;
     struct soilText_str soTexS; 
     soTexS = soilTchoose(soilType);
 
-    /* Creation of pointers outside the loop */
-    sti = &newLeafcol[0];
-    sti2 = &newStemcol[0];
-    sti3 = &newRootcol[0];
-
     /* Some soil related empirical coefficients */
     double rfl = REAL(SOILP)[8];  /* root factor lambda */
     double rsec = REAL(SOILP)[9]; /* radiation soil evaporation coefficient */
@@ -236,9 +231,11 @@ SEXP maizeGro(
 
     double plantdensity = REAL(PLANTDENSITY)[0];
 
-    double cwsVec[soilLayers];
+    /* The soil layers start from cws and are updated in place by soilML */
+    struct soil_column soil;
+    initialize_soil_column(&soil, soilLayers);
     for(i2 = 0; i2 < soilLayers; i2++) {
-        cwsVec[i2] = cws[i2];
+        soil.cws[i2] = cws[i2];
     } 
     double cwsVecSum = 0.0;
     /* Parameters for calculating leaf water potential */
@@ -291,6 +288,7 @@ SEXP maizeGro(
     f = REAL(LAIP)[20];
     g = REAL(LAIP)[21];
 
+    const struct solar_table *solar_geometry = solar_table_for(lat);
 
     for(i = 0; i < vecsize; i++)
 	{
@@ -433,7 +431,7 @@ SEXP maizeGro(
                     solar[i], temp[i], rh[i], windspeed[i],
                     lat, nlayers, vmax, alpha, kparm, beta,
 					Rd, Catm, b0, b1, theta, kd, chil,
-					heightf, LeafN, kpLN, lnb0, lnb1, lnFun, upperT, lowerT, nitrop, 0.04, 0, StomWS, ws);
+					heightf, LeafN, kpLN, lnb0, lnb1, lnFun, upperT, lowerT, nitrop, 0.04, 0, StomWS, ws, 0, 0, 0, 0, NULL, solar_geometry, NULL);
 
             CanopyA = Canopy.Assim * timestep;
             CanopyT = Canopy.Trans * timestep;
@@ -470,20 +468,19 @@ SEXP maizeGro(
 
         /* Inserting the multilayer model */
         if(soilLayers > 1) {
-            soilMLS = soilML(precip[i], CanopyT, &cwsVec[0], soilDepth, soilDepths, FieldC, WiltP,
+            soilML(&soil, precip[i], CanopyT, soilDepth, soilDepths, FieldC, WiltP,
                     phi1, phi2, soTexS, wsFun, soilLayers, Root, 
                     LAI, 0.68, temp[i], solar[i], windspeed[i], rh[i], 
                     hydrDist, rfl, rsec, rsdf);
 
-            StomWS = soilMLS.rcoefPhoto;
-            LeafWS = soilMLS.rcoefSpleaf;
-            soilEvap = soilMLS.SoilEvapo;
+            StomWS = soil.rcoefPhoto;
+            LeafWS = soil.rcoefSpleaf;
+            soilEvap = soil.SoilEvapo;
 
             for(i3 = 0; i3 < soilLayers; i3++) {
-                cwsVec[i3] = soilMLS.cws[i3];
-                cwsVecSum += cwsVec[i3];
-                REAL(cwsMat)[i3 + i*soilLayers] = soilMLS.cws[i3];
-                REAL(rdMat)[i3 + i*soilLayers] = soilMLS.rootDist[i3];
+                cwsVecSum += soil.cws[i3];
+                REAL(cwsMat)[i3 + i*soilLayers] = soil.cws[i3];
+                REAL(rdMat)[i3 + i*soilLayers] = soil.rootDist[i3];
             }
             waterCont = cwsVecSum / soilLayers;
             cwsVecSum = 0.0;
@@ -591,32 +588,29 @@ SEXP maizeGro(
         Grain += newGrain;
 
         /* Implementing senescence */
-        *(sti+q) = newLeaf;
-        *(sti2+q) = newStem;
-        *(sti3+q) = newRoot;
+        put_senescence_queue(&leaf_cohorts, q, newLeaf);
+        put_senescence_queue(&stem_cohorts, q, newStem);
+        put_senescence_queue(&root_cohorts, q, newRoot);
 
         /* Senescence for leaf */
         if(TTc < seneLeaf || TTc > R6) {
             Leaf += newLeaf;
         } else {
-            Leaf += newLeaf - *(sti+k);
-            k++;
+            Leaf += newLeaf - take_senescence_queue(&leaf_cohorts);
         }
 
         /* Senescence for stem */
         if(TTc < seneStem || TTc > R6) {
             Stem += newStem;
         } else {
-            Stem += newStem - *(sti2+j);
-            j++;
+            Stem += newStem - take_senescence_queue(&stem_cohorts);
         }
 
         /* Senescence for root */
         if(TTc < seneRoot || TTc > R6) {
             Root += newRoot;
         } else {
-            Root += newRoot - *(sti3+m);
-            m++;
+            Root += newRoot - take_senescence_queue(&root_cohorts);
         }
 
         /* Collecting results */
@@ -708,5 +702,9 @@ SEXP maizeGro(
 
     setAttrib(lists,R_NamesSymbol,names);
     UNPROTECT(25);
+    free_senescence_queue(&leaf_cohorts);
+    free_senescence_queue(&stem_cohorts);
+    free_senescence_queue(&root_cohorts);
+    free_soil_column(&soil);
     return(lists);
 }
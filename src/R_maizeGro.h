@@ -8,7 +8,9 @@ struct Can_Str CanAC(double LAI,int DOY,int hr,double solarR,double Temp,
 		     double Kparm, double beta, double Rd, double Catm, double b0, 
 		     double b1, double theta, double kd, double chil, double heightf,
 		     double leafN, double kpLN, double lnb0, double lnb1, int lnfun,double upperT,
-		     double lowerT,struct nitroParms nitroP, double leafwidth, int eteq, double StomataWS, int ws);
+		     double lowerT,struct nitroParms nitroP, double leafwidth, int eteq, double StomataWS, int ws, int dark_canopy,
+		     int coupled_leaf, enum leaf_solver leaf_solver, int gauss_layering, struct c4_surface *surface,
+		     const struct solar_table *solar, struct canopy_start *start);
 
 struct lai_str laiLizasoFun(double thermalt, double phenostage, double phyllochron1,
 			    double phyllochron2, double Ax, double LT, double k0, 
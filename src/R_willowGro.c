@@ -5,6 +5,7 @@
 
 #include <R.h>
 #include <math.h>
+#include <string.h>
 #include <Rmath.h>
 #include <Rinternals.h>
 #include "c3photo.h"
@@ -13,6 +14,7 @@
 #include "c3canopy.h"
 #include "BioCro.h"
 #include "Century.h"
+#include "solver_stats.h"
 
 SEXP willowGro(
         SEXP LAT,              /* Latitude                            1 */
@@ -73,7 +75,9 @@ SEXP willowGro(
         SEXP JMAXB1,           /*                                    55 */
         SEXP O2,               /*                                    55 */
         SEXP GROWTHRESP,       /*                                    57 */
-        SEXP STOMATAWS)        /*                                    58 */
+        SEXP STOMATAWS,        /*                                    58 */
+        SEXP WARM_START,       /* Warm start the photosynthesis solves  */
+        SEXP COUPLED_LEAF)     /* Solve leaf temperature and Ci together */
 {
     double lat = REAL(LAT)[0];
     int *doy = INTEGER(DOY);
@@ -134,6 +138,8 @@ SEXP willowGro(
     // double o2 = REAL(O2)[0];
     double GrowthRespFraction = REAL(GROWTHRESP)[0];
     double StomataWS = REAL(STOMATAWS)[0];
+    int warm_start = INTEGER(WARM_START)[0];
+    int coupled_leaf = INTEGER(COUPLED_LEAF)[0];
 
     SEXP lists, names;
 
@@ -166,6 +172,7 @@ SEXP willowGro(
     SEXP SCpools;
     SEXP SNpools;
     SEXP LeafPsimVec;
+    SEXP PhotoIterations, PhotoNames;
 
     vecsize = length(DOY);
     PROTECT(lists = allocVector(VECSXP, 29));
@@ -201,8 +208,6 @@ SEXP willowGro(
     PROTECT(SNpools = allocVector(REALSXP, 9));
     PROTECT(LeafPsimVec = allocVector(REALSXP, vecsize));
 
-	if ( vecsize > 8760 ) error("The number of timesteps must be less than or equal to 8760. You probably want to change the day1 or dayn arguments.");
-
     struct BioGro_results_str *results = (struct BioGro_results_str*)malloc(sizeof(struct BioGro_results_str));
     initialize_biogro_results(results, soilLayers, vecsize);
 	
@@ -219,10 +224,24 @@ SEXP willowGro(
     Tfrostlow = REAL(SENCOEFS)[5];
     leafdeathrate = REAL(SENCOEFS)[6];
 
-    double newLeafcol[8760];
-    double newStemcol[8760];
-    double newRootcol[8760];
-    double newRhizomecol[8760];
+    struct BioGro_workspace workspace;
+    initialize_biogro_workspace(&workspace, soilLayers);
+    SOLVER_STATS(solver_stats_reset());
+    workspace.solar = solar_table_for(lat);
+
+    /* Tissue produced each step, kept until it senesces. Leaves die at a
+     * rate instead, so they are not queued. */
+    struct senescence_queue stem_cohorts, root_cohorts, rhizome_cohorts;
+    initialize_senescence_queue(&stem_cohorts);
+    initialize_senescence_queue(&root_cohorts);
+    initialize_senescence_queue(&rhizome_cohorts);
+
+    /* The soil layers start from cws and are updated in place by soilML */
+    struct soil_column soil;
+    initialize_soil_column(&soil, soilLayers);
+    memcpy(soil.cws, cws, soilLayers * sizeof(double));
+    /* Evaluate the Campbell curves exactly instead of from a table */
+    soil.exactCampbell = length(SOILCOEFS) > 9 && soilcoefs[9] != 0;
 
     double Rhizome = initial_biomass[0];
     double Stem = initial_biomass[1];
@@ -245,9 +264,8 @@ SEXP willowGro(
     double RootLitter_d = 0.0, RhizomeLitter_d = 0.0;
     double ALitter = 0.0, BLitter = 0.0;
 
-    double *sti , *sti2, *sti3, *sti4; 
+    double Senesced;
     double Remob;
-    int k = 0, q = 0, m = 0, n = 0;
     int ri = 0;
 
     double LeafWS;
@@ -261,6 +279,7 @@ SEXP willowGro(
     /* Century */
     double MinNitro = centcoefs[19];
     int doyNfert = centcoefs[18];
+    int centExponential = centcoefs[24] != 0;
     double Nfert;
     double SCCs[9];
     double Resp = 0.0;
@@ -283,20 +302,17 @@ SEXP willowGro(
     const double seneRhizome = sencoefs[3];
 
     struct Can_Str Canopy = {0,0,0};
+    struct canopy_start canopy_start;
+    double photo_solves = 0.0, photo_iterations = 0.0;
     struct ws_str WaterS = {0, 0, 0, 0, 0, 0};
     struct dbp_str dbpS;
-    struct soilML_str soilMLS;
     struct soilText_str soTexS; /* , *soTexSp = &soTexS; */
     soTexS = soilTchoose(soilType);
 
     LAI = Leaf * Sp;
+    canopy_start.leaves = 0;
 
     /* Creation of pointers outside the loop */
-    sti = &newLeafcol[0]; /* This creates sti to be a pointer to the position 0
-                             in the newLeafcol vector */
-    sti2 = &newStemcol[0];
-    sti3 = &newRootcol[0];
-    sti4 = &newRhizomecol[0];
 
     /* Some soil related empirical coefficients */
     double rfl = secs[0];  /* root factor lambda */
@@ -306,9 +322,9 @@ SEXP willowGro(
     double transpRes = soilcoefs[7]; /* Resistance to transpiration from soil to leaf */
     double leafPotTh = soilcoefs[8]; /* Leaf water potential threshold */
 
-	double water_status[soilLayers * vecsize];
-	double root_distribution[soilLayers * vecsize];
-	double psi[soilLayers * vecsize];
+	double *water_status = workspace.water_status;
+	double *root_distribution = workspace.root_distribution;
+	double *psi = workspace.psim;
     double cwsVecSum = 0.0;
 
     /* Parameters for calculating leaf water potential */
@@ -349,7 +365,10 @@ SEXP willowGro(
                 solar[i], temp[i], rh[i], windspeed[i],
                 lat, nlayers, vmax, jmax1,
 				Rd, Catm, o2, b0, b1, theta, kd,
-                heightf, LeafN, kpLN, lnb0, lnb1, lnfun, StomataWS, ws);
+                heightf, LeafN, kpLN, lnb0, lnb1, lnfun, StomataWS, ws, coupled_leaf,
+                workspace.solar, warm_start ? &canopy_start : NULL);
+        photo_solves += Canopy.photo_solves;
+        photo_iterations += Canopy.photo_iterations;
 
         CanopyA = Canopy.Assim * timestep * (1.0 - GrowthRespFraction);
         CanopyT = Canopy.Trans * timestep;
@@ -393,21 +412,20 @@ SEXP willowGro(
 
         /* Inserting the multilayer model */
         if(soilLayers > 1) {
-            soilMLS = soilML(precip[i], CanopyT, cws, soilDepth, soilDepths, FieldC, WiltP,
+            soilML(&soil, precip[i], CanopyT, soilDepth, soilDepths, FieldC, WiltP,
                     phi1, phi2, soTexS, wsFun, soilLayers, Root, 
                     LAI, 0.68, temp[i], solar[i], windspeed[i], rh[i], 
                     hydrDist, rfl, rsec, rsdf);
 
-            StomataWS = soilMLS.rcoefPhoto;
-            LeafWS = soilMLS.rcoefSpleaf;
-            soilEvap = soilMLS.SoilEvapo;
+            StomataWS = soil.rcoefPhoto;
+            LeafWS = soil.rcoefSpleaf;
+            soilEvap = soil.SoilEvapo;
 
             for(i3=0; i3 < soilLayers; i3++) {
-                cws[i3] = soilMLS.cws[i3];
-                cwsVecSum += cws[i3];
-                water_status[i3 + i*soilLayers] = soilMLS.cws[i3];
-                root_distribution[i3 + i*soilLayers] = soilMLS.rootDist[i3];
-				psi[i3 + i * soilLayers] = 0;
+                cwsVecSum += soil.cws[i3];
+                water_status[i3] = soil.cws[i3];
+                root_distribution[i3] = soil.rootDist[i3];
+				psi[i3] = 0;
             }
             waterCont = cwsVecSum / soilLayers;
             cwsVecSum = 0.0;
@@ -419,9 +437,9 @@ SEXP willowGro(
             waterCont = WaterS.awc;
             StomataWS = WaterS.rcoefPhoto ; 
             LeafWS = WaterS.rcoefSpleaf;
-            water_status[i] = waterCont;
-            psi[i] = WaterS.psim;
-			root_distribution[i] = 0;
+            water_status[0] = waterCont;
+            psi[0] = WaterS.psim;
+			root_distribution[0] = 0;
         }
 
         /* An alternative way of computing water stress is by doing the leaf
@@ -541,10 +559,6 @@ SEXP willowGro(
             }
 
             newLeaf = resp(newLeaf, mrc1, temp[i]);
-
-            *(sti+i) = newLeaf; /* This populates the vector newLeafcol. It makes sense
-                                   to use i because when kLeaf is negative no new leaf is
-                                   being accumulated and thus would not be subjected to senescence */
         } else {
             error("kLeaf should be positive");
         }
@@ -574,7 +588,6 @@ SEXP willowGro(
                 Root += kRoot * Remob;
                 Grain += kGrain * Remob;
                 newLeaf = newLeaf - Deadleaf + (kLeaf * Remob);
-                k++;
                 //Rprintf("%f,%f,%f,%f\n",leafdeathrate,Deadleaf,Remob,Leaf);
                 //      error("stop");
             }
@@ -596,7 +609,7 @@ SEXP willowGro(
         if(kStem >= 0) {
             newStem = CanopyA * kStem ;
             newStem = resp(newStem, mrc1, temp[i]);
-            *(sti2+i) = newStem;
+            put_senescence_queue(&stem_cohorts, i, newStem);
         } else {
             error("kStem should be positive");
         }
@@ -604,15 +617,15 @@ SEXP willowGro(
         if(TTc < seneStem) {
             Stem += newStem;
         } else {
-            Stem += newStem - *(sti2+q);
-            StemLitter += *(sti2+q);
-            q++;
+            Senesced = take_senescence_queue(&stem_cohorts);
+            Stem += newStem - Senesced;
+            StemLitter += Senesced;
         }
 
         if(kRoot > 0) {
             newRoot = CanopyA * kRoot ;
             newRoot = resp(newRoot, mrc2, temp[i]);
-            *(sti3+i) = newRoot;
+            put_senescence_queue(&root_cohorts, i, newRoot);
         } else {
             newRoot = Root * kRoot ;
             Rhizome += kRhizome * -newRoot * 0.9;
@@ -624,15 +637,15 @@ SEXP willowGro(
         if(TTc < seneRoot) {
             Root += newRoot;
         } else {
-            Root += newRoot - *(sti3+m);
-            RootLitter += *(sti3+m);
-            m++;
+            Senesced = take_senescence_queue(&root_cohorts);
+            Root += newRoot - Senesced;
+            RootLitter += Senesced;
         }
 
         if(kRhizome > 0) {
             newRhizome = CanopyA * kRhizome ;
             newRhizome = resp(newRhizome, mrc2, temp[i]);
-            *(sti4+ri) = newRhizome;
+            put_senescence_queue(&rhizome_cohorts, ri, newRhizome);
             /* Here i will not work because the rhizome goes from being a source
                to a sink. I need its own index. Let's call it rhizome's i or ri.*/
             ri++;
@@ -652,9 +665,9 @@ SEXP willowGro(
         if(TTc < seneRhizome) {
             Rhizome += newRhizome;
         } else {
-            Rhizome += newRhizome - *(sti4+n);
-            RhizomeLitter += *(sti4+n);
-            n++;
+            Senesced = take_senescence_queue(&rhizome_cohorts);
+            Rhizome += newRhizome - Senesced;
+            RhizomeLitter += Senesced;
         }
 
         if((kGrain < 1e-10) || (TTc < thermalp[4])) {
@@ -667,7 +680,7 @@ SEXP willowGro(
             Grain += newGrain;  
         }
 
-        if(i % 24*centTimestep == 0) {
+        if(i % (24*centTimestep) == 0) {
             LeafLitter_d = LeafLitter * ((0.1/30)*centTimestep);
             StemLitter_d = StemLitter * ((0.1/30)*centTimestep);
             RootLitter_d = RootLitter * ((0.1/30)*centTimestep);
@@ -692,7 +705,8 @@ SEXP willowGro(
                     centcoefs[15],  /* Root litter N */
                     centcoefs[16],   /* Rhizome litter N */
                     soilType, 
-                    centks);
+                    centks,
+                    centExponential);
         }
 
         MinNitro = results->centS.MinN; /* These should be kg / m^2 per week? */
@@ -730,14 +744,14 @@ SEXP willowGro(
 		results->vmax[i] = vmax;
 		results->alpha[i] = alpha;
 		results->specific_leaf_area[i] = Sp;
-		results->min_nitro[i] = MinNitro / (24 / centTimestep);
+		results->min_nitro[i] = MinNitro / (24.0 / centTimestep);
 		results->respiration[i] = Resp / (24*centTimestep);
 		results->soil_evaporation[i] = soilEvap;
 		results->leaf_psim[i] = LeafPsim;
 		for(int layer = 0; layer < soilLayers; layer++) {
-			results->psim[layer + i * soilLayers] = psi[layer + i * soilLayers];
-			results->water_status[layer + i * soilLayers] = water_status[layer + i * soilLayers];
-			results->root_distribution[layer + i * soilLayers] = root_distribution[layer + i * soilLayers];
+			results->psim[layer + i * soilLayers] = psi[layer];
+			results->water_status[layer + i * soilLayers] = water_status[layer];
+			results->root_distribution[layer + i * soilLayers] = root_distribution[layer];
 		}
 
         REAL(DayofYear)[i] =  INTEGER(DOY)[i];
@@ -853,8 +867,30 @@ SEXP willowGro(
     SET_STRING_ELT(names,27,mkChar("SNpools"));
     SET_STRING_ELT(names,28,mkChar("LeafPsimVec"));
     setAttrib(lists,R_NamesSymbol,names);
-    UNPROTECT(31);
+
+    /* Leaf photosynthesis solves and their average number of iterations */
+    PROTECT(PhotoIterations = allocVector(REALSXP, 2));
+    PROTECT(PhotoNames = allocVector(STRSXP, 2));
+    REAL(PhotoIterations)[0] = photo_solves;
+    REAL(PhotoIterations)[1] = photo_solves > 0 ? photo_iterations / photo_solves : 0.0;
+    SET_STRING_ELT(PhotoNames, 0, mkChar("solves"));
+    SET_STRING_ELT(PhotoNames, 1, mkChar("iterations"));
+    setAttrib(PhotoIterations, R_NamesSymbol, PhotoNames);
+    setAttrib(lists, install("photoIterations"), PhotoIterations);
+#ifdef BIOCRO_SOLVER_STATS
+    SEXP SolverStats;
+    PROTECT(SolverStats = solver_stats_list());
+    setAttrib(lists, install("solverStats"), SolverStats);
+    UNPROTECT(1);
+#endif
+    UNPROTECT(33);
+    free_biogro_workspace(&workspace);
+    free_soil_column(&soil);
+    free_senescence_queue(&stem_cohorts);
+    free_senescence_queue(&root_cohorts);
+    free_senescence_queue(&rhizome_cohorts);
     free_biogro_results(results);
+    free(results);
     return(lists);
 }
 
@@ -0,0 +1,294 @@
+/*
+ *  BioCro/src/biogro_sinks.c
+ *
+ *  Sinks that receive the output of BioGro as it runs. A sink decides
+ *  what is kept, so a long run only holds as much output as the sink
+ *  asks for.
+ *
+ */
+
+#include <R.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "BioCro.h"
+
+const char *biogro_channel_names[BIOGRO_CHANNELS] = {
+	"DayofYear", "Hour", "CanopyAssim", "CanopyTrans", "Leaf", "Stem",
+	"Root", "Rhizome", "Grain", "LAI", "ThermalT", "SoilWatCont",
+	"StomatalCondCoefs", "LeafReductionCoefs", "LeafNitrogen",
+	"AboveLitter", "BelowLitter", "VmaxVec", "AlphaVec", "SpVec",
+	"MinNitroVec", "RespVec", "SoilEvaporation", "LeafPsimVec"
+};
+
+double *biogro_results_channel(struct BioGro_results_str *results, int channel)
+{
+	switch (channel) {
+		case BIOGRO_DAY_OF_YEAR: return results->day_of_year;
+		case BIOGRO_HOUR: return results->hour;
+		case BIOGRO_CANOPY_ASSIM: return results->CanopyAssim;
+		case BIOGRO_CANOPY_TRANSPIRATION: return results->canopy_transpiration;
+		case BIOGRO_LEAF: return results->Leafy;
+		case BIOGRO_STEM: return results->Stemy;
+		case BIOGRO_ROOT: return results->Rooty;
+		case BIOGRO_RHIZOME: return results->Rhizomey;
+		case BIOGRO_GRAIN: return results->Grainy;
+		case BIOGRO_LAI: return results->LAIc;
+		case BIOGRO_THERMAL_TIME: return results->thermal_time;
+		case BIOGRO_SOIL_WATER_CONTENT: return results->soil_water_content;
+		case BIOGRO_STOMATA_COND_COEFS: return results->stomata_cond_coefs;
+		case BIOGRO_LEAF_REDUCTION_COEFS: return results->leaf_reduction_coefs;
+		case BIOGRO_LEAF_NITROGEN: return results->leaf_nitrogen;
+		case BIOGRO_ABOVE_GROUND_LITTER: return results->above_ground_litter;
+		case BIOGRO_BELOW_GROUND_LITTER: return results->below_ground_litter;
+		case BIOGRO_VMAX: return results->vmax;
+		case BIOGRO_ALPHA: return results->alpha;
+		case BIOGRO_SPECIFIC_LEAF_AREA: return results->specific_leaf_area;
+		case BIOGRO_MIN_NITRO: return results->min_nitro;
+		case BIOGRO_RESPIRATION: return results->respiration;
+		case BIOGRO_SOIL_EVAPORATION: return results->soil_evaporation;
+		case BIOGRO_LEAF_PSIM: return results->leaf_psim;
+	}
+	return NULL;
+}
+
+/* Keep all: every recorded step goes to its own slot of a results object. */
+
+static void store_step(struct BioGro_results_str *results, int j, const struct BioGro_step *step,
+		unsigned long channels, int soil)
+{
+	int c, layer;
+	int layers = step->soil_layers;
+
+	for (c = 0; c < BIOGRO_CHANNELS; c++) {
+		if (channels & BIOGRO_CHANNEL_BIT(c)) biogro_results_channel(results, c)[j] = step->value[c];
+	}
+	if (!soil) return;
+	for (layer = 0; layer < layers; layer++) {
+		results->psim[layer + j * layers] = step->psim[layer];
+		results->water_status[layer + j * layers] = step->water_status[layer];
+		results->root_distribution[layer + j * layers] = step->root_distribution[layer];
+	}
+}
+
+static void record_results(struct BioGro_sink *sink, int index, const struct BioGro_step *step)
+{
+	struct BioGro_results_str *results = (struct BioGro_results_str*)sink->data;
+	int j = index / sink->interval;
+
+	if (j < results->vector_size) store_step(results, j, step, BIOGRO_ALL_CHANNELS, 1);
+}
+
+static void finish_results(struct BioGro_sink *sink, const struct BioGro_step *last)
+{
+	struct BioGro_results_str *results = (struct BioGro_results_str*)sink->data;
+	results->centS = *last->centS;
+}
+
+void initialize_results_sink(struct BioGro_sink *sink, struct BioGro_results_str *results, int interval)
+{
+	sink->record = record_results;
+	sink->finish = finish_results;
+	sink->interval = interval > 0 ? interval : 1;
+	sink->stop = 0;
+	sink->data = results;
+}
+
+/* Keep selected: like keep all, restricted to some channels and steps. */
+
+/* The slot step index is stored in, or -1 if it is not kept. */
+int biogro_results_slot(const struct BioGro_results_selection *selection, int index)
+{
+	int lower = 0, upper = selection->n_indices - 1, middle;
+
+	while (lower <= upper) {
+		middle = (lower + upper) / 2;
+		if (selection->indices[middle] < index) {
+			lower = middle + 1;
+		} else if (selection->indices[middle] > index) {
+			upper = middle - 1;
+		} else {
+			return middle;
+		}
+	}
+	return -1;
+}
+
+static void record_selected(struct BioGro_sink *sink, int index, const struct BioGro_step *step)
+{
+	struct BioGro_results_selection *selection = (struct BioGro_results_selection*)sink->data;
+	int j = selection->indices != NULL ? biogro_results_slot(selection, index) : index / sink->interval;
+
+	if (j >= 0 && j < selection->results->vector_size) {
+		store_step(selection->results, j, step, selection->channels, selection->soil);
+	}
+}
+
+static void finish_selected(struct BioGro_sink *sink, const struct BioGro_step *last)
+{
+	struct BioGro_results_selection *selection = (struct BioGro_results_selection*)sink->data;
+	selection->results->centS = *last->centS;
+}
+
+/* selection must outlive the runs the sink is used for. */
+void initialize_selected_results_sink(struct BioGro_sink *sink, struct BioGro_results_selection *selection, int interval)
+{
+	sink->record = record_selected;
+	sink->finish = finish_selected;
+	sink->interval = interval > 0 ? interval : 1;
+	sink->stop = 0;
+	sink->data = selection;
+}
+
+/* Daily aggregates: fluxes are summed over the day and everything else is
+ * averaged over the steps recorded in it. Each recorded step stands for
+ * interval steps in the sums. The hour channel holds the hour of the last
+ * step recorded in the day, so a day cut short by the start or the end of
+ * the run can be recognized. */
+
+struct daily_sink_data {
+	struct BioGro_results_str *results;
+	double sums[BIOGRO_CHANNELS];
+	double *layer_sums; /* psim, water_status and root_distribution */
+	double day_of_year;
+	double last_hour;
+	int steps;
+	int first_day;
+	int day;
+};
+
+static int is_flux(int channel)
+{
+	return channel == BIOGRO_CANOPY_ASSIM || channel == BIOGRO_CANOPY_TRANSPIRATION ||
+		channel == BIOGRO_RESPIRATION || channel == BIOGRO_SOIL_EVAPORATION;
+}
+
+static void flush_day(struct daily_sink_data *daily, int interval)
+{
+	struct BioGro_results_str *results = daily->results;
+	int c, layer;
+	int layers = results->soil_layers;
+	int j = daily->day;
+
+	if (daily->steps == 0) return;
+
+	if (j < results->vector_size) {
+		for (c = 0; c < BIOGRO_CHANNELS; c++) {
+			biogro_results_channel(results, c)[j] = is_flux(c) ? daily->sums[c] * interval : daily->sums[c] / daily->steps;
+		}
+		results->hour[j] = daily->last_hour;
+
+		for (layer = 0; layer < layers; layer++) {
+			results->psim[layer + j * layers] = daily->layer_sums[layer] / daily->steps;
+			results->water_status[layer + j * layers] = daily->layer_sums[layer + layers] / daily->steps;
+			results->root_distribution[layer + j * layers] = daily->layer_sums[layer + 2 * layers] / daily->steps;
+		}
+	}
+
+	for (c = 0; c < BIOGRO_CHANNELS; c++) daily->sums[c] = 0;
+	for (layer = 0; layer < 3 * layers; layer++) daily->layer_sums[layer] = 0;
+	daily->steps = 0;
+	daily->day++;
+}
+
+static void record_daily(struct BioGro_sink *sink, int index, const struct BioGro_step *step)
+{
+	struct daily_sink_data *daily = (struct daily_sink_data*)sink->data;
+	int c, layer;
+	int layers = daily->results->soil_layers;
+
+	if (daily->steps > 0 && step->value[BIOGRO_DAY_OF_YEAR] != daily->day_of_year) {
+		flush_day(daily, sink->interval);
+	}
+	daily->day_of_year = step->value[BIOGRO_DAY_OF_YEAR];
+	daily->last_hour = step->value[BIOGRO_HOUR];
+
+	for (c = 0; c < BIOGRO_CHANNELS; c++) {
+		daily->sums[c] += step->value[c];
+	}
+	for (layer = 0; layer < layers; layer++) {
+		daily->layer_sums[layer] += step->psim[layer];
+		daily->layer_sums[layer + layers] += step->water_status[layer];
+		daily->layer_sums[layer + 2 * layers] += step->root_distribution[layer];
+	}
+	daily->steps++;
+}
+
+/* The last day is written and the sink is ready for another run. */
+static void finish_daily(struct BioGro_sink *sink, const struct BioGro_step *last)
+{
+	struct daily_sink_data *daily = (struct daily_sink_data*)sink->data;
+
+	flush_day(daily, sink->interval);
+	daily->results->centS = *last->centS;
+	daily->day = daily->first_day;
+}
+
+/* Day j of the run goes to slot first_day + j of daily, which must have as
+ * many elements as there are days, and is written once its last step has
+ * been recorded. first_day is not zero when a run resumes from a saved
+ * state. The memory of the sink is released by free_daily_sink. */
+void initialize_daily_sink(struct BioGro_sink *sink, struct BioGro_results_str *daily, int first_day, int interval)
+{
+	struct daily_sink_data *data = (struct daily_sink_data*)calloc(1, sizeof(struct daily_sink_data));
+
+	data->results = daily;
+	data->layer_sums = (double*)calloc(3 * daily->soil_layers, sizeof(double));
+	data->first_day = first_day;
+	data->day = first_day;
+
+	sink->record = record_daily;
+	sink->finish = finish_daily;
+	sink->interval = interval > 0 ? interval : 1;
+	sink->stop = 0;
+	sink->data = data;
+}
+
+void free_daily_sink(struct BioGro_sink *sink)
+{
+	struct daily_sink_data *daily = (struct daily_sink_data*)sink->data;
+
+	free(daily->layer_sums);
+	free(daily);
+	sink->data = NULL;
+}
+
+/* Write to file: one comma separated row per recorded step with the scalar
+ * channels. Soil layer values are not written. */
+
+static void record_file(struct BioGro_sink *sink, int index, const struct BioGro_step *step)
+{
+	FILE *file = (FILE*)sink->data;
+	int c;
+
+	for (c = 0; c < BIOGRO_CHANNELS; c++) {
+		fprintf(file, c == 0 ? "%.10g" : ",%.10g", step->value[c]);
+	}
+	fputc('\n', file);
+}
+
+static void finish_file(struct BioGro_sink *sink, const struct BioGro_step *last)
+{
+	fclose((FILE*)sink->data);
+	sink->data = NULL;
+}
+
+/* Returns 0 if the file could not be opened. */
+int initialize_file_sink(struct BioGro_sink *sink, const char *path, int interval)
+{
+	int c;
+	FILE *file = fopen(path, "w");
+
+	if (file == NULL) return 0;
+
+	for (c = 0; c < BIOGRO_CHANNELS; c++) {
+		fprintf(file, c == 0 ? "%s" : ",%s", biogro_channel_names[c]);
+	}
+	fputc('\n', file);
+
+	sink->record = record_file;
+	sink->finish = finish_file;
+	sink->interval = interval > 0 ? interval : 1;
+	sink->stop = 0;
+	sink->data = file;
+	return 1;
+}
@@ -0,0 +1,251 @@
+/*
+ *  BioCro/src/biogro_state.c
+ *
+ *  The state a BioGro run carries between steps, so that a run can be
+ *  stopped at any step, saved and resumed.
+ *
+ */
+
+#include <R.h>
+#include <stdlib.h>
+#include <string.h>
+#include "BioCro.h"
+
+/* Bumped whenever the layout written by save_biogro_state changes. */
+#define BIOGRO_STATE_VERSION 3
+
+/* Scalars, SCCs, centS and water_stress, in the order they are saved. */
+#define BIOGRO_STATE_SCALARS (23 + 9 + 20 + 6)
+
+void initialize_biogro_state(struct BioGro_state *state, int soil_layers)
+{
+	memset(state, 0, sizeof(struct BioGro_state));
+
+	state->soil_layers = soil_layers;
+
+	initialize_soil_column(&state->soil, soil_layers);
+	initialize_senescence_queue(&state->leaf_cohorts);
+	initialize_senescence_queue(&state->stem_cohorts);
+	initialize_senescence_queue(&state->root_cohorts);
+	initialize_senescence_queue(&state->rhizome_cohorts);
+}
+
+void free_biogro_state(struct BioGro_state *state)
+{
+	free_soil_column(&state->soil);
+
+	free_senescence_queue(&state->leaf_cohorts);
+	free_senescence_queue(&state->stem_cohorts);
+	free_senescence_queue(&state->root_cohorts);
+	free_senescence_queue(&state->rhizome_cohorts);
+}
+
+/* The state at step 0. */
+void start_biogro_state(struct BioGro_state *state, double initial_biomass[4], double Sp,
+		double centcoefs[], double water_content, double cws[], int soil_layers,
+		double ileafn, double vmax1, double alpha1, double StomataWS)
+{
+	int i;
+
+	state->index = 0;
+
+	state->rhizome = initial_biomass[0];
+	state->stem = initial_biomass[1];
+	state->leaf = initial_biomass[2];
+	state->root = initial_biomass[3];
+	state->grain = 0.0;
+	state->lai = state->leaf * Sp;
+	state->thermal_time = 0.0;
+
+	state->new_leaf = 0.0;
+	state->new_stem = 0.0;
+	state->new_root = 0.0;
+	state->new_rhizome = 0.0;
+	state->new_grain = 0.0;
+
+	state->leaf_litter = centcoefs[20];
+	state->stem_litter = centcoefs[21];
+	state->root_litter = centcoefs[22];
+	state->rhizome_litter = centcoefs[23];
+	state->min_nitro = centcoefs[19];
+	for (i = 0; i < 9; i++) state->SCCs[i] = centcoefs[i];
+	memset(&state->centS, 0, sizeof(struct cenT_str));
+	memset(&state->water_stress, 0, sizeof(struct ws_str));
+
+	state->specific_leaf_area = Sp;
+	state->leaf_nitrogen = ileafn; /* Need to set it because it is used by CanA before it is computed */
+	state->vmax = vmax1;
+	state->alpha = alpha1;
+	state->stomata_ws = StomataWS;
+	state->water_content = water_content;
+	for (i = 0; i < soil_layers; i++) state->soil.cws[i] = cws[i];
+
+	clear_senescence_queue(&state->leaf_cohorts);
+	clear_senescence_queue(&state->stem_cohorts);
+	clear_senescence_queue(&state->root_cohorts);
+	clear_senescence_queue(&state->rhizome_cohorts);
+	state->rhizome_cohort_count = 0;
+	state->canopy_start.leaves = 0;
+}
+
+/* Both states must have been initialized with the same number of soil
+ * layers. */
+void copy_biogro_state(struct BioGro_state *to, const struct BioGro_state *from)
+{
+	struct BioGro_state queues = *to;
+
+	*to = *from;
+	to->soil = queues.soil;
+	to->leaf_cohorts = queues.leaf_cohorts;
+	to->stem_cohorts = queues.stem_cohorts;
+	to->root_cohorts = queues.root_cohorts;
+	to->rhizome_cohorts = queues.rhizome_cohorts;
+
+	copy_soil_column(&to->soil, &from->soil);
+	copy_senescence_queue(&to->leaf_cohorts, &from->leaf_cohorts);
+	copy_senescence_queue(&to->stem_cohorts, &from->stem_cohorts);
+	copy_senescence_queue(&to->root_cohorts, &from->root_cohorts);
+	copy_senescence_queue(&to->rhizome_cohorts, &from->rhizome_cohorts);
+}
+
+/* Only the cohorts that have not senesced yet are saved. */
+int biogro_state_length(const struct BioGro_state *state)
+{
+	return 4 + BIOGRO_STATE_SCALARS + 1 + 2 * state->canopy_start.leaves + state->soil_layers +
+		senescence_queue_length(&state->leaf_cohorts) +
+		senescence_queue_length(&state->stem_cohorts) +
+		senescence_queue_length(&state->root_cohorts) +
+		senescence_queue_length(&state->rhizome_cohorts);
+}
+
+/* Writes the state to buffer, which must hold biogro_state_length() values. */
+void save_biogro_state(const struct BioGro_state *state, double *buffer)
+{
+	double *b = buffer;
+	int i;
+
+	*b++ = BIOGRO_STATE_VERSION;
+	*b++ = state->index;
+	*b++ = state->soil_layers;
+	*b++ = state->rhizome_cohort_count;
+
+	*b++ = state->leaf;
+	*b++ = state->stem;
+	*b++ = state->root;
+	*b++ = state->rhizome;
+	*b++ = state->grain;
+	*b++ = state->lai;
+	*b++ = state->thermal_time;
+	*b++ = state->new_leaf;
+	*b++ = state->new_stem;
+	*b++ = state->new_root;
+	*b++ = state->new_rhizome;
+	*b++ = state->new_grain;
+	*b++ = state->leaf_litter;
+	*b++ = state->stem_litter;
+	*b++ = state->root_litter;
+	*b++ = state->rhizome_litter;
+	*b++ = state->min_nitro;
+	*b++ = state->specific_leaf_area;
+	*b++ = state->leaf_nitrogen;
+	*b++ = state->vmax;
+	*b++ = state->alpha;
+	*b++ = state->stomata_ws;
+	*b++ = state->water_content;
+
+	for (i = 0; i < 9; i++) *b++ = state->SCCs[i];
+	for (i = 0; i < 9; i++) *b++ = state->centS.SCs[i];
+	for (i = 0; i < 9; i++) *b++ = state->centS.SNs[i];
+	*b++ = state->centS.MinN;
+	*b++ = state->centS.Resp;
+	*b++ = state->water_stress.rcoefPhoto;
+	*b++ = state->water_stress.rcoefSpleaf;
+	*b++ = state->water_stress.awc;
+	*b++ = state->water_stress.psim;
+	*b++ = state->water_stress.runoff;
+	*b++ = state->water_stress.Nleach;
+
+	*b++ = state->canopy_start.leaves;
+	for (i = 0; i < state->canopy_start.leaves; i++) *b++ = state->canopy_start.Ci[i];
+	for (i = 0; i < state->canopy_start.leaves; i++) *b++ = state->canopy_start.Assim[i];
+
+	for (i = 0; i < state->soil_layers; i++) *b++ = state->soil.cws[i];
+	b = save_senescence_queue(&state->leaf_cohorts, b);
+	b = save_senescence_queue(&state->stem_cohorts, b);
+	b = save_senescence_queue(&state->root_cohorts, b);
+	save_senescence_queue(&state->rhizome_cohorts, b);
+}
+
+/* Reads a buffer written by save_biogro_state into a state initialized
+ * with the same number of soil layers. Returns 0 if the buffer does not fit
+ * the state, which must then be started again before it is used. */
+int restore_biogro_state(struct BioGro_state *state, const double *buffer, int length)
+{
+	const double *b = buffer;
+	const double *end = buffer + length;
+	int soil_layers, leaves, i;
+
+	if (length < 4 || (int)b[0] != BIOGRO_STATE_VERSION) return 0;
+	soil_layers = (int)b[2];
+	if (soil_layers != state->soil_layers || b[1] < 0) return 0;
+	if (length < 4 + BIOGRO_STATE_SCALARS + 1 + soil_layers) return 0;
+	leaves = (int)b[4 + BIOGRO_STATE_SCALARS];
+	if (leaves < 0 || leaves > 2 * MAXLAY ||
+	    length < 4 + BIOGRO_STATE_SCALARS + 1 + 2 * leaves + soil_layers) return 0;
+
+	state->index = (int)b[1];
+	state->rhizome_cohort_count = (int)b[3];
+	b += 4;
+
+	state->leaf = *b++;
+	state->stem = *b++;
+	state->root = *b++;
+	state->rhizome = *b++;
+	state->grain = *b++;
+	state->lai = *b++;
+	state->thermal_time = *b++;
+	state->new_leaf = *b++;
+	state->new_stem = *b++;
+	state->new_root = *b++;
+	state->new_rhizome = *b++;
+	state->new_grain = *b++;
+	state->leaf_litter = *b++;
+	state->stem_litter = *b++;
+	state->root_litter = *b++;
+	state->rhizome_litter = *b++;
+	state->min_nitro = *b++;
+	state->specific_leaf_area = *b++;
+	state->leaf_nitrogen = *b++;
+	state->vmax = *b++;
+	state->alpha = *b++;
+	state->stomata_ws = *b++;
+	state->water_content = *b++;
+
+	for (i = 0; i < 9; i++) state->SCCs[i] = *b++;
+	for (i = 0; i < 9; i++) state->centS.SCs[i] = *b++;
+	for (i = 0; i < 9; i++) state->centS.SNs[i] = *b++;
+	state->centS.MinN = *b++;
+	state->centS.Resp = *b++;
+	state->water_stress.rcoefPhoto = *b++;
+	state->water_stress.rcoefSpleaf = *b++;
+	state->water_stress.awc = *b++;
+	state->water_stress.psim = *b++;
+	state->water_stress.runoff = *b++;
+	state->water_stress.Nleach = *b++;
+
+	state->canopy_start.leaves = (int)*b++;
+	for (i = 0; i < leaves; i++) state->canopy_start.Ci[i] = *b++;
+	for (i = 0; i < leaves; i++) state->canopy_start.Assim[i] = *b++;
+
+	for (i = 0; i < soil_layers; i++) state->soil.cws[i] = *b++;
+
+	if ((b = restore_senescence_queue(&state->leaf_cohorts, b, end - b)) == NULL ||
+	    (b = restore_senescence_queue(&state->stem_cohorts, b, end - b)) == NULL ||
+	    (b = restore_senescence_queue(&state->root_cohorts, b, end - b)) == NULL ||
+	    (b = restore_senescence_queue(&state->rhizome_cohorts, b, end - b)) == NULL ||
+	    b != end) {
+		state->index = 0;
+		return 0;
+	}
+	return 1;
+}
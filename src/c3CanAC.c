@@ -1,8 +1,28 @@
+#include <stddef.h>
 #include "BioCro.h"
 #include "c3photo.h"
 #include "c3canopy.h"
 #include "c3EvapoTrans.h"
+#include "leaf_coupled.h"
 
+/* The solve of leaf to start from, or the usual guess */
+static struct c3_str leaf_start(const struct canopy_start *start, int leaves, int leaf)
+{
+    struct c3_str photo = {0, 0, 0, 0};
+    if(start != NULL && start->leaves == leaves) {
+        photo.Ci = start->Ci[leaf];
+        photo.Assim = start->Assim[leaf];
+    }
+    return(photo);
+}
+
+static void count_solve(struct Can_Str *ans, struct c3_str photo)
+{
+    ans->photo_solves++;
+    ans->photo_iterations += photo.iterations;
+}
+
+/* start, coupled_leaf and solar work as in CanAC */
 struct Can_Str c3CanAC(double LAI,
 		int DOY,
 		int hr,
@@ -28,11 +48,15 @@ struct Can_Str c3CanAC(double LAI,
 		double lnb1,
 		int lnfun,
 		double StomataWS,
-		int ws)
+		int ws,
+		int coupled_leaf,
+		const struct solar_table *solar,
+		struct canopy_start *start)
 {
 
     struct ET_Str tmp5_ET, tmp6_ET; 
     struct c3_str temp_photo_results = {0, 0, 0, 0};
+    struct c3_str air_photo_results;
     struct Can_Str ans = {0, 0, 0};
 
     const double cf = 3600 * 1e-6 * 30 * 1e-6 * 10000;
@@ -47,6 +71,7 @@ struct Can_Str c3CanAC(double LAI,
     /* 10000 - meters squared per hectare */
 
     int i;
+    int leaves = 2 * nlayers;
     double Idir, Idiff, cosTh;
     double LAIc;
     double IDir, IDiff, Itot, rh, layerWindSpeed;
@@ -65,7 +90,7 @@ struct Can_Str c3CanAC(double LAI,
 	double leafN_lay;
 
     struct Light_model light_model;
-    light_model = lightME(lat, DOY, hr);
+    light_model = solar_light(solar, lat, DOY, hr);
 
     Idir = light_model.irradiance_direct * solarR;
     Idiff = light_model.irradiance_diffuse * solarR;
@@ -110,11 +135,25 @@ struct Can_Str c3CanAC(double LAI,
 
         Leafsun = LAIc * pLeafsun;
 
-        tmp5_ET = c3EvapoTrans(IDir, Itot, Temp, rh, layerWindSpeed, LAIc, CanHeight,
-				vmax1, Jmax, Rd, b0, b1, Catm, o2, theta, StomataWS, ws);
-
-        TempIdir = Temp + tmp5_ET.Deltat;
-        temp_photo_results = c3photoC(IDir, TempIdir, rh, vmax1, Jmax, Rd, b0, b1, Catm, o2, theta, StomataWS, ws);
+        air_photo_results = leaf_start(start, leaves, i);
+        if(coupled_leaf) {
+            temp_photo_results = c3photoC_coupled(IDir, Itot, Temp, rh, layerWindSpeed, LAIc, CanHeight,
+				vmax1, Jmax, Rd, b0, b1, Catm, o2, theta, StomataWS, ws, air_photo_results.Ci, &tmp5_ET);
+        } else {
+            tmp5_ET = c3EvapoTrans(IDir, Itot, Temp, rh, layerWindSpeed, LAIc, CanHeight,
+				vmax1, Jmax, Rd, b0, b1, Catm, o2, theta, StomataWS, ws, &air_photo_results);
+            count_solve(&ans, air_photo_results);
+            if(start == NULL) air_photo_results.Ci = 0;
+
+            TempIdir = Temp + tmp5_ET.Deltat;
+            temp_photo_results = c3photoC_warm(IDir, TempIdir, rh, vmax1, Jmax, Rd, b0, b1, Catm, o2, theta, StomataWS, ws,
+				air_photo_results.Ci, air_photo_results.Assim);
+        }
+        count_solve(&ans, temp_photo_results);
+        if(start != NULL) {
+            start->Ci[i] = temp_photo_results.Ci;
+            start->Assim[i] = temp_photo_results.Assim;
+        }
         AssIdir = temp_photo_results.Assim;
         GAssIdir = temp_photo_results.GrossAssim;
 
@@ -122,11 +161,25 @@ struct Can_Str c3CanAC(double LAI,
         pLeafshade = light_profile.shaded_fraction[current_layer];
         Leafshade = LAIc * pLeafshade;
 
-        tmp6_ET = c3EvapoTrans(IDiff, Itot, Temp, rh, layerWindSpeed, LAIc, CanHeight,
-				vmax1, Jmax, Rd, b0, b1, Catm, o2, theta, StomataWS, ws);
-        TempIdiff = Temp + tmp6_ET.Deltat;
-
-        temp_photo_results = c3photoC(IDiff, TempIdiff, rh, vmax1, Jmax, Rd, b0, b1, Catm, o2, theta, StomataWS, ws);
+        air_photo_results = leaf_start(start, leaves, nlayers + i);
+        if(coupled_leaf) {
+            temp_photo_results = c3photoC_coupled(IDiff, Itot, Temp, rh, layerWindSpeed, LAIc, CanHeight,
+				vmax1, Jmax, Rd, b0, b1, Catm, o2, theta, StomataWS, ws, air_photo_results.Ci, &tmp6_ET);
+        } else {
+            tmp6_ET = c3EvapoTrans(IDiff, Itot, Temp, rh, layerWindSpeed, LAIc, CanHeight,
+				vmax1, Jmax, Rd, b0, b1, Catm, o2, theta, StomataWS, ws, &air_photo_results);
+            count_solve(&ans, air_photo_results);
+            if(start == NULL) air_photo_results.Ci = 0;
+            TempIdiff = Temp + tmp6_ET.Deltat;
+
+            temp_photo_results = c3photoC_warm(IDiff, TempIdiff, rh, vmax1, Jmax, Rd, b0, b1, Catm, o2, theta, StomataWS, ws,
+				air_photo_results.Ci, air_photo_results.Assim);
+        }
+        count_solve(&ans, temp_photo_results);
+        if(start != NULL) {
+            start->Ci[nlayers + i] = temp_photo_results.Ci;
+            start->Assim[nlayers + i] = temp_photo_results.Assim;
+        }
         AssIdiff = temp_photo_results.Assim;
         GAssIdiff = temp_photo_results.GrossAssim;
 
@@ -150,6 +203,7 @@ struct Can_Str c3CanAC(double LAI,
     ans.Assim = cf * CanopyA;
     ans.Trans = cf2 * CanopyT; 
     ans.GrossAssim = cf * GCanopyA;
+    if(start != NULL) start->leaves = leaves;
     return(ans);
 }
 
@@ -15,6 +15,7 @@
 #include "c3photo.h"
 #include "AuxBioCro.h"
 #include "c3EvapoTrans.h"
+#include "solver_stats.h"
 
 /* EvapoTrans function */
 struct ET_Str c3EvapoTrans(double Rad, 
@@ -33,7 +34,8 @@ struct ET_Str c3EvapoTrans(double Rad,
         double O2,
         double theta2,
         double StomWS,
-        int ws)
+        int ws,
+        struct c3_str *photo)
 
 {
     /* creating the structure to return */
@@ -97,7 +99,13 @@ struct ET_Str c3EvapoTrans(double Rad,
     /* Convert light assuming 1 micromole PAR photons = 0.235 J/s */
     totalradiation = Itot * 0.235;
 
-    photo_results = c3photoC(Rad,Airtemperature,RH,vcmax2,jmax2,Rd2,b02,b12,Catm2,O2,theta2,StomWS,ws); 
+    /* photo, when given, holds an earlier solve to start from and gets this one */
+    if(photo == NULL) {
+        photo_results = c3photoC(Rad,Airtemperature,RH,vcmax2,jmax2,Rd2,b02,b12,Catm2,O2,theta2,StomWS,ws); 
+    } else {
+        photo_results = c3photoC_warm(Rad,Airtemperature,RH,vcmax2,jmax2,Rd2,b02,b12,Catm2,O2,theta2,StomWS,ws,photo->Ci,photo->Assim);
+        *photo = photo_results;
+    }
     LayerConductance = photo_results.Gs;
 
     /* Convert mmoles/m2/s to moles/m2/s
@@ -194,6 +202,8 @@ constant: 5.67 * 1e-8 W m^-2 K^-4. */
             ChangeInLeafTemp = -ChangeInLeafTemp;
         Counter++;
     }
+    SOLVER_STATS(solver_stats_record(SOLVER_C3EVAPOTRANS, Counter, ChangeInLeafTemp <= 0.5, ChangeInLeafTemp,
+                                     (double[]){Rad, Itot, Airtemperature, RH, WindSpeed, photo_results.Gs}));
 
 
     if(PhiN < 0)
@@ -34,6 +34,7 @@ struct ET_Str c3EvapoTrans(double Rad,
 			   double O2,
 			   double theta2,
 			   double StomWS,
-			   int ws);
+			   int ws,
+			   struct c3_str *photo);
 #endif
 
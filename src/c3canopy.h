@@ -48,6 +48,7 @@ struct canopyoutput
 struct canopy
 {
   int Nlayers;
+  int MaxLayers; /* layers the vectors below have room for */
   double Idirtop, Idifftop, CosZenithAngle;
   double LAItotal;
   struct canopyEnv *ENV;
@@ -57,9 +58,15 @@ struct canopy
 
 void createCanopy (struct canopy *canopy, int Nlayers, double LAItotal);
 
+void allocateCanopy (struct canopy *canopy, int MaxLayers);
+
+void resetCanopy (struct canopy *canopy, int Nlayers, double LAItotal);
+
 void discretizeCanopy(struct canopy *canopy);
 
-void getcanopylightme(struct canopy * canopy, double lat, double DOY, int td, double solarR);
+struct solar_table;
+
+void getcanopylightme(struct canopy * canopy, const struct solar_table *solar, double lat, double DOY, int td, double solarR);
 
 void getCanopysunML(struct canopy *canopy,double kd, double chil, double heightf);
 
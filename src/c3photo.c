@@ -5,10 +5,21 @@
 
 #include <math.h>
 #include "c3photo.h"
+#include "solver_stats.h"
 
 /* c3photo function */ 
 struct c3_str c3photoC(double Qp, double Tleaf, double RH, double Vcmax0, double Jmax, 
 		       double Rd0, double bb0, double bb1, double Ca, double O2, double thet,double StomWS,int ws)
+{
+	return(c3photoC_warm(Qp, Tleaf, RH, Vcmax0, Jmax, Rd0, bb0, bb1, Ca, O2, thet, StomWS, ws, 0.0, 0.0));
+}
+
+/* c3photoC with the iteration started from the intercellular CO2 (Pa) and
+ * the assimilation of an earlier solve of the same leaf. A StartCi that is
+ * not positive starts from Ci = 0, which is what c3photoC does. */
+struct c3_str c3photoC_warm(double Qp, double Tleaf, double RH, double Vcmax0, double Jmax, 
+		       double Rd0, double bb0, double bb1, double Ca, double O2, double thet,double StomWS,int ws,
+		       double StartCi, double StartAssim)
 {
 	struct c3_str tmp = {0,0,0,0};
 	/* Constants */
@@ -43,6 +54,11 @@ struct c3_str c3photoC(double Qp, double Tleaf, double RH, double Vcmax0, double
 	if(Ca <= 0)
 		Ca = 1e-4;
 
+	if(StartCi > 0){
+		Ci = StartCi;
+		OldAssim = StartAssim;
+	}
+
     double Ca_pa = Ca / 1e6 * AP;  // Pa.
 
 	/* From Bernacchi 2001. Improved temperature response functions. */
@@ -155,6 +171,9 @@ struct c3_str c3photoC(double Qp, double Tleaf, double RH, double Vcmax0, double
 	tmp.Gs = Gs;
 	tmp.Ci = Ci;
   tmp.GrossAssim=Assim+Rd;
+	tmp.iterations = iterCounter < 50 ? iterCounter + 1 : 50;
+	SOLVER_STATS(solver_stats_record(SOLVER_C3PHOTO, tmp.iterations, iterCounter < 50, diff,
+					 (double[]){Qp, Tleaf, RH, StomWS, Vcmax0, Ca}));
   if(Assim>0){
 //  Rprintf(" in C3photoSynthesis Function : Net Leaf Photosynthesis is %f, Dark Respiration is %f, Gross Assimilation is %f \n", tmp.Assim, Rd, tmp.GrossAssim);
   }
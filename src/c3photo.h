@@ -11,6 +11,7 @@ struct c3_str {
   double Gs;
   double Ci;
   double GrossAssim;
+  int iterations; /* passes of the Ci iteration */
 
 };
 
@@ -20,6 +21,10 @@ extern double ballBerry(double Amu, double Cappm, double Temp, double RelH, doub
 extern struct c3_str c3photoC(double Qp, double Tleaf, double RH, double Vcmax0, double Jmax0, 
 			      double Rd0, double bb0, double bb1, double Ca, double O2, double theta, double StomWS,int ws);
 
+extern struct c3_str c3photoC_warm(double Qp, double Tleaf, double RH, double Vcmax0, double Jmax0, 
+			      double Rd0, double bb0, double bb1, double Ca, double O2, double theta, double StomWS,int ws,
+			      double StartCi, double StartAssim);
+
 double solc(double LeafT);
 double solo(double LeafT);
 
@@ -13,7 +13,9 @@
  */
 
 #include <math.h>
+#include <stddef.h>
 #include "c4photo.h"
+#include "solver_stats.h"
 
 /* Ball Berry stomatal conductance function */
 double ballBerry(double Amu, double Cappm, double Temp, double RelH, double beta0, double beta1)
@@ -86,6 +88,47 @@ double ballBerry(double Amu, double Cappm, double Temp, double RelH, double beta
 }
 
 
+/* ballBerry and its derivative with respect to Amu, with the CO2 at the
+ * surface as a mole fraction. wa/wi in ballBerry is RelH up to rounding, so
+ * the conductance only depends on the temperature through Amu. */
+double ballBerry_d(double Amu, double Camf, double RelH, double beta0, double beta1, double *dAmu)
+{
+	const double gbw = 1.2;
+	double assimn = Amu * 1e-6;
+	double Cs, acs, dacs, aaa, bbb, ccc, hs, dhs, gsmol;
+
+	*dAmu = 0;
+	if(assimn < 0.0){
+		gsmol = beta0 * 1000;
+	}else{
+		Cs = Camf - (1.4/gbw) * assimn;
+		dacs = Camf / (Cs * Cs);
+		if(Cs < 0.0){
+			Cs = 1;
+			dacs = 1;
+		}
+		acs = assimn / Cs;
+		if(acs < 1e-6){
+			acs = 1e-6;
+			dacs = 0;
+		}
+		aaa = beta1 * acs;
+		bbb = beta0 + gbw - (beta1 * acs);
+		ccc = -RelH * gbw - beta0;
+		hs = (-bbb + sqrt(bbb * bbb - 4*aaa*ccc)) / (2 * aaa);
+		/* From the quadratic aaa*hs^2 + bbb*hs + ccc = 0 */
+		dhs = -beta1 * hs * (hs - 1) / (2 * aaa * hs + bbb);
+		gsmol = (beta1 * hs * acs + beta0) * 1000;
+		*dAmu = beta1 * (hs + acs * dhs) * dacs * 1e-6 * 1000;
+	}
+	if(gsmol <= 0){
+		gsmol = 1e-5;
+		*dAmu = 0;
+	}
+	return(gsmol);
+}
+
+
 double fnpsvp(double Tkelvin){
 	/* water boiling point = 373.16 oK*/
 /* This is the Arden Buck Equation 
@@ -109,6 +152,19 @@ struct c4_str c4photoC(double Qp, double Tl, double RH, double vmax, double alph
 		       double kparm, double theta, double beta,
 		       double Rd, double bb0, double bb1, double StomaWS, double Ca, int ws,double upperT,double lowerT)
 {
+	return(c4photoC_warm(Qp, Tl, RH, vmax, alpha, kparm, theta, beta, Rd, bb0, bb1, StomaWS, Ca, ws, upperT, lowerT, 0.0, 0.0));
+}
+
+/* c4photoC with the iteration started from the intercellular CO2 (ppm) and
+ * the assimilation of an earlier solve, typically of the same leaf at a
+ * nearby temperature or hour. When these are close to the solution the
+ * first pass already converges. A StartCi that is not positive starts
+ * from the usual guess, which is what c4photoC does. */
+struct c4_str c4photoC_warm(double Qp, double Tl, double RH, double vmax, double alpha, 
+		       double kparm, double theta, double beta,
+		       double Rd, double bb0, double bb1, double StomaWS, double Ca, int ws,double upperT,double lowerT,
+		       double StartCi, double StartAssim)
+{
 
 	struct c4_str tmp;
 	/* Constants */
@@ -143,7 +199,12 @@ struct c4_str c4photoC(double Qp, double Tl, double RH, double vmax, double alph
 
 	Csurface = (Ca * 1e-6) * AP ;
   
-	InterCellularCO2 = Csurface * 0.4; /* Initial guestimate */
+	if(StartCi > 0){
+		InterCellularCO2 = (StartCi * 1e-6) * AP;
+		OldAssim = StartAssim;
+	}else{
+		InterCellularCO2 = Csurface * 0.4; /* Initial guestimate */
+	}
 
 	KQ10 =  pow(Q10,((Tl - 25.0) / 10.0));
 
@@ -261,6 +322,384 @@ struct c4_str c4photoC(double Qp, double Tl, double RH, double vmax, double alph
 	tmp.Gs = Gs;
 	tmp.Ci = miC;
   tmp.GrossAssim=GrossAssim;
+	tmp.iterations = iterCounter < 50 ? iterCounter + 1 : 50;
+	SOLVER_STATS(solver_stats_record(SOLVER_C4PHOTO, tmp.iterations, iterCounter < 50, diff,
+					 (double[]){Qp, Tl, RH, StomaWS, vmax, Ca}));
+	return(tmp);
+}
+
+/* c4photoC for n leaves at once. The leaf inputs are arrays with one
+ * element per leaf and the remaining parameters are shared. Each leaf goes
+ * through the same operations as in c4photoC, so the results are the same,
+ * but the temperature terms and the vapor pressures that ballBerry needs
+ * are computed once per leaf instead of once per iteration, and the
+ * iteration runs over all leaves that have not converged yet. When
+ * start_Ci and start_Assim are not NULL each leaf starts from them as in
+ * c4photoC_warm. */
+void c4photoC_batch(int n, const double Qp[], const double Tl[], const double RH[],
+		    const double vmax[], const double alpha[], const double Rd[],
+		    double kparm, double theta, double beta, double bb0, double bb1,
+		    double StomaWS, double Ca, int ws, double upperT, double lowerT,
+		    const double start_Ci[], const double start_Assim[],
+		    struct c4_str results[])
+{
+	const double AP = 101325;
+	const double P = AP / 1e3;
+	const double gbw = 1.2;
+	const double Tol = 0.1;
+
+	double Csurface = (Ca * 1e-6) * AP ;
+	double csurfaceppm = Csurface * 10 ;
+	double Camf = csurfaceppm * 1e-6;
+
+	double kT[n], RT[n], M[n];
+	double wa[n], wi[n];
+	double InterCellularCO2[n], Assim[n], Gs[n], OldAssim[n];
+	int active[n], iterations[n];
+	int i, iterCounter, remaining;
+	SOLVER_STATS(double change[n]);
+
+	for(i = 0; i < n; i++){
+		double KQ10, Vtn, Vtd, VT, Rtn, Rtd;
+		double b0, b1, M1, M2, pwi;
+
+		KQ10 = pow(2, (Tl[i] - 25.0) / 10.0);
+		kT[i] = kparm * KQ10;
+
+		Vtn = vmax[i] * KQ10;
+		Vtd = ( 1 + exp(0.3 * (lowerT-Tl[i])) ) * (1 + exp( 0.3*(Tl[i]-upperT) ));
+		VT  = Vtn / Vtd;
+
+		Rtn = Rd[i] * KQ10;
+		Rtd =  1 + exp( 1.3 * (Tl[i]-55) ) ;
+		RT[i] = Rtn / Rtd ;
+
+		b0 = VT * alpha[i] * Qp[i] ;
+		b1 = VT + alpha[i] * Qp[i] ;
+		M1 = (b1 + sqrt(b1*b1 - (4 * b0 * theta)))/(2*theta) ;
+		M2 = (b1 - sqrt(b1*b1 - (4 * b0 * theta)))/(2*theta) ;
+		M[i] = M1 < M2 ? M1 : M2;
+
+		/* The parts of ballBerry that do not change between iterations */
+		pwi = fnpsvp(Tl[i] + 273.15);
+		wa[i] = (RH[i] * pwi) / AP;
+		wi[i] = pwi / AP;
+
+		if(start_Ci != NULL && start_Ci[i] > 0){
+			InterCellularCO2[i] = (start_Ci[i] * 1e-6) * AP;
+			OldAssim[i] = start_Assim[i];
+		}else{
+			InterCellularCO2[i] = Csurface * 0.4;
+			OldAssim[i] = 0.0;
+		}
+		active[i] = 1;
+		iterations[i] = 50;
+	}
+
+	remaining = n;
+	for(iterCounter = 0; iterCounter < 50 && remaining > 0; iterCounter++){
+		for(i = 0; i < n; i++){
+			double kT_IC_P, Quada, Quadb, a2, assimn, gswmol, gsmol, diff;
+
+			if(!active[i]) continue;
+
+			kT_IC_P = kT[i] * (InterCellularCO2[i] / P*1000);
+			Quada = M[i] * kT_IC_P;
+			Quadb = M[i] + kT_IC_P;
+			a2 = (Quadb - sqrt(Quadb*Quadb - (4 * Quada * beta))) / (2 * beta);
+
+			Assim[i] = a2 - RT[i];
+			if(ws == 0) Assim[i] *= StomaWS;
+
+			/* ballBerry */
+			assimn = Assim[i] * 1e-6;
+			if(assimn < 0.0){
+				gswmol = bb0;
+			}else{
+				double Cs, acs, aaa, bbb, ccc, hs;
+				Cs  = Camf - (1.4/gbw)*assimn;
+				if(Cs < 0.0)
+					Cs = 1;
+				acs = assimn/Cs;
+				if(acs < 1e-6) acs = 1e-6;
+				aaa = bb1 * acs;
+				bbb = bb0 + gbw - (bb1 * acs);
+				ccc = -(wa[i] / wi[i]) * gbw - bb0;
+				hs  = (-bbb + sqrt(bbb * bbb - 4*aaa*ccc)) / (2* aaa);
+				gswmol = bb1 * hs * acs + bb0;
+			}
+			gsmol = gswmol * 1000;
+			if(gsmol <= 0) gsmol = 1e-5;
+
+			Gs[i] = gsmol;
+			if(ws == 1) Gs[i] *= StomaWS;
+
+			InterCellularCO2[i] = Csurface - (Assim[i] * 1e-6 * 1.6 * AP) / (Gs[i] * 0.001);
+			if(InterCellularCO2[i] < 0)
+				InterCellularCO2[i] = 1e-5;
+
+			diff = OldAssim[i] - Assim[i];
+			if(diff < 0) diff = -diff;
+			SOLVER_STATS(change[i] = diff);
+			if(diff < Tol){
+				active[i] = 0;
+				iterations[i] = iterCounter + 1;
+				remaining--;
+			}else{
+				OldAssim[i] = Assim[i];
+			}
+		}
+	}
+
+	for(i = 0; i < n; i++){
+		results[i].Assim = Assim[i];
+		results[i].Gs = Gs[i] > 600 ? 600 : Gs[i];
+		results[i].Ci = (InterCellularCO2[i] / AP) * 1e6;
+		results[i].GrossAssim = Assim[i] + RT[i];
+		results[i].iterations = iterations[i];
+		SOLVER_STATS(solver_stats_record(SOLVER_C4PHOTO, iterations[i], !active[i], change[i],
+						 (double[]){Qp[i], Tl[i], RH[i], StomaWS, vmax[i], Ca}));
+	}
+}
+
+#define C4_BRACKET_MAX_EVALUATIONS 100
+
+/* The parts of c4photoC that do not depend on the assimilation, for
+ * c4photoC_bracketed */
+struct c4_bracket {
+	double Csurface, Camf, kT, RT, M, beta;
+	double RelH, bb0, bb1, StomaWS, scale;
+	int ws;
+};
+
+/* The assimilation that the Ci of assimilation A gives, less A, and its
+ * derivative. The solution of c4photoC is where this is 0. Ci (Pa) and the
+ * conductance are those of the iteration of c4photoC. */
+static double c4_bracket_residual(const struct c4_bracket *p, double A, double *dA,
+		double *ci, double *Gs)
+{
+	const double AP = 101325;
+	const double P = AP / 1e3;
+	const double K = 1e-6 * 1.6 * AP / 0.001;
+	double gs, dgs, inv_gs, dci, kT_IC_P, Quada, Quadb, root, a2, da2;
+
+	gs = ballBerry_d(A, p->Camf, p->RelH, p->bb0, p->bb1, &dgs);
+	if(p->ws == 1){
+		gs *= p->StomaWS;
+		dgs *= p->StomaWS;
+	}
+
+	inv_gs = 1 / gs;
+	*ci = p->Csurface - K * A * inv_gs;
+	dci = -K * (1 - A * dgs * inv_gs) * inv_gs;
+	if(*ci < 0){
+		*ci = 1e-5;
+		dci = 0;
+	}
+	*Gs = gs;
+
+	kT_IC_P = p->kT * (*ci / P*1000);
+	Quada = p->M * kT_IC_P;
+	Quadb = p->M + kT_IC_P;
+	root = sqrt(Quadb*Quadb - (4 * Quada * p->beta));
+	a2 = (Quadb - root) / (2 * p->beta);
+	/* From the quadratic beta*a2^2 - Quadb*a2 + Quada = 0 */
+	da2 = root > 0 ? (p->M - a2) / root * p->kT * 1000 / P * dci : 0;
+
+	*dA = p->scale * da2 - 1;
+	return(p->scale * (a2 - p->RT) - A);
+}
+
+/* c4photoC solved as one equation in the assimilation instead of by
+ * iterating on Ci. For 0 < beta <= 1, a2 lies between 0 and M, so the
+ * solution lies between -RT and M - RT (times StomaWS when ws is 0), where
+ * the residual changes sign. Newton's method from the first pass of
+ * c4photoC, with bisection when a step leaves the bracket, finds it to
+ * 1e-8 of a micromole. The iterations are the residuals evaluated, which
+ * for ordinary leaves are 1 to 4 and never more than
+ * C4_BRACKET_MAX_EVALUATIONS. The result is that of c4photoC at its fixed
+ * point, which c4photoC stops within 0.1 of or, when it cycles, does not
+ * reach. Parameters outside the assumptions of the bracket fall back to
+ * c4photoC. */
+struct c4_str c4photoC_bracketed(double Qp, double Tl, double RH, double vmax, double alpha,
+		       double kparm, double theta, double beta,
+		       double Rd, double bb0, double bb1, double StomaWS, double Ca, int ws,double upperT,double lowerT)
+{
+	struct c4_str tmp;
+	c4photoC_bracketed_batch(1, &Qp, &Tl, &RH, &vmax, &alpha, &Rd, kparm, theta, beta, bb0, bb1,
+				 StomaWS, Ca, ws, upperT, lowerT, &tmp);
+	return(tmp);
+}
+
+/* c4photoC_bracketed for n leaves at once, with the arrays of
+ * c4photoC_batch. The Newton passes run over all leaves that have not
+ * converged yet, so that the solves of different leaves overlap. */
+void c4photoC_bracketed_batch(int n, const double Qp[], const double Tl[], const double RH[],
+			      const double vmax[], const double alpha[], const double Rd[],
+			      double kparm, double theta, double beta, double bb0, double bb1,
+			      double StomaWS, double Ca, int ws, double upperT, double lowerT,
+			      struct c4_str results[])
+{
+	const double AP = 101325;
+	const double P = AP / 1e3;
+	const double Tol = 1e-8;
+	const double scale = ws == 0 ? StomaWS : 1;
+	const double Csurface = (Ca * 1e-6) * AP;
+
+	struct c4_bracket p[n];
+	double lo[n], hi[n], A[n], ci[n], Gs[n];
+	int active[n], evaluations[n];
+	int i, pass, remaining = 0;
+	SOLVER_STATS(double change[n]);
+	SOLVER_STATS(int converged[n]);
+
+	for(i = 0; i < n; i++){
+		double KQ10, Vtn, Vtd, VT, Rtn, Rtd;
+		double b0, b1, M1, M2;
+		double kT_IC_P, Quada, Quadb;
+
+		KQ10 = pow(2, (Tl[i] - 25.0) / 10.0);
+		p[i].kT = kparm * KQ10;
+
+		Vtn = vmax[i] * KQ10;
+		Vtd = ( 1 + exp(0.3 * (lowerT-Tl[i])) ) * (1 + exp( 0.3*(Tl[i]-upperT) ));
+		VT  = Vtn / Vtd;
+
+		Rtn = Rd[i] * KQ10;
+		Rtd =  1 + exp( 1.3 * (Tl[i]-55) ) ;
+		p[i].RT = Rtn / Rtd ;
+
+		b0 = VT * alpha[i] * Qp[i] ;
+		b1 = VT + alpha[i] * Qp[i] ;
+		M1 = (b1 + sqrt(b1*b1 - (4 * b0 * theta)))/(2*theta) ;
+		M2 = (b1 - sqrt(b1*b1 - (4 * b0 * theta)))/(2*theta) ;
+		p[i].M = M1 < M2 ? M1 : M2;
+
+		p[i].RelH = RH[i];
+		p[i].Csurface = Csurface;
+		p[i].Camf = Csurface * 10 * 1e-6;
+		p[i].beta = beta;
+		p[i].bb0 = bb0;
+		p[i].bb1 = bb1;
+		p[i].StomaWS = StomaWS;
+		p[i].ws = ws;
+		p[i].scale = scale;
+
+		active[i] = 0;
+		evaluations[i] = 0;
+		if(!(beta > 0 && beta <= 1 && p[i].M >= 0 && isfinite(p[i].M) && p[i].kT >= 0 && isfinite(p[i].kT) &&
+		     isfinite(p[i].RT) && scale >= 0 && isfinite(scale) && Csurface >= 0 && isfinite(Csurface))){
+			results[i] = c4photoC(Qp[i], Tl[i], RH[i], vmax[i], alpha[i], kparm, theta, beta, Rd[i],
+					      bb0, bb1, StomaWS, Ca, ws, upperT, lowerT);
+			continue;
+		}
+
+		lo[i] = -scale * p[i].RT;
+		hi[i] = scale * (p[i].M - p[i].RT);
+
+		/* The first pass of c4photoC */
+		kT_IC_P = p[i].kT * (Csurface * 0.4 / P*1000);
+		Quada = p[i].M * kT_IC_P;
+		Quadb = p[i].M + kT_IC_P;
+		A[i] = scale * ((Quadb - sqrt(Quadb*Quadb - (4 * Quada * beta))) / (2 * beta) - p[i].RT);
+		if(!(A[i] >= lo[i] && A[i] <= hi[i]))
+			A[i] = 0.5 * (lo[i] + hi[i]);
+
+		active[i] = 1;
+		remaining++;
+	}
+
+	for(pass = 0; pass < C4_BRACKET_MAX_EVALUATIONS && remaining > 0; pass++){
+		for(i = 0; i < n; i++){
+			double g, dg, step;
+
+			if(!active[i]) continue;
+
+			g = c4_bracket_residual(&p[i], A[i], &dg, &ci[i], &Gs[i]);
+			evaluations[i]++;
+			if(g > 0)
+				lo[i] = A[i];
+			else
+				hi[i] = A[i];
+
+			step = -g / dg;
+			if(!(dg < 0) || !(A[i] + step > lo[i] && A[i] + step < hi[i]))
+				step = 0.5 * (lo[i] + hi[i]) - A[i];
+			if(g == 0 || fabs(step) < Tol || evaluations[i] == C4_BRACKET_MAX_EVALUATIONS){
+				SOLVER_STATS(change[i] = step);
+				SOLVER_STATS(converged[i] = g == 0 || fabs(step) < Tol);
+				active[i] = 0;
+				remaining--;
+			}else{
+				A[i] += step;
+			}
+		}
+	}
+
+	for(i = 0; i < n; i++){
+		if(evaluations[i] == 0) continue;
+		results[i].Assim = A[i];
+		results[i].Gs = Gs[i] > 600 ? 600 : Gs[i];
+		results[i].Ci = (ci[i] / AP) * 1e6;
+		results[i].GrossAssim = A[i] + p[i].RT;
+		results[i].iterations = evaluations[i];
+		SOLVER_STATS(solver_stats_record(SOLVER_C4PHOTO_BRACKETED, evaluations[i], converged[i], change[i],
+						 (double[]){Qp[i], Tl[i], RH[i], StomaWS, vmax[i], Ca}));
+	}
+}
+
+/* c4photoC at Qp = 0. Without light the smaller root M of the first
+ * quadratic is 0, so a2 is 0 for any intercellular CO2 and Assim is the dark
+ * respiration -RT. When that is negative ballBerry returns its minimum
+ * conductance and the iteration ends on its second pass with the values of
+ * the first, so neither needs to be iterated. Anything the closed form does
+ * not cover falls back to c4photoC, so the result is that of
+ * c4photoC(0, ...) short of parameters so extreme that the squares in
+ * c4photoC over- or underflow. */
+struct c4_str c4photoC_dark(double Tl, double RH, double vmax, double alpha,
+		       double kparm, double theta, double beta,
+		       double Rd, double bb0, double bb1, double StomaWS, double Ca, int ws,double upperT,double lowerT)
+{
+	struct c4_str tmp;
+	const double AP = 101325;
+	double Csurface, InterCellularCO2;
+	double Rtn, Rtd, RT;
+	double Assim, Gs;
+
+	/* The roots are real and M is the one at 0, and kT_IC_P is not negative */
+	if(!(theta > 0 && beta != 0 && isfinite(alpha) &&
+	     vmax >= 0 && isfinite(vmax) && kparm >= 0 && isfinite(kparm) &&
+	     Ca >= 0 && isfinite(Ca)))
+		return(c4photoC(0.0, Tl, RH, vmax, alpha, kparm, theta, beta, Rd, bb0, bb1, StomaWS, Ca, ws, upperT, lowerT));
+
+	Rtn = Rd * pow(2 , (Tl-25)/10 ) ;
+	Rtd =  1 + exp( 1.3 * (Tl-55) ) ;
+	RT = Rtn / Rtd ;
+
+	Assim = -RT;
+	if(ws == 0) Assim *= StomaWS;
+
+	Gs = bb0 * 1000;
+	if(Gs <= 0) Gs = 1e-5;
+	if(ws == 1) Gs *= StomaWS;
+
+	Csurface = (Ca * 1e-6) * AP ;
+	InterCellularCO2 = Csurface - (Assim * 1e-6 * 1.6 * AP) / (Gs * 0.001);
+	if(InterCellularCO2 < 0)
+		InterCellularCO2 = 1e-5;
+
+	/* Otherwise ballBerry solves for the leaf surface humidity, or the
+	 * second pass has no finite intercellular CO2 to start from */
+	if(!(Assim * 1e-6 < 0.0) || !isfinite(InterCellularCO2))
+		return(c4photoC(0.0, Tl, RH, vmax, alpha, kparm, theta, beta, Rd, bb0, bb1, StomaWS, Ca, ws, upperT, lowerT));
+
+	if(Gs > 600)
+	  Gs = 600;
+	tmp.Assim = Assim;
+	tmp.Gs = Gs;
+	tmp.Ci = (InterCellularCO2 / AP) * 1e6;
+	tmp.GrossAssim = Assim + RT;
+	tmp.iterations = 0;
 	return(tmp);
 }
 
@@ -10,13 +10,77 @@ struct c4_str {
     double Gs;
     double Ci;
     double GrossAssim;
+    int iterations; /* passes of the Ci iteration, 0 if none was needed */
 };
 
 /* Function needed for ballBerry */
 extern double fnpsvp(double Tkelvin);
 extern double ballBerry(double Amu, double Cappm, double Temp, double RelH, double beta0, double beta1);
+extern double ballBerry_d(double Amu, double Camf, double RelH, double beta0, double beta1, double *dAmu);
 extern struct c4_str c4photoC(double Qp, double Tl, double RH, double vmax, double alpha, 
         double kparm, double theta, double beta, double Rd, double bb0, double bb1, double StomaWS, double Ca, int ws,double upperT,double lowerT);
+extern struct c4_str c4photoC_warm(double Qp, double Tl, double RH, double vmax, double alpha, 
+        double kparm, double theta, double beta, double Rd, double bb0, double bb1, double StomaWS, double Ca, int ws,double upperT,double lowerT,
+        double StartCi, double StartAssim);
+extern struct c4_str c4photoC_bracketed(double Qp, double Tl, double RH, double vmax, double alpha, 
+        double kparm, double theta, double beta, double Rd, double bb0, double bb1, double StomaWS, double Ca, int ws,double upperT,double lowerT);
+extern void c4photoC_bracketed_batch(int n, const double Qp[], const double Tl[], const double RH[],
+        const double vmax[], const double alpha[], const double Rd[],
+        double kparm, double theta, double beta, double bb0, double bb1,
+        double StomaWS, double Ca, int ws, double upperT, double lowerT,
+        struct c4_str results[]);
+extern void c4photoC_batch(int n, const double Qp[], const double Tl[], const double RH[],
+        const double vmax[], const double alpha[], const double Rd[],
+        double kparm, double theta, double beta, double bb0, double bb1,
+        double StomaWS, double Ca, int ws, double upperT, double lowerT,
+        const double start_Ci[], const double start_Assim[],
+        struct c4_str results[]);
+extern struct c4_str c4photoC_dark(double Tl, double RH, double vmax, double alpha,
+        double kparm, double theta, double beta, double Rd, double bb0, double bb1, double StomaWS, double Ca, int ws,double upperT,double lowerT);
+
+/* c4photoC_bracketed tabulated for one set of parameters, see
+ * c4photo_surface.c. Light is on nodes spaced quadratically from 0 to
+ * C4_SURFACE_QP_MAX, leaf temperature every C4_SURFACE_TL_STEP from
+ * C4_SURFACE_TL_MIN, and relative humidity and StomaWS evenly from 0 to
+ * 1. */
+#define C4_SURFACE_QP 32
+#define C4_SURFACE_QP_MAX 3000.0
+#define C4_SURFACE_TL 25
+#define C4_SURFACE_TL_MIN -10.0
+#define C4_SURFACE_TL_STEP 2.5
+#define C4_SURFACE_RH 11
+#define C4_SURFACE_WS 21
+
+/* Single precision is well within the error of the interpolation */
+struct c4_surface_node {
+    float Assim;
+    float Gs;
+    float Ci;
+    float GrossAssim;
+};
+
+struct c4_surface {
+    int built;
+    double vmax, alpha, kparm, theta, beta, Rd, bb0, bb1, Ca, upperT, lowerT;
+    int ws;
+    double builds;      /* times the parameters changed and the table was started again */
+    double solves;      /* c4photoC_bracketed solves spent filling the table */
+    double lookups;     /* leaves read from the table */
+    double fallbacks;   /* leaves solved because the table did not cover them */
+    double error_Assim; /* largest error of Assim at the cell centres filled */
+    double error_Gs;    /* and of Gs, against c4photoC_bracketed */
+    char slice_filled[C4_SURFACE_RH * C4_SURFACE_WS];
+    char block_filled[(C4_SURFACE_RH - 1) * (C4_SURFACE_WS - 1)];
+    struct c4_surface_node node[C4_SURFACE_QP * C4_SURFACE_TL * C4_SURFACE_RH * C4_SURFACE_WS];
+};
+
+extern struct c4_surface *c4_surface_alloc(void);
+extern void c4_surface_free(struct c4_surface *surface);
+extern void c4photoC_surface_batch(struct c4_surface *surface, int n, const double Qp[], const double Tl[],
+        const double RH[], const double vmax[], const double alpha[], const double Rd[],
+        double kparm, double theta, double beta, double bb0, double bb1,
+        double StomaWS, double Ca, int ws, double upperT, double lowerT,
+        struct c4_str results[]);
 
 /* Declaring the RSS_C4photo */
 extern double RSS_C4photo(double oAssim[], double oQp[], double oTemp[], 
@@ -0,0 +1,288 @@
+/*
+ *  BioCro/src/c4photo_surface.c
+ *
+ *  c4photoC_bracketed tabulated over light, leaf temperature, relative
+ *  humidity and water stress for one set of parameters, and interpolated.
+ *  A canopy solves the same parameters for every leaf of every step, so
+ *  once the table is filled a leaf costs a lookup instead of a solve.
+ *
+ *  The table is filled one block of humidity and stress at a time, when a
+ *  leaf first falls in it, so a run only pays for the weather it has.
+ *
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "c4photo.h"
+
+/* Parameters that differ from those of the table by more than this, relative
+ * to their size, make the table be started again. */
+#define C4_SURFACE_TOLERANCE 1e-3
+
+#define C4_SURFACE_SLICE (C4_SURFACE_QP * C4_SURFACE_TL)
+
+struct c4_surface *c4_surface_alloc(void)
+{
+	struct c4_surface *surface = (struct c4_surface*)calloc(1, sizeof(struct c4_surface));
+	return surface;
+}
+
+void c4_surface_free(struct c4_surface *surface)
+{
+	free(surface);
+}
+
+/* Nodes i = 0..n-1 at max * (i / (n - 1))^2, closer together at the
+ * low end where the responses bend the most. */
+static double square_node(int i, int n, double max)
+{
+	double u = (double)i / (n - 1);
+	return max * u * u;
+}
+
+static double node_Qp(int q)
+{
+	return square_node(q, C4_SURFACE_QP, C4_SURFACE_QP_MAX);
+}
+
+static double node_Tl(int t)
+{
+	return C4_SURFACE_TL_MIN + t * C4_SURFACE_TL_STEP;
+}
+
+static double node_RH(int r)
+{
+	return (double)r / (C4_SURFACE_RH - 1);
+}
+
+static double node_WS(int w)
+{
+	return (double)w / (C4_SURFACE_WS - 1);
+}
+
+static int node_index(int q, int t, int r, int w)
+{
+	return (w * C4_SURFACE_RH + r) * C4_SURFACE_SLICE + t * C4_SURFACE_QP + q;
+}
+
+static int same_parameter(double a, double b)
+{
+	return fabs(a - b) <= C4_SURFACE_TOLERANCE * fabs(b) || a == b;
+}
+
+static int surface_matches(const struct c4_surface *s, double vmax, double alpha,
+			   double kparm, double theta, double beta, double Rd, double bb0, double bb1,
+			   double Ca, int ws, double upperT, double lowerT)
+{
+	return s->built && s->ws == ws &&
+		same_parameter(vmax, s->vmax) && same_parameter(alpha, s->alpha) &&
+		same_parameter(kparm, s->kparm) && same_parameter(theta, s->theta) &&
+		same_parameter(beta, s->beta) && same_parameter(Rd, s->Rd) &&
+		same_parameter(bb0, s->bb0) && same_parameter(bb1, s->bb1) &&
+		same_parameter(Ca, s->Ca) && same_parameter(upperT, s->upperT) &&
+		same_parameter(lowerT, s->lowerT);
+}
+
+/* The cell that holds x on nodes x0 + i * step, i = 0..n-1, and the
+ * position in it. Returns 0 when x is outside the nodes. */
+static int locate(double x, double x0, double step, int n, int *cell, double *f)
+{
+	double u = (x - x0) / step;
+	int i;
+	if(!(u >= 0 && u <= n - 1)) return 0;
+	i = (int)u;
+	if(i > n - 2) i = n - 2;
+	*cell = i;
+	*f = u - i;
+	return 1;
+}
+
+/* The same for nodes at square_node(i, n, max) */
+static int locate_square(double x, int n, double max, int *cell, double *f)
+{
+	double u, lo, hi;
+	int i;
+	if(!(x >= 0 && x <= max)) return 0;
+	u = sqrt(x / max) * (n - 1);
+	i = (int)u;
+	if(i > n - 2) i = n - 2;
+	lo = square_node(i, n, max);
+	hi = square_node(i + 1, n, max);
+	*cell = i;
+	*f = (x - lo) / (hi - lo);
+	return 1;
+}
+
+/* n solves at one humidity and stress with the parameters of the surface */
+static void solve(struct c4_surface *s, int n, const double Qp[], const double Tl[],
+		  double RH, double StomaWS, struct c4_str photo[])
+{
+	double RHv[n], vmax[n], alpha[n], Rd[n];
+	int i;
+	for(i = 0; i < n; i++){
+		RHv[i] = RH;
+		vmax[i] = s->vmax;
+		alpha[i] = s->alpha;
+		Rd[i] = s->Rd;
+	}
+	c4photoC_bracketed_batch(n, Qp, Tl, RHv, vmax, alpha, Rd, s->kparm, s->theta, s->beta,
+				 s->bb0, s->bb1, StomaWS, s->Ca, s->ws, s->upperT, s->lowerT, photo);
+	s->solves += n;
+}
+
+/* The nodes of light and temperature at humidity node r and stress node w */
+static void fill_slice(struct c4_surface *s, int r, int w)
+{
+	double Qp[C4_SURFACE_SLICE], Tl[C4_SURFACE_SLICE];
+	struct c4_str photo[C4_SURFACE_SLICE];
+	int q, t, i;
+
+	for(t = 0, i = 0; t < C4_SURFACE_TL; t++){
+		for(q = 0; q < C4_SURFACE_QP; q++, i++){
+			Qp[i] = node_Qp(q);
+			Tl[i] = node_Tl(t);
+		}
+	}
+	solve(s, C4_SURFACE_SLICE, Qp, Tl, node_RH(r), node_WS(w), photo);
+	for(i = 0; i < C4_SURFACE_SLICE; i++){
+		struct c4_surface_node *node = &s->node[node_index(0, 0, r, w) + i];
+		node->Assim = photo[i].Assim;
+		node->Gs = photo[i].Gs;
+		node->Ci = photo[i].Ci;
+		node->GrossAssim = photo[i].GrossAssim;
+	}
+	s->slice_filled[w * C4_SURFACE_RH + r] = 1;
+}
+
+/* Multilinear interpolation between the 16 nodes around a point */
+static void interpolate(const struct c4_surface *s, int q, int t, int r, int w,
+			double fq, double ft, double fr, double fw, struct c4_str *result)
+{
+	int dt, dr, dw;
+	double Assim = 0, Gs = 0, Ci = 0, GrossAssim = 0;
+
+	for(dw = 0; dw < 2; dw++){
+		double ww = dw ? fw : 1 - fw;
+		if(ww == 0) continue;
+		for(dr = 0; dr < 2; dr++){
+			double wr = ww * (dr ? fr : 1 - fr);
+			if(wr == 0) continue;
+			for(dt = 0; dt < 2; dt++){
+				double wt = wr * (dt ? ft : 1 - ft);
+				/* The two nodes along Qp are next to each other */
+				const struct c4_surface_node *node = &s->node[node_index(q, t + dt, r + dr, w + dw)];
+				double w0 = wt * (1 - fq), w1 = wt * fq;
+				Assim += w0 * node[0].Assim + w1 * node[1].Assim;
+				Gs += w0 * node[0].Gs + w1 * node[1].Gs;
+				Ci += w0 * node[0].Ci + w1 * node[1].Ci;
+				GrossAssim += w0 * node[0].GrossAssim + w1 * node[1].GrossAssim;
+			}
+		}
+	}
+	result->Assim = Assim;
+	result->Gs = Gs;
+	result->Ci = Ci;
+	result->GrossAssim = GrossAssim;
+	result->iterations = 0;
+}
+
+/* Fills the four slices around block (r, w), then solves the centre of
+ * every cell in it to measure the error of the interpolation, which for a
+ * smooth surface is largest there. */
+static void fill_block(struct c4_surface *s, int r, int w)
+{
+	const int n = (C4_SURFACE_QP - 1) * (C4_SURFACE_TL - 1);
+	double Qp[n], Tl[n];
+	struct c4_str photo[n], guess;
+	int q, t, i;
+
+	for(i = 0; i < 4; i++){
+		int ri = r + (i & 1), wi = w + (i >> 1);
+		if(!s->slice_filled[wi * C4_SURFACE_RH + ri])
+			fill_slice(s, ri, wi);
+	}
+
+	for(t = 0, i = 0; t < C4_SURFACE_TL - 1; t++){
+		for(q = 0; q < C4_SURFACE_QP - 1; q++, i++){
+			Qp[i] = 0.5 * (node_Qp(q) + node_Qp(q + 1));
+			Tl[i] = 0.5 * (node_Tl(t) + node_Tl(t + 1));
+		}
+	}
+	solve(s, n, Qp, Tl, 0.5 * (node_RH(r) + node_RH(r + 1)),
+	      0.5 * (node_WS(w) + node_WS(w + 1)), photo);
+	for(t = 0, i = 0; t < C4_SURFACE_TL - 1; t++){
+		for(q = 0; q < C4_SURFACE_QP - 1; q++, i++){
+			double fq = (Qp[i] - node_Qp(q)) / (node_Qp(q + 1) - node_Qp(q));
+			interpolate(s, q, t, r, w, fq, 0.5, 0.5, 0.5, &guess);
+			if(fabs(guess.Assim - photo[i].Assim) > s->error_Assim)
+				s->error_Assim = fabs(guess.Assim - photo[i].Assim);
+			if(fabs(guess.Gs - photo[i].Gs) > s->error_Gs)
+				s->error_Gs = fabs(guess.Gs - photo[i].Gs);
+		}
+	}
+	s->block_filled[w * (C4_SURFACE_RH - 1) + r] = 1;
+}
+
+/* Empties the table and keeps the parameters it is to be filled for */
+static void start_surface(struct c4_surface *s, double vmax, double alpha,
+			  double kparm, double theta, double beta, double Rd, double bb0, double bb1,
+			  double Ca, int ws, double upperT, double lowerT)
+{
+	s->vmax = vmax;
+	s->alpha = alpha;
+	s->kparm = kparm;
+	s->theta = theta;
+	s->beta = beta;
+	s->Rd = Rd;
+	s->bb0 = bb0;
+	s->bb1 = bb1;
+	s->Ca = Ca;
+	s->ws = ws;
+	s->upperT = upperT;
+	s->lowerT = lowerT;
+	memset(s->slice_filled, 0, sizeof(s->slice_filled));
+	memset(s->block_filled, 0, sizeof(s->block_filled));
+	s->built = 1;
+	s->builds++;
+}
+
+/* c4photoC_bracketed_batch from the surface. The surface is started again
+ * when the parameters of the first leaf differ from those it holds by
+ * more than C4_SURFACE_TOLERANCE. Leaves with other vmax, alpha or Rd,
+ * or with light, temperature, humidity or stress outside the table, are
+ * solved by c4photoC_bracketed. Results from the table have no
+ * iterations. */
+void c4photoC_surface_batch(struct c4_surface *surface, int n, const double Qp[], const double Tl[],
+			    const double RH[], const double vmax[], const double alpha[], const double Rd[],
+			    double kparm, double theta, double beta, double bb0, double bb1,
+			    double StomaWS, double Ca, int ws, double upperT, double lowerT,
+			    struct c4_str results[])
+{
+	int i, q, t, r, w;
+	double fq, ft, fr, fw;
+
+	if(n == 0) return;
+	if(!surface_matches(surface, vmax[0], alpha[0], kparm, theta, beta, Rd[0], bb0, bb1,
+			    Ca, ws, upperT, lowerT))
+		start_surface(surface, vmax[0], alpha[0], kparm, theta, beta, Rd[0], bb0, bb1,
+			      Ca, ws, upperT, lowerT);
+
+	for(i = 0; i < n; i++){
+		if(same_parameter(vmax[i], surface->vmax) && same_parameter(alpha[i], surface->alpha) &&
+		   same_parameter(Rd[i], surface->Rd) &&
+		   locate_square(Qp[i], C4_SURFACE_QP, C4_SURFACE_QP_MAX, &q, &fq) &&
+		   locate(Tl[i], C4_SURFACE_TL_MIN, C4_SURFACE_TL_STEP, C4_SURFACE_TL, &t, &ft) &&
+		   locate(RH[i], 0, node_RH(1), C4_SURFACE_RH, &r, &fr) &&
+		   locate(StomaWS, 0, node_WS(1), C4_SURFACE_WS, &w, &fw)){
+			if(!surface->block_filled[w * (C4_SURFACE_RH - 1) + r])
+				fill_block(surface, r, w);
+			interpolate(surface, q, t, r, w, fq, ft, fr, fw, &results[i]);
+			surface->lookups++;
+		}else{
+			results[i] = c4photoC_bracketed(Qp[i], Tl[i], RH[i], vmax[i], alpha[i], kparm, theta, beta,
+							Rd[i], bb0, bb1, StomaWS, Ca, ws, upperT, lowerT);
+			surface->fallbacks++;
+		}
+	}
+}
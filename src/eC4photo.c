@@ -9,6 +9,7 @@
 #include <Rinternals.h>
 #include "BioCro.h"
 #include "CanA.h"
+#include "solver_stats.h"
 
 /*%Second section for defining functions*/
 double eC4photoC(double QP, double TEMP, double RH, double CA,
@@ -78,7 +79,7 @@ SEXP eCanA(SEXP lai, SEXP Doy, SEXP Hr, SEXP SolarR, SEXP ATemp,
 	stomataws = REAL(STOMATAWS)[0];
 
 	struct Light_model light_model;
-	light_model = lightME(lat, DOY, hr);
+	light_model = solar_light(solar_table_for(lat), lat, DOY, hr);
 
 	Idir = light_model.irradiance_direct * solarR;
 	Idiff = light_model.irradiance_diffuse * solarR;
@@ -269,6 +270,9 @@ double eC4photoC(double QP, double TEMP, double RH, double CA,
     }else{
       A = Ac;
     }
+
+    SOLVER_STATS(solver_stats_record(SOLVER_EC4PHOTO, 0, 1, 0,
+                                     (double[]){QP, TEMP, RH, CA, VCMAX, VPMAX}));
         
 	/* Unused if-else statments
     Os = a * A / 0.047 * gs + Om;
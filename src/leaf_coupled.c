@@ -0,0 +1,628 @@
+/*
+ *  BioCro/src/leaf_coupled.c
+ *
+ *  Leaf temperature, stomatal conductance and assimilation solved
+ *  together.
+ *
+ *  CanAC and c3CanAC solve photosynthesis at air temperature, take the
+ *  leaf temperature its conductance gives from the energy balance
+ *  (EvapoTrans2, c3EvapoTrans, iterated until the change is below 0.5 C)
+ *  and solve photosynthesis again at that temperature. The conductance of
+ *  the final solve is not the one the leaf temperature was computed with.
+ *  Here the energy balance and the Ci balance of the photosynthesis model
+ *  are one system in the leaf to air temperature difference dt and the
+ *  intercellular CO2 Ci,
+ *
+ *    r0 = dt - DeltaT(dt, gs(A(dt, Ci)))
+ *    r1 = Ci - Ci_new(A(dt, Ci), gs(A(dt, Ci)))
+ *
+ *  solved by Newton's method with the Jacobian worked out from the model
+ *  equations. The clamps of the models are kept, and their derivatives
+ *  are 0 where they apply.
+ *
+ */
+
+#include <R.h>
+#include <math.h>
+#include "BioCro.h"
+#include "c4photo.h"
+#include "c3photo.h"
+#include "c3EvapoTrans.h"
+#include "leaf_coupled.h"
+
+#define COUPLED_MAX_ITERATIONS 20
+#define COUPLED_DT_TOL 1e-6 /* C */
+#define COUPLED_CI_TOL 1e-6 /* Pa */
+
+/* The residuals at (dt, Ci), their Jacobian and what the leaf results are
+ * made of */
+struct coupled_eval {
+	double r[2];
+	double J[2][2];
+	double assim;
+	double gross_assim;
+	double gs;      /* mmol m-2 s-1 */
+	double ci;      /* the next Ci of the photosynthesis model, Pa */
+	double ga;      /* boundary layer conductance, m s-1 */
+	double cond;    /* stomatal conductance used by the energy balance, m s-1 */
+};
+
+typedef void (*coupled_fn)(const void *leaf, double dt, double ci, struct coupled_eval *e);
+
+static double residual_norm(const struct coupled_eval *e)
+{
+	return e->r[0] * e->r[0] + e->r[1] * e->r[1];
+}
+
+/* Newton's method from (*dt, *ci). A step is halved while it does not
+ * reduce the residuals or leaves Ci not positive. Returns the number of
+ * passes, the last being the one that found the residuals within the
+ * tolerance, or 0 if the method did not converge. */
+static int coupled_newton(coupled_fn f, const void *leaf, double *dt, double *ci, struct coupled_eval *e)
+{
+	struct coupled_eval trial;
+	double d = *dt, c = *ci;
+	double det, step_d, step_c, lambda;
+	int pass, cut;
+
+	f(leaf, d, c, e);
+	for(pass = 1; pass <= COUPLED_MAX_ITERATIONS; pass++){
+		if(!isfinite(e->r[0]) || !isfinite(e->r[1]))
+			return(0);
+		if(fabs(e->r[0]) < COUPLED_DT_TOL && fabs(e->r[1]) < COUPLED_CI_TOL){
+			*dt = d;
+			*ci = c;
+			return(pass);
+		}
+
+		det = e->J[0][0] * e->J[1][1] - e->J[0][1] * e->J[1][0];
+		if(!isfinite(det) || det == 0)
+			return(0);
+		step_d = -(e->J[1][1] * e->r[0] - e->J[0][1] * e->r[1]) / det;
+		step_c = -(e->J[0][0] * e->r[1] - e->J[1][0] * e->r[0]) / det;
+
+		lambda = 1;
+		for(cut = 0; cut < 10; cut++){
+			if(c + lambda * step_c > 0){
+				f(leaf, d + lambda * step_d, c + lambda * step_c, &trial);
+				if(residual_norm(&trial) < residual_norm(e))
+					break;
+			}
+			lambda /= 2;
+		}
+		if(cut == 10)
+			return(0);
+
+		d += lambda * step_d;
+		c += lambda * step_c;
+		*e = trial;
+	}
+	return(0);
+}
+
+/* C4: c4photoC with the energy balance of EvapoTrans2 */
+
+struct c4_leaf {
+	double Qp, Tair, RH, vmax, alpha, kparm, theta, beta, Rd, bb0, bb1, StomaWS, upperT, lowerT;
+	int ws;
+	double Csurface, Camf;
+	double leafw, ea, gbv_forced, Tvair; /* for leafboundarylayer */
+	double Ja2, LHV, SlopeFS, PsycParam, DeltaPVa, rlc; /* rlc per degree of dt */
+};
+
+/* leafboundarylayer and its derivatives with respect to deltat and
+ * stomcond, with the forced convection conductance and the virtual
+ * temperature of the air, which do not depend on either, taken from leaf. */
+static double leafboundarylayer_d(const struct c4_leaf *leaf, double deltat, double stomcond,
+		double *ddeltat, double *dstomcond)
+{
+	const double Pa = 101325;
+	const double cf = 1.6361e-3;
+
+	double leaftemp = leaf->Tair + deltat;
+	double gsv = stomcond;
+	double Tlk = leaftemp + 273.15;
+	double gbv_forced = leaf->gbv_forced;
+	double esTl, desTl, eb, deb_dt, deb_dgsv, q, Tvdiff;
+	double gbv_free, a, b, dTv_dt, dTv_dgsv;
+
+	esTl = TempToSWVC(leaftemp) * 100;
+	eb = (gsv * esTl + gbv_forced * leaf->ea)/(gsv + gbv_forced);
+	q = 1 - 0.378 * eb/Pa;
+	Tvdiff = (Tlk / q) - leaf->Tvair;
+
+	gbv_free = cf * pow(Tlk,0.56) * sqrt((Tlk+120)/Pa) * sqrt(sqrt(fabs(Tvdiff)/leaf->leafw));
+
+	*ddeltat = 0;
+	*dstomcond = 0;
+	if(gbv_forced > gbv_free)
+		return(gbv_forced);
+
+	/* Slope of the Arden Buck equation in TempToSWVC */
+	a = (18.678 - leaftemp/234.5) * leaftemp;
+	b = 257.14 + leaftemp;
+	desTl = esTl * ((18.678 - 2 * leaftemp/234.5) * b - a) / (b * b);
+
+	deb_dt = gsv * desTl / (gsv + gbv_forced);
+	deb_dgsv = gbv_forced * (esTl - leaf->ea) / ((gsv + gbv_forced) * (gsv + gbv_forced));
+	dTv_dt = 1 / q + Tlk * (0.378/Pa) / (q * q) * deb_dt;
+	dTv_dgsv = Tlk * (0.378/Pa) / (q * q) * deb_dgsv;
+
+	*ddeltat = gbv_free * (0.56 / Tlk + 0.5 / (Tlk + 120) + 0.25 * dTv_dt / Tvdiff);
+	*dstomcond = gbv_free * 0.25 * dTv_dgsv / Tvdiff;
+	return(gbv_free);
+}
+
+static void c4_leaf_eval(const void *data, double dt, double ci, struct coupled_eval *e)
+{
+	const struct c4_leaf *p = (const struct c4_leaf*)data;
+	const double AP = 101325;
+	const double P = AP / 1e3;
+	const double K = 1e-6 * 1.6 * AP / 0.001; /* Ci_new = Csurface - K * A / gs */
+	const double lnQ10 = log(2.0) / 10;
+
+	double Tl = p->Tair + dt;
+	double KQ10, dKQ10, kT, dkT, e1, e2, e3, VT, dVT, RT, dRT;
+	double aQ, b0, b1, M, dM, x, dx_dt, dx_ci, Qb, a2, den, da2_M, da2_x;
+	double s, A, dA_dt, dA_ci, gs, dgs;
+	double ci_new, dci_new;
+	double gvs, dgvs, ga, dga_dt, dga_gvs;
+	double PhiN2, top, bottom, F, F_dt, F_ga, F_gvs, dF_dt, dF_ci;
+
+	/* Collatz (1992) as in c4photoC */
+	KQ10 = pow(2, (Tl - 25.0) / 10.0);
+	dKQ10 = KQ10 * lnQ10;
+	kT = p->kparm * KQ10;
+	dkT = p->kparm * dKQ10;
+
+	e1 = exp(0.3 * (p->lowerT - Tl));
+	e2 = exp(0.3 * (Tl - p->upperT));
+	VT = p->vmax * KQ10 / ((1 + e1) * (1 + e2));
+	dVT = VT * (lnQ10 + 0.3 * e1 / (1 + e1) - 0.3 * e2 / (1 + e2));
+
+	e3 = exp(1.3 * (Tl - 55));
+	RT = p->Rd * KQ10 / (1 + e3);
+	dRT = RT * (lnQ10 - 1.3 * e3 / (1 + e3));
+
+	/* M is the smaller root of theta M^2 - b1 M + b0 = 0 */
+	aQ = p->alpha * p->Qp;
+	b0 = VT * aQ;
+	b1 = VT + aQ;
+	M = fmin((b1 + sqrt(b1*b1 - 4 * b0 * p->theta)) / (2 * p->theta),
+		 (b1 - sqrt(b1*b1 - 4 * b0 * p->theta)) / (2 * p->theta));
+	dM = (M - aQ) / (2 * p->theta * M - b1) * dVT;
+
+	/* a2 is the smaller root of beta a^2 - (M + x) a + M x = 0 */
+	x = kT * (ci / P * 1000);
+	dx_dt = dkT * (ci / P * 1000);
+	dx_ci = kT / P * 1000;
+	Qb = M + x;
+	a2 = (Qb - sqrt(Qb*Qb - 4 * M * x * p->beta)) / (2 * p->beta);
+	den = 2 * p->beta * a2 - Qb;
+	da2_M = (a2 - x) / den;
+	da2_x = (a2 - M) / den;
+
+	s = p->ws == 0 ? p->StomaWS : 1;
+	A = (a2 - RT) * s;
+	dA_dt = (da2_M * dM + da2_x * dx_dt - dRT) * s;
+	dA_ci = da2_x * dx_ci * s;
+
+	gs = ballBerry_d(A, p->Camf, p->RH, p->bb0, p->bb1, &dgs);
+	if(p->ws == 1){
+		gs *= p->StomaWS;
+		dgs *= p->StomaWS;
+	}
+
+	ci_new = p->Csurface - K * A / gs;
+	dci_new = -K * (gs - A * dgs) / (gs * gs);
+	if(ci_new < 0){
+		ci_new = 1e-5;
+		dci_new = 0;
+	}
+
+	/* Energy balance as in EvapoTrans2 */
+	gvs = gs * (1.0/41000.0);
+	dgvs = dgs * (1.0/41000.0);
+	if(gvs <= 0.001){
+		gvs = 0.001;
+		dgvs = 0;
+	}
+	ga = leafboundarylayer_d(p, dt, gvs, &dga_dt, &dga_gvs);
+
+	PhiN2 = p->Ja2 - p->rlc * dt;
+	top = PhiN2 * (1 / ga + 1 / gvs) - p->LHV * p->DeltaPVa;
+	bottom = p->LHV * (p->SlopeFS + p->PsycParam * (1 + ga / gvs));
+	F = top / bottom;
+	F_dt = -p->rlc * (1 / ga + 1 / gvs) / bottom;
+	F_ga = (-PhiN2 / (ga * ga) - F * p->LHV * p->PsycParam / gvs) / bottom;
+	F_gvs = (-PhiN2 / (gvs * gvs) + F * p->LHV * p->PsycParam * ga / (gvs * gvs)) / bottom;
+	dF_dt = F_dt + F_ga * (dga_dt + dga_gvs * dgvs * dA_dt) + F_gvs * dgvs * dA_dt;
+	dF_ci = (F_ga * dga_gvs + F_gvs) * dgvs * dA_ci;
+	if(F > 10 || F < -10){
+		F = F > 10 ? 10 : -10;
+		dF_dt = 0;
+		dF_ci = 0;
+	}
+
+	e->r[0] = dt - F;
+	e->J[0][0] = 1 - dF_dt;
+	e->J[0][1] = -dF_ci;
+	e->r[1] = ci - ci_new;
+	e->J[1][0] = -dci_new * dA_dt;
+	e->J[1][1] = 1 - dci_new * dA_ci;
+
+	e->assim = A;
+	e->gross_assim = A + RT;
+	e->gs = gs;
+	e->ci = ci_new;
+	e->ga = ga;
+	e->cond = gvs;
+}
+
+struct c4_str c4photoC_coupled(double Qp, double Iave, double Tair, double RH,
+		double WindSpeed, double LeafAreaIndex, double CanopyHeight, double leafw, int eteq,
+		double vmax, double alpha, double kparm, double theta, double beta,
+		double Rd, double bb0, double bb1, double StomaWS, double Ca, int ws,
+		double upperT, double lowerT, double StartCi, struct ET_Str *et)
+{
+	const double AP = 101325;
+	const double tau = 0.2;
+	const double LeafReflectance = 0.2;
+	const double SpecificHeat = 1010;
+	const double StefanBoltzmann = 5.67037e-8;
+
+	struct c4_leaf leaf;
+	struct coupled_eval e;
+	struct c4_str photo;
+	double DdryA, SWVP, SWVC, totalradiation, Ja, PhiN, Tak;
+	double TransR, EPen, EPries;
+	double dt = 0, ci;
+	int passes;
+
+	leaf.Qp = Qp;
+	leaf.Tair = Tair;
+	leaf.RH = RH;
+	leaf.vmax = vmax;
+	leaf.alpha = alpha;
+	leaf.kparm = kparm;
+	leaf.theta = theta;
+	leaf.beta = beta;
+	leaf.Rd = Rd;
+	leaf.bb0 = bb0;
+	leaf.bb1 = bb1;
+	leaf.StomaWS = StomaWS;
+	leaf.upperT = upperT;
+	leaf.lowerT = lowerT;
+	leaf.ws = ws;
+	leaf.Csurface = (Ca * 1e-6) * AP;
+	leaf.Camf = leaf.Csurface * 10 * 1e-6;
+
+	/* The parts of EvapoTrans2 that do not depend on the leaf */
+	DdryA = TempToDdryA(Tair);
+	leaf.LHV = TempToLHV(Tair) * 1e6;
+	leaf.SlopeFS = TempToSFS(Tair) * 1e-3;
+	SWVP = TempToSWVC(Tair);
+	SWVC = (DdryA * 0.622 * SWVP)/1013.25;
+	leaf.PsycParam = (DdryA * SpecificHeat) / leaf.LHV;
+	leaf.DeltaPVa = SWVC * (1 - RH);
+	leaf.ea = RH * SWVP * 1e2;
+
+	totalradiation = Qp * 0.235;
+	if(totalradiation > 650) error("total radiation too high");
+	Ja = (2 * totalradiation * ((1 - LeafReflectance - tau) / (1 - tau)));
+	leaf.Ja2 = (2 * Iave * 0.235 * ((1 - LeafReflectance - tau) / (1 - tau)));
+
+	/* leafboundarylayer, forced convection */
+	if(WindSpeed < 0.5) WindSpeed = 0.5;
+	Tak = Tair + 273.15;
+	leaf.leafw = leafw;
+	leaf.gbv_forced = 1.6361e-3 * pow(Tak,0.56) * pow((Tak+120)*((WindSpeed/leafw)/AP),0.5);
+	leaf.Tvair = Tak / (1-0.378*leaf.ea/AP);
+	leaf.rlc = 4 * StefanBoltzmann * pow(273 + Tair, 3);
+
+	ci = StartCi > 0 ? (StartCi * 1e-6) * AP : leaf.Csurface * 0.4;
+
+	passes = coupled_newton(c4_leaf_eval, &leaf, &dt, &ci, &e);
+	if(passes == 0){
+		/* What CanAC does otherwise */
+		int iterations;
+		photo = c4photoC(Qp, Tair, RH, vmax, alpha, kparm, theta, beta, Rd, bb0, bb1, StomaWS, Ca, ws, upperT, lowerT);
+		*et = EvapoTrans2(Qp, Iave, Tair, RH, WindSpeed, LeafAreaIndex, CanopyHeight, photo.Gs, leafw, eteq);
+		iterations = photo.iterations;
+		photo = c4photoC(Qp, Tair + et->Deltat, RH, vmax, alpha, kparm, theta, beta, Rd, bb0, bb1, StomaWS, Ca, ws, upperT, lowerT);
+		photo.iterations += iterations + COUPLED_MAX_ITERATIONS;
+		return(photo);
+	}
+
+	PhiN = Ja - leaf.rlc * dt;
+	if(PhiN < 0)
+		PhiN = 0;
+
+	TransR = (leaf.SlopeFS * PhiN + (leaf.LHV * leaf.PsycParam * e.ga * leaf.DeltaPVa)) /
+		(leaf.LHV * (leaf.SlopeFS + leaf.PsycParam * (1 + e.ga / e.cond)));
+	EPen = (((leaf.SlopeFS * PhiN) + leaf.LHV * leaf.PsycParam * e.ga * leaf.DeltaPVa)) /
+		(leaf.LHV * (leaf.SlopeFS + leaf.PsycParam));
+	EPries = 1.26 * ((leaf.SlopeFS * PhiN) / (leaf.LHV * (leaf.SlopeFS + leaf.PsycParam)));
+	if(eteq == 1) TransR = EPen;
+	if(eteq == 2) TransR = EPries;
+
+	et->TransR = TransR * 1e6 / 18;
+	et->EPenman = EPen * 1e6 / 18;
+	et->EPriestly = EPries * 1e6 / 18;
+	et->Deltat = dt;
+	et->LayerCond = e.cond * 41000;
+
+	photo.Assim = e.assim;
+	photo.Gs = e.gs > 600 ? 600 : e.gs;
+	photo.Ci = (e.ci / AP) * 1e6;
+	photo.GrossAssim = e.gross_assim;
+	photo.iterations = passes;
+	return(photo);
+}
+
+/* C3: c3photoC with the energy balance of c3EvapoTrans */
+
+struct c3_leaf {
+	double Qp, Tair, RH, Vcmax0, Jmax, Rd0, bb0, bb1, Ca, O2, thet, StomWS;
+	int ws;
+	double Ca_pa;
+	double Ja, LHV, SlopeFS, PsycParam, DeltaPVa, ga, rlc; /* rlc per degree of dt */
+};
+
+/* solo and its derivative */
+static double solo_d(double LeafT, double *dLeafT)
+{
+	if(LeafT > 24 && LeafT < 26){
+		*dLeafT = 0;
+		return(1);
+	}
+	*dLeafT = (-0.0013087 + 2 * 2.5603e-05 * LeafT - 3 * 2.1441e-07 * LeafT * LeafT) / 0.026934;
+	return(solo(LeafT));
+}
+
+static void c3_leaf_eval(const void *data, double dt, double ci, struct coupled_eval *e)
+{
+	const struct c3_leaf *p = (const struct c3_leaf*)data;
+	const double AP = 101325;
+	const double R = 0.008314472;
+	const double Rate_TPu = 23;
+	const double Leaf_Reflectance = 0.2;
+	const double K = 1e-6 * 1.6 * AP / 0.001;
+
+	double Tl = p->Tair + dt;
+	double Tk = Tl + 273.15;
+	double RTk2 = R * Tk * Tk;
+	double Kc, dKc, Ko, dKo, Gstar, dGstar, Vcmax, dVcmax, Rd, dRd;
+	double theta, dtheta, FEII, dFEII, I2, dI2, J, dJ;
+	double Oi, dOi, Kx, dKx, n, m;
+	double Ac, dAc_dt, dAc_ci, Aj, dAj_dt, dAj_ci, Ap, dAp_dt, dAp_ci, u;
+	double Vc = 0, dVc_dt = 0, dVc_ci = 0;
+	double s, A, dA_dt, dA_ci, gs, dgs, ci_new, dci_new;
+	double LC, dLC, PhiN, top, bottom, F, F_LC, dF_dt, dF_ci;
+
+	/* Bernacchi 2001 as in c3photoC, d/dT exp(c - E/(R Tk)) = E/(R Tk^2) exp(...) */
+	Kc = exp(38.05-79.43/(R*Tk));
+	dKc = Kc * 79.43 / RTk2;
+	Ko = exp(20.30-36.38/(R*Tk));
+	dKo = Ko * 36.38 / RTk2;
+	Gstar = exp(19.02-37.83/(R*Tk));
+	dGstar = Gstar * 37.83 / RTk2;
+	Vcmax = p->Vcmax0 * exp(26.35 - 65.33/(R*Tk));
+	dVcmax = Vcmax * 65.33 / RTk2;
+	Rd = p->Rd0 * exp(18.72 - 46.39/(R*Tk));
+	dRd = Rd * 46.39 / RTk2;
+
+	theta = p->thet + 0.018 * Tl - 3.7e-4 * pow(Tl,2);
+	dtheta = 0.018 - 2 * 3.7e-4 * Tl;
+	FEII = 0.352 + 0.022 * Tl - 3.4 * pow(Tl,2) / 10000;
+	dFEII = 0.022 - 2 * 3.4 * Tl / 10000;
+	I2 = p->Qp * FEII * (1 - Leaf_Reflectance) / 2;
+	dI2 = p->Qp * dFEII * (1 - Leaf_Reflectance) / 2;
+
+	/* J is the smaller root of theta J^2 - (Jmax + I2) J + I2 Jmax = 0 */
+	J = (p->Jmax + I2 - sqrt(pow(p->Jmax+I2,2) - 4 * theta * I2 * p->Jmax))/(2*theta);
+	dJ = -(J * J * dtheta + (p->Jmax - J) * dI2) / (2 * theta * J - p->Jmax - I2);
+
+	Oi = p->O2 * solo_d(Tl, &dOi);
+	dOi *= p->O2;
+	Kx = Kc * (1 + Oi/Ko);
+	dKx = dKc * (1 + Oi/Ko) + Kc * (dOi/Ko - Oi * dKo / (Ko * Ko));
+
+	/* Rubisco limited */
+	n = Vcmax * (ci - Gstar);
+	m = ci + Kx;
+	Ac = n / m;
+	dAc_ci = (Vcmax * m - n) / (m * m);
+	dAc_dt = (dVcmax * (ci - Gstar) - Vcmax * dGstar) / m - n * dKx / (m * m);
+
+	/* Light limited */
+	n = J * (ci - Gstar);
+	m = 4.5*ci + 10.5*Gstar;
+	Aj = n / m;
+	dAj_ci = (J * m - 4.5 * n) / (m * m);
+	dAj_dt = (dJ * (ci - Gstar) - J * dGstar) / m - n * 10.5 * dGstar / (m * m);
+	if(Aj < 0.0){
+		Aj = 0.0;
+		dAj_ci = dAj_dt = 0;
+	}
+
+	/* Triose phosphate utilization limited */
+	u = 1 - Gstar / ci;
+	Ap = (3 * Rate_TPu) / u;
+	dAp_ci = -(3 * Rate_TPu) * (Gstar / (ci * ci)) / (u * u);
+	dAp_dt = (3 * Rate_TPu) * (dGstar / ci) / (u * u);
+
+	if(Ac < Aj && Ac < Ap){
+		Vc = Ac;
+		dVc_dt = dAc_dt;
+		dVc_ci = dAc_ci;
+	}else if(Aj < Ac && Aj < Ap){
+		Vc = Aj;
+		dVc_dt = dAj_dt;
+		dVc_ci = dAj_ci;
+	}else if(Ap < Ac && Ap < Aj && Ap > 0){
+		Vc = Ap;
+		dVc_dt = dAp_dt;
+		dVc_ci = dAp_ci;
+	}
+
+	s = p->ws == 0 ? p->StomWS : 1;
+	A = (Vc - Rd) * s;
+	dA_dt = (dVc_dt - dRd) * s;
+	dA_ci = dVc_ci * s;
+
+	gs = ballBerry_d(A, p->Ca * 1e-6, p->RH, p->bb0, p->bb1, &dgs);
+	if(p->ws == 1){
+		gs *= p->StomWS;
+		dgs *= p->StomWS;
+	}
+	if(gs <= 0 || gs > 800){
+		gs = gs <= 0 ? 1e-5 : 800;
+		dgs = 0;
+	}
+
+	ci_new = p->Ca_pa - K * A / gs;
+	dci_new = -K * (gs - A * dgs) / (gs * gs);
+	if(ci_new < 0){
+		ci_new = 1e-5;
+		dci_new = 0;
+	}
+
+	/* Energy balance as in c3EvapoTrans, where ga does not depend on the leaf */
+	LC = gs * 1e-6 * 24.39;
+	dLC = dgs * 1e-6 * 24.39;
+	if(LC <= 0){
+		LC = 0.01;
+		dLC = 0;
+	}
+	PhiN = p->Ja - p->rlc * dt;
+	top = PhiN * (1 / p->ga + 1 / LC) - p->LHV * p->DeltaPVa;
+	bottom = p->LHV * (p->SlopeFS + p->PsycParam * (1 + p->ga / LC));
+	F = top / bottom;
+	F_LC = (-PhiN / (LC * LC) + F * p->LHV * p->PsycParam * p->ga / (LC * LC)) / bottom;
+	dF_dt = -p->rlc * (1 / p->ga + 1 / LC) / bottom + F_LC * dLC * dA_dt;
+	dF_ci = F_LC * dLC * dA_ci;
+	if(F > 5 || F < -5){
+		F = F > 5 ? 5 : -5;
+		dF_dt = 0;
+		dF_ci = 0;
+	}
+
+	e->r[0] = dt - F;
+	e->J[0][0] = 1 - dF_dt;
+	e->J[0][1] = -dF_ci;
+	e->r[1] = ci - ci_new;
+	e->J[1][0] = -dci_new * dA_dt;
+	e->J[1][1] = 1 - dci_new * dA_ci;
+
+	e->assim = A;
+	e->gross_assim = A + Rd;
+	e->gs = gs;
+	e->ci = ci_new;
+	e->ga = p->ga;
+	e->cond = LC;
+}
+
+struct c3_str c3photoC_coupled(double Rad, double Itot, double Airtemperature, double RH,
+		double WindSpeed, double LeafAreaIndex, double CanopyHeight,
+		double vcmax, double jmax, double Rd, double b0, double b1,
+		double Catm, double O2, double theta, double StomWS, int ws,
+		double StartCi, struct ET_Str *et)
+{
+	const double AP = 101325;
+	const double kappa = 0.41;
+	const double WindSpeedHeight = 5;
+	const double dCoef = 0.77;
+	const double tau = 0.2;
+	const double ZetaCoef = 0.026;
+	const double ZetaMCoef = 0.13;
+	const double LeafReflectance = 0.2;
+	const double SpecificHeat = 1010;
+
+	struct c3_leaf leaf;
+	struct coupled_eval e;
+	struct c3_str photo = {0, 0, 0, 0, 0};
+	double DdryA, SWVC, Zeta, Zetam, d, totalradiation, PhiN;
+	double TransR, EPen, EPries;
+	double dt = 0, ci;
+	int passes;
+
+	leaf.Qp = Rad;
+	leaf.Tair = Airtemperature;
+	leaf.RH = RH;
+	leaf.Vcmax0 = vcmax;
+	leaf.Jmax = jmax;
+	leaf.Rd0 = Rd;
+	leaf.bb0 = b0;
+	leaf.bb1 = b1;
+	leaf.Ca = Catm <= 0 ? 1e-4 : Catm;
+	leaf.Ca_pa = leaf.Ca / 1e6 * AP;
+	leaf.O2 = O2;
+	leaf.thet = theta;
+	leaf.StomWS = StomWS;
+	leaf.ws = ws;
+
+	/* The parts of c3EvapoTrans that do not depend on the leaf */
+	if(CanopyHeight < 0.1)
+		CanopyHeight = 0.1;
+	DdryA = TempToDdryA(Airtemperature);
+	leaf.LHV = TempToLHV(Airtemperature) * 1e6;
+	leaf.SlopeFS = TempToSFS(Airtemperature) * 1e-3;
+	SWVC = TempToSWVC(Airtemperature) * 1e-3;
+	Zeta = ZetaCoef * CanopyHeight;
+	Zetam = ZetaMCoef * CanopyHeight;
+	d = dCoef * CanopyHeight;
+
+	if(RH * 100 > 100)
+		error("LayerRelativehumidity > 100");
+	if(WindSpeed < 0.5) WindSpeed = 0.5;
+	totalradiation = Itot * 0.235;
+	if(SWVC < 0)
+		error("SWVC < 0");
+	leaf.DeltaPVa = SWVC * (1 - RH);
+	leaf.PsycParam = (DdryA * SpecificHeat) / leaf.LHV;
+	leaf.Ja = (2 * totalradiation * ((1 - LeafReflectance - tau) / (1 - tau)));
+	leaf.ga = pow(kappa,2) * WindSpeed /
+		(log((WindSpeedHeight + Zeta - d)/Zeta) * log((WindSpeedHeight + Zetam - d)/Zetam));
+	if(leaf.ga < 0)
+		error("ga is less than zero");
+	leaf.rlc = 4 * (5.67*1e-8) * pow(273 + Airtemperature, 3);
+
+	/* c3photoC starts from Ci = 0, where the triose phosphate limit has no
+	 * derivative */
+	ci = StartCi > 0 ? StartCi : leaf.Ca_pa * 0.7;
+
+	passes = coupled_newton(c3_leaf_eval, &leaf, &dt, &ci, &e);
+	if(passes == 0){
+		/* What c3CanAC does otherwise */
+		*et = c3EvapoTrans(Rad, Itot, Airtemperature, RH, WindSpeed, LeafAreaIndex, CanopyHeight,
+				vcmax, jmax, Rd, b0, b1, Catm, O2, theta, StomWS, ws, &photo);
+		passes = photo.iterations;
+		photo = c3photoC(Rad, Airtemperature + et->Deltat, RH, vcmax, jmax, Rd, b0, b1, Catm, O2, theta, StomWS, ws);
+		photo.iterations += passes + COUPLED_MAX_ITERATIONS;
+		return(photo);
+	}
+
+	PhiN = leaf.Ja - leaf.rlc * dt;
+	if(PhiN < 0)
+		PhiN = 0;
+
+	TransR = (leaf.SlopeFS * PhiN + (leaf.LHV * leaf.PsycParam * leaf.ga * leaf.DeltaPVa)) /
+		(leaf.LHV * (leaf.SlopeFS + leaf.PsycParam * (1 + leaf.ga / e.cond)));
+	EPries = 1.26 * ((leaf.SlopeFS * PhiN) / (leaf.LHV * (leaf.SlopeFS + leaf.PsycParam)));
+	EPen = (((leaf.SlopeFS * PhiN) + leaf.LHV * leaf.PsycParam * leaf.ga * leaf.DeltaPVa)) /
+		(leaf.LHV * (leaf.SlopeFS + leaf.PsycParam));
+
+	et->TransR = TransR * 1e6 / 18;
+	et->EPenman = EPen * 1e6 / 18;
+	et->EPriestly = EPries * 1e6 / 18;
+	et->Deltat = dt;
+	et->LayerCond = e.cond * 1e6 * (1/24.39);
+
+	photo.Assim = e.assim;
+	photo.Gs = e.gs;
+	photo.Ci = e.ci;
+	photo.GrossAssim = e.gross_assim;
+	photo.iterations = passes;
+	return(photo);
+}
@@ -0,0 +1,30 @@
+#ifndef LEAF_COUPLED_H
+#define LEAF_COUPLED_H
+/*
+ *  BioCro/src/leaf_coupled.h
+ *
+ *  Leaf temperature, stomatal conductance and assimilation solved
+ *  together. Needs AuxBioCro.h, and c4photo.h or c3photo.h for the
+ *  solver that is called.
+ *
+ */
+
+/* The energy balance of EvapoTrans2 and the Ci balance of c4photoC solved
+ * together. Returns photosynthesis at the leaf temperature in et->Deltat,
+ * with iterations the Newton passes it took. StartCi (ppm) starts the
+ * solve when positive. */
+struct c4_str c4photoC_coupled(double Qp, double Iave, double Tair, double RH,
+        double WindSpeed, double LeafAreaIndex, double CanopyHeight, double leafw, int eteq,
+        double vmax, double alpha, double kparm, double theta, double beta,
+        double Rd, double bb0, double bb1, double StomaWS, double Ca, int ws,
+        double upperT, double lowerT, double StartCi, struct ET_Str *et);
+
+/* The same for the energy balance of c3EvapoTrans and c3photoC. StartCi
+ * is in Pa. */
+struct c3_str c3photoC_coupled(double Rad, double Itot, double Airtemperature, double RH,
+        double WindSpeed, double LeafAreaIndex, double CanopyHeight,
+        double vcmax, double jmax, double Rd, double b0, double b1,
+        double Catm, double O2, double theta, double StomWS, int ws,
+        double StartCi, struct ET_Str *et);
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ *  BioCro/src/senescence_queue.c
+ *
+ *  Tissue produced at each step, kept until it senesces. Only the steps
+ *  between the next one to senesce and the last one produced are held, in
+ *  a ring that grows when it fills, so runs are not limited to the length
+ *  of a preallocated vector.
+ *
+ */
+
+#include <R.h>
+#include <stdlib.h>
+#include <string.h>
+#include "BioCro.h"
+
+#define SENESCENCE_QUEUE_CAPACITY 512
+
+void initialize_senescence_queue(struct senescence_queue *queue)
+{
+	queue->capacity = SENESCENCE_QUEUE_CAPACITY;
+	queue->values = (double*)calloc(queue->capacity, sizeof(double));
+	clear_senescence_queue(queue);
+}
+
+void free_senescence_queue(struct senescence_queue *queue)
+{
+	free(queue->values);
+	queue->values = NULL;
+	queue->capacity = 0;
+}
+
+void clear_senescence_queue(struct senescence_queue *queue)
+{
+	queue->start = 0;
+	queue->count = 0;
+	queue->taken = 0;
+}
+
+/* Makes room for at least capacity values, keeping the ones held. */
+static void reserve_senescence_queue(struct senescence_queue *queue, int capacity)
+{
+	double *values;
+	int new_capacity = queue->capacity, j;
+
+	if (capacity <= queue->capacity) return;
+	while (new_capacity < capacity) new_capacity *= 2;
+
+	values = (double*)calloc(new_capacity, sizeof(double));
+	for (j = 0; j < queue->count; j++) {
+		values[j] = queue->values[(queue->start + j) % queue->capacity];
+	}
+	free(queue->values);
+	queue->values = values;
+	queue->capacity = new_capacity;
+	queue->start = 0;
+}
+
+/* Stores the tissue produced at step. Steps that were skipped hold zero. A
+ * step that has already been taken, which happens when senescence gets
+ * ahead of production, is not stored. */
+void put_senescence_queue(struct senescence_queue *queue, int step, double value)
+{
+	int offset = step - queue->taken;
+	int j;
+
+	if (offset < 0) return;
+	if (offset >= queue->count) {
+		reserve_senescence_queue(queue, offset + 1);
+		for (j = queue->count; j <= offset; j++) {
+			queue->values[(queue->start + j) % queue->capacity] = 0.0;
+		}
+		queue->count = offset + 1;
+	}
+	queue->values[(queue->start + offset) % queue->capacity] = value;
+}
+
+/* Removes and returns the tissue of the oldest step that has not
+ * senesced yet, or zero if none was produced at that step. */
+double take_senescence_queue(struct senescence_queue *queue)
+{
+	double value = 0.0;
+
+	if (queue->count > 0) {
+		value = queue->values[queue->start];
+		queue->start = (queue->start + 1) % queue->capacity;
+		queue->count--;
+	}
+	queue->taken++;
+	return value;
+}
+
+/* Both queues must have been initialized. */
+void copy_senescence_queue(struct senescence_queue *to, const struct senescence_queue *from)
+{
+	int j;
+
+	reserve_senescence_queue(to, from->count);
+	for (j = 0; j < from->count; j++) {
+		to->values[j] = from->values[(from->start + j) % from->capacity];
+	}
+	to->start = 0;
+	to->count = from->count;
+	to->taken = from->taken;
+}
+
+/* The number of doubles save_senescence_queue writes. */
+int senescence_queue_length(const struct senescence_queue *queue)
+{
+	return 2 + queue->count;
+}
+
+double *save_senescence_queue(const struct senescence_queue *queue, double *buffer)
+{
+	int j;
+
+	*buffer++ = queue->taken;
+	*buffer++ = queue->count;
+	for (j = 0; j < queue->count; j++) {
+		*buffer++ = queue->values[(queue->start + j) % queue->capacity];
+	}
+	return buffer;
+}
+
+/* Reads a queue written by save_senescence_queue from the length values at
+ * buffer. Returns the position after it, or NULL if it does not fit. */
+const double *restore_senescence_queue(struct senescence_queue *queue, const double *buffer, int length)
+{
+	int count, j;
+
+	if (length < 2) return NULL;
+	count = (int)buffer[1];
+	if (count < 0 || buffer[0] < 0 || length < 2 + count) return NULL;
+
+	reserve_senescence_queue(queue, count);
+	queue->taken = (int)buffer[0];
+	queue->start = 0;
+	queue->count = count;
+	buffer += 2;
+	for (j = 0; j < count; j++) queue->values[j] = *buffer++;
+	return buffer;
+}
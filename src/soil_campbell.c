@@ -0,0 +1,205 @@
+/*
+ *  BioCro/src/soil_campbell.c
+ *
+ *  The Campbell retention and conductivity curves of a soil (Campbell and
+ *  Norman "Environmental BioPhysics" Chapter 9), the matric potential
+ *
+ *    psim = air_entry * (theta / satur)^-b
+ *
+ *  and the conductivity at that potential
+ *
+ *    K = Ks * (air_entry / psim)^(2 + 3 / b),
+ *
+ *  tabulated over the water content theta and interpolated. The soil of a
+ *  run does not change, so the table is built once, at the first step or
+ *  before the run by campbell_table_for, and every layer of every step
+ *  after costs a lookup instead of two calls of pow.
+ *
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include "AuxBioCro.h"
+
+static double exact_psim(struct soilText_str soTexS, double theta)
+{
+	return(soTexS.air_entry * pow((theta/soTexS.satur),-soTexS.b));
+}
+
+static double exact_K(struct soilText_str soTexS, double psim)
+{
+	return(soTexS.Ks * pow((soTexS.air_entry/psim),2+3/soTexS.b));
+}
+
+static int same_soil(const struct campbell_table *table, struct soilText_str soTexS)
+{
+	return(table->air_entry == soTexS.air_entry && table->b == soTexS.b &&
+	       table->Ks == soTexS.Ks && table->satur == soTexS.satur);
+}
+
+/* Cubic Hermite interpolation between nodes i and i + 1 at position f */
+static double hermite(const double y[], const double dy[], double step, int i, double f)
+{
+	double f2 = f * f, f3 = f2 * f;
+	return((2 * f3 - 3 * f2 + 1) * y[i] + (f3 - 2 * f2 + f) * step * dy[i] +
+	       (-2 * f3 + 3 * f2) * y[i+1] + (f3 - f2) * step * dy[i+1]);
+}
+
+/* Limits the slopes at the nodes so that the interpolation between them
+   is monotone (Fritsch and Carlson 1980). The slopes of the curves
+   change little from one node to the next and this seldom changes any. */
+static void monotone_slopes(double y[], double dy[], double step)
+{
+	double delta, alpha, beta, tau;
+	int i;
+	for(i = 0; i < CAMPBELL_NODES - 1; i++){
+		delta = (y[i+1] - y[i]) / step;
+		if(delta == 0){
+			dy[i] = dy[i+1] = 0;
+			continue;
+		}
+		alpha = dy[i] / delta;
+		beta = dy[i+1] / delta;
+		if(alpha < 0) dy[i] = 0, alpha = 0;
+		if(beta < 0) dy[i+1] = 0, beta = 0;
+		if(alpha * alpha + beta * beta > 9){
+			tau = 3 / sqrt(alpha * alpha + beta * beta);
+			dy[i] = tau * alpha * delta;
+			dy[i+1] = tau * beta * delta;
+		}
+	}
+}
+
+/* Nodes from half the wilting point of the soil to saturation, and the
+   largest relative errors of the interpolation, measured at the centres
+   of the cells where they are largest for curves this smooth. */
+static void build_table(struct campbell_table *table, struct soilText_str soTexS)
+{
+	double theta, psim, K, error;
+	int i;
+
+	table->air_entry = soTexS.air_entry;
+	table->b = soTexS.b;
+	table->Ks = soTexS.Ks;
+	table->satur = soTexS.satur;
+	table->theta_min = 0.5 * soTexS.wiltp;
+	table->step = (soTexS.satur - table->theta_min) / (CAMPBELL_NODES - 1);
+
+	for(i = 0; i < CAMPBELL_NODES; i++){
+		theta = table->theta_min + i * table->step;
+		psim = exact_psim(soTexS, theta);
+		K = exact_K(soTexS, psim);
+		table->psim[i] = psim;
+		table->dpsim[i] = -soTexS.b * psim / theta;
+		table->K[i] = K;
+		table->dK[i] = (2 * soTexS.b + 3) * K / theta;
+	}
+	monotone_slopes(table->psim, table->dpsim, table->step);
+	monotone_slopes(table->K, table->dK, table->step);
+
+	table->error_psim = table->error_K = 0;
+	for(i = 0; i < CAMPBELL_NODES - 1; i++){
+		theta = table->theta_min + (i + 0.5) * table->step;
+		psim = exact_psim(soTexS, theta);
+		K = exact_K(soTexS, psim);
+		error = fabs(hermite(table->psim, table->dpsim, table->step, i, 0.5) / psim - 1);
+		if(error > table->error_psim) table->error_psim = error;
+		error = fabs(hermite(table->K, table->dK, table->step, i, 0.5) / K - 1);
+		if(error > table->error_K) table->error_K = error;
+	}
+	table->builds++;
+}
+
+/* Soils kept at once by campbell_table_for */
+#define CAMPBELL_TABLE_CACHE 4
+
+static struct campbell_table *campbell_tables[CAMPBELL_TABLE_CACHE];
+static int next_campbell_table = 0;
+
+/* The table for soTexS, shared by all the runs on that soil and built the
+   first time it is asked for. Not thread safe: call it on the main thread,
+   before starting any threads that use the table, as BioGroEnsemble does
+   so that its members do not each build the same one. A table stays valid
+   until CAMPBELL_TABLE_CACHE other soils have been asked for. Returns NULL
+   if the table cannot be allocated. */
+const struct campbell_table *campbell_table_for(struct soilText_str soTexS)
+{
+	struct campbell_table *table;
+	int i;
+
+	for(i = 0; i < CAMPBELL_TABLE_CACHE; i++)
+		if(campbell_tables[i] != NULL && same_soil(campbell_tables[i], soTexS) &&
+		   campbell_tables[i]->theta_min == 0.5 * soTexS.wiltp)
+			return(campbell_tables[i]);
+
+	table = campbell_tables[next_campbell_table];
+	if(table == NULL){
+		table = (struct campbell_table*)calloc(1, sizeof(struct campbell_table));
+		if(table == NULL) return(NULL);
+		campbell_tables[next_campbell_table] = table;
+	}
+	next_campbell_table = (next_campbell_table + 1) % CAMPBELL_TABLE_CACHE;
+
+	build_table(table, soTexS);
+	return(table);
+}
+
+/* The table of the soil column for soTexS: soil->sharedCampbell when it
+   is for that soil, otherwise the column's own, built at the first call
+   and again if the soil changes. NULL when soil->exactCampbell is set. */
+const struct campbell_table *soil_campbell_table(struct soil_column *soil, struct soilText_str soTexS)
+{
+	if(soil->exactCampbell) return(NULL);
+	if(soil->sharedCampbell != NULL && same_soil(soil->sharedCampbell, soTexS))
+		return(soil->sharedCampbell);
+	if(soil->campbell == NULL)
+		soil->campbell = (struct campbell_table*)calloc(1, sizeof(struct campbell_table));
+	if(soil->campbell->builds == 0 || !same_soil(soil->campbell, soTexS))
+		build_table(soil->campbell, soTexS);
+	return(soil->campbell);
+}
+
+/* The position of theta in the cell of the table that holds it. Returns 0
+   when the table does not cover theta. */
+static int locate(const struct campbell_table *table, double theta, int *cell, double *f)
+{
+	double u;
+	int i;
+	if(table == NULL) return(0);
+	u = (theta - table->theta_min) / table->step;
+	if(!(u >= 0 && u <= CAMPBELL_NODES - 1)) return(0);
+	i = (int)u;
+	if(i > CAMPBELL_NODES - 2) i = CAMPBELL_NODES - 2;
+	*cell = i;
+	*f = u - i;
+	return(1);
+}
+
+/* The matric potential (J / kg) and conductivity (kg s / m3) at water
+   content theta. Water contents outside the table, or a NULL table, are
+   evaluated exactly, as soilML always did. */
+void campbell_curves(const struct campbell_table *table, struct soilText_str soTexS, double theta,
+		     double *psim, double *K)
+{
+	double f;
+	int i;
+
+	if(locate(table, theta, &i, &f)){
+		*psim = hermite(table->psim, table->dpsim, table->step, i, f);
+		*K = hermite(table->K, table->dK, table->step, i, f);
+	}else{
+		*psim = exact_psim(soTexS, theta);
+		*K = exact_K(soTexS, *psim);
+	}
+}
+
+/* The matric potential alone */
+double campbell_psim(const struct campbell_table *table, struct soilText_str soTexS, double theta)
+{
+	double f;
+	int i;
+
+	if(locate(table, theta, &i, &f))
+		return(hermite(table->psim, table->dpsim, table->step, i, f));
+	return(exact_psim(soTexS, theta));
+}
@@ -0,0 +1,74 @@
+/*
+ *  BioCro/src/soil_column.c
+ *
+ *  The soil layers of a run, sized for the layers it has, which soilML
+ *  and soilML_rootfront update in place at every step.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "AuxBioCro.h"
+
+void initialize_soil_column(struct soil_column *soil, int layers)
+{
+	memset(soil, 0, sizeof(struct soil_column));
+
+	soil->layers = layers;
+	soil->cws = (double*)calloc(layers, sizeof(double));
+	soil->rootDist = (double*)calloc(layers, sizeof(double));
+	soil->hourlyWflux = (double*)calloc(layers, sizeof(double));
+	soil->rootFraction = (double*)calloc(layers, sizeof(double));
+}
+
+void free_soil_column(struct soil_column *soil)
+{
+	free(soil->cws);
+	free(soil->rootDist);
+	free(soil->hourlyWflux);
+	free(soil->rootFraction);
+	free(soil->campbell);
+
+	soil->cws = NULL;
+	soil->rootDist = NULL;
+	soil->hourlyWflux = NULL;
+	soil->rootFraction = NULL;
+	soil->campbell = NULL;
+}
+
+/* Both columns must have been initialized with the same number of layers.
+   Each keeps its own table of the Campbell curves; sharedCampbell is
+   copied as it is. */
+void copy_soil_column(struct soil_column *to, const struct soil_column *from)
+{
+	struct soil_column arrays = *to;
+
+	*to = *from;
+	to->cws = arrays.cws;
+	to->rootDist = arrays.rootDist;
+	to->hourlyWflux = arrays.hourlyWflux;
+	to->rootFraction = arrays.rootFraction;
+	to->campbell = arrays.campbell;
+
+	memcpy(to->cws, from->cws, from->layers * sizeof(double));
+	memcpy(to->rootDist, from->rootDist, from->layers * sizeof(double));
+	memcpy(to->hourlyWflux, from->hourlyWflux, from->layers * sizeof(double));
+	memcpy(to->rootFraction, from->rootFraction, from->layers * sizeof(double));
+}
+
+/* The fraction of the roots in each layer for roots down to rootDepth, as
+   rootDist gives it. The fractions change only when the roots reach
+   another layer, so they are computed again only then, or when rfl
+   changes. depths must be the same at every call. */
+const double *soil_root_fractions(struct soil_column *soil, double rootDepth, double *depths, double rfl)
+{
+	int rootLayers = rootDist_layers(soil->layers, rootDepth, depths);
+
+	if(rootLayers != soil->rootLayers || rfl != soil->rootRfl){
+		rootDist_fractions(soil->layers, rootLayers, rfl, soil->rootFraction);
+		soil->rootLayers = rootLayers;
+		soil->rootRfl = rfl;
+		soil->rootDistComputations++;
+	}
+	return(soil->rootFraction);
+}
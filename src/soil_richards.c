@@ -0,0 +1,202 @@
+/*
+ *  BioCro/src/soil_richards.c
+ *
+ *  Redistribution of water between the layers of soil by the Richards
+ *  equation with the Campbell retention and conductivity curves (Campbell
+ *  and Norman "Environmental BioPhysics" Chapter 9). Each step is taken
+ *  backward in time, which stays stable for thin layers and sandy soils
+ *  where the explicit fluxes of soilML overshoot, and the hour is split in
+ *  steps as short as the change in water content asks for.
+ *
+ *  A step solves one tridiagonal system per Newton pass, so an hour costs
+ *  a number of operations linear in the number of layers. The curves come
+ *  from the table of the soil column, see soil_campbell.c.
+ *
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include "AuxBioCro.h"
+
+#define RICHARDS_HOUR 3600.0
+/* Largest difference in water content, between one step and two of half
+   its length, of a step that is kept */
+#define RICHARDS_TOLERANCE 1e-3
+/* Steps are not made shorter than this many seconds */
+#define RICHARDS_MIN_STEP 1.0
+#define RICHARDS_MAX_ITERATIONS 20
+#define RICHARDS_ITERATION_TOLERANCE 1e-10
+/* Water content below which the retention curve is not followed */
+#define RICHARDS_MIN_THETA 1e-3
+
+/* Fluxes in kg / (m2 * s) to m3 / (m2 * s), the factor of soilML */
+static const double flux_to_volume = 0.9882 * 1e-3;
+static const double g = 9.8; /* m / s-2 */
+
+/* Matric potential (J / kg), its derivative with water content and
+   hydraulic conductivity (kg s / m3), soTexS.Ks at saturation */
+static void curves(const struct campbell_table *table, struct soilText_str soTexS, double theta,
+		   double *psi, double *dpsi, double *K)
+{
+	if(theta < RICHARDS_MIN_THETA) theta = RICHARDS_MIN_THETA;
+	if(table != NULL){
+		campbell_curves(table, soTexS, theta, psi, K);
+	}else{
+		/* The same curves in water content alone */
+		*psi = soTexS.air_entry * pow(theta / soTexS.satur, -soTexS.b);
+		*K = soTexS.Ks * pow(theta / soTexS.satur, 2 * soTexS.b + 3);
+	}
+	*dpsi = -soTexS.b * *psi / theta;
+	if(theta >= soTexS.satur) *K = soTexS.Ks;
+}
+
+/* Solves a[i] x[i-1] + b[i] x[i] + c[i] x[i+1] = d[i] for i = 0..n-1,
+   overwriting c and d. The systems of a step are diagonally dominant and
+   need no pivoting. */
+static void thomas(int n, const double a[], const double b[], double c[], double d[], double x[])
+{
+	int i;
+	double m;
+
+	c[0] /= b[0];
+	d[0] /= b[0];
+	for(i = 1; i < n; i++){
+		m = b[i] - a[i] * c[i-1];
+		c[i] /= m;
+		d[i] = (d[i] - a[i] * d[i-1]) / m;
+	}
+	x[n-1] = d[n-1];
+	for(i = n - 2; i >= 0; i--)
+		x[i] = d[i] - c[i] * x[i+1];
+}
+
+/* One backward Euler step of h seconds from theta0 to theta, by Newton
+   passes on the matric potential with the conductivities of the last
+   pass. Water enters and leaves the column only through free drainage at
+   the bottom. Returns 0 when the passes do not converge. */
+static int richards_step(int n, const double dz[], const double theta0[], double h,
+			 const struct campbell_table *table, struct soilText_str soTexS, double theta[])
+{
+	double psi[n], dpsi[n], Kl[n], A[n + 1], G[n + 1];
+	double a[n], b[n], c[n], d[n], delta[n];
+	double K, F_top, F_bottom, change;
+	int i, iter;
+
+	for(i = 0; i < n; i++) theta[i] = theta0[i];
+
+	for(iter = 0; iter < RICHARDS_MAX_ITERATIONS; iter++){
+		for(i = 0; i < n; i++)
+			curves(table, soTexS, theta[i], &psi[i], &dpsi[i], &Kl[i]);
+
+		/* Flux down through the top of layer i is
+		   A[i] * (psi[i-1] - psi[i]) + G[i]. No water crosses the top
+		   of the column and the bottom drains by gravity alone. */
+		A[0] = G[0] = 0.0;
+		for(i = 1; i < n; i++){
+			K = 0.5 * (Kl[i-1] + Kl[i]);
+			A[i] = flux_to_volume * K / (0.5 * (dz[i-1] + dz[i]));
+			G[i] = flux_to_volume * g * K;
+		}
+		A[n] = 0.0;
+		G[n] = flux_to_volume * g * Kl[n-1];
+
+		for(i = 0; i < n; i++){
+			F_top = G[i] + (i > 0 ? A[i] * (psi[i-1] - psi[i]) : 0.0);
+			F_bottom = G[i+1] + (i < n - 1 ? A[i+1] * (psi[i] - psi[i+1]) : 0.0);
+			a[i] = i > 0 ? -A[i] * dpsi[i-1] : 0.0;
+			b[i] = dz[i] / h + (A[i] + A[i+1]) * dpsi[i];
+			c[i] = i < n - 1 ? -A[i+1] * dpsi[i+1] : 0.0;
+			d[i] = F_top - F_bottom - dz[i] / h * (theta[i] - theta0[i]);
+		}
+		thomas(n, a, b, c, d, delta);
+
+		change = 0.0;
+		for(i = 0; i < n; i++){
+			theta[i] += delta[i];
+			if(theta[i] < RICHARDS_MIN_THETA) theta[i] = RICHARDS_MIN_THETA;
+			if(fabs(delta[i]) > change) change = fabs(delta[i]);
+		}
+		if(!isfinite(change)) return(0);
+		if(change < RICHARDS_ITERATION_TOLERANCE) return(1);
+	}
+	return(0);
+}
+
+/* Adds the water that crossed into each layer from above while the column
+   went from theta0 to theta, worked out from the change of every layer
+   above it so that no water is lost, to down[0..n]; down[n] is what left
+   through the bottom. */
+static void add_fluxes(int n, const double dz[], const double theta0[], const double theta[],
+		       double down[])
+{
+	double F = 0.0;
+	int i;
+	for(i = 0; i < n; i++){
+		F -= dz[i] * (theta[i] - theta0[i]);
+		down[i+1] += F;
+	}
+}
+
+/* Moves the water of soil->cws between its layers for one hour. Each step
+   is compared with two steps of half its length; when they differ by more
+   than RICHARDS_TOLERANCE in any layer the step is made shorter, otherwise
+   the two half steps are kept and the next step is made longer. The flow
+   into each layer from the one above, upward positive as in soilML, is
+   stored in soil->hourlyWflux (m3 / m2 in the hour) and what drained from
+   the bottom layer is subtracted from drainage. Returns the number of
+   steps taken; should a step of RICHARDS_MIN_STEP fail to converge, the
+   rest of the hour is left without redistribution. */
+int richards_redistribute(struct soil_column *soil, const double *depths, struct soilText_str soTexS,
+			  double *drainage)
+{
+	const struct campbell_table *table = soil_campbell_table(soil, soTexS);
+	int n = soil->layers;
+	double dz[n], theta[n], full[n], half[n], second[n], down[n + 1];
+	double t = 0.0, h = RICHARDS_HOUR, error, factor;
+	int i, steps = 0;
+
+	for(i = 0; i < n; i++){
+		dz[i] = i == 0 ? depths[1] : depths[i] - depths[i-1];
+		theta[i] = soil->cws[i];
+	}
+	for(i = 0; i <= n; i++) down[i] = 0.0;
+
+	while(t < RICHARDS_HOUR){
+		if(h > RICHARDS_HOUR - t) h = RICHARDS_HOUR - t;
+
+		if(richards_step(n, dz, theta, h, table, soTexS, full) &&
+		   richards_step(n, dz, theta, 0.5 * h, table, soTexS, half) &&
+		   richards_step(n, dz, half, 0.5 * h, table, soTexS, second)){
+			error = 0.0;
+			for(i = 0; i < n; i++)
+				if(fabs(full[i] - second[i]) > error) error = fabs(full[i] - second[i]);
+		}else{
+			error = HUGE_VAL;
+		}
+
+		if(error > RICHARDS_TOLERANCE && h > RICHARDS_MIN_STEP){
+			h *= error == HUGE_VAL ? 0.25 : fmax(0.25, 0.9 * sqrt(RICHARDS_TOLERANCE / error));
+			if(h < RICHARDS_MIN_STEP) h = RICHARDS_MIN_STEP;
+			continue;
+		}
+
+		/* At the shortest step the result is kept whatever its error,
+		   unless the step failed. */
+		if(error == HUGE_VAL) break;
+		add_fluxes(n, dz, theta, second, down);
+		for(i = 0; i < n; i++) theta[i] = second[i];
+		t += h;
+		steps++;
+
+		factor = error > 0 ? 0.9 * sqrt(RICHARDS_TOLERANCE / error) : 4.0;
+		h *= factor > 4.0 ? 4.0 : factor;
+		if(h < RICHARDS_MIN_STEP) h = RICHARDS_MIN_STEP;
+	}
+
+	for(i = 0; i < n; i++){
+		soil->cws[i] = theta[i];
+		soil->hourlyWflux[i] = -down[i];
+	}
+	*drainage -= down[n];
+	return(steps);
+}
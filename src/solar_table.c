@@ -0,0 +1,56 @@
+/*
+ *  BioCro/src/solar_table.c
+ *
+ *  lightME for every hour of the year at one latitude. The position of the
+ *  sun does not depend on the weather, so a run, and every other run at the
+ *  same site, can look it up instead of computing it again each hour.
+ *
+ */
+
+#include <R.h>
+#include <stdlib.h>
+#include "BioCro.h"
+
+/* Latitudes kept at once. */
+#define SOLAR_TABLE_CACHE 8
+
+static struct solar_table *solar_tables[SOLAR_TABLE_CACHE];
+static int next_solar_table = 0;
+
+/* The table for lat, built the first time it is asked for. Not thread safe:
+ * call it on the main thread, before starting any threads that use the
+ * table. A table stays valid until SOLAR_TABLE_CACHE other latitudes have
+ * been asked for. Returns NULL if the table cannot be allocated, which
+ * solar_light takes as a request to call lightME. */
+const struct solar_table *solar_table_for(double lat)
+{
+	struct solar_table *table;
+	int i, doy, hr;
+
+	for (i = 0; i < SOLAR_TABLE_CACHE; i++)
+		if (solar_tables[i] != NULL && solar_tables[i]->lat == lat)
+			return solar_tables[i];
+
+	table = solar_tables[next_solar_table];
+	if (table == NULL) {
+		table = (struct solar_table*)malloc(sizeof(struct solar_table));
+		if (table == NULL) return NULL;
+		solar_tables[next_solar_table] = table;
+	}
+	next_solar_table = (next_solar_table + 1) % SOLAR_TABLE_CACHE;
+
+	table->lat = lat;
+	for (doy = 1; doy <= SOLAR_TABLE_DAYS; doy++)
+		for (hr = 0; hr < 24; hr++)
+			table->light[doy - 1][hr] = lightME(lat, doy, hr);
+	return table;
+}
+
+/* The same as lightME(lat, DOY, hr), from the table when it covers them. */
+struct Light_model solar_light(const struct solar_table *table, double lat, int DOY, int hr)
+{
+	if (table != NULL && table->lat == lat &&
+	    DOY >= 1 && DOY <= SOLAR_TABLE_DAYS && hr >= 0 && hr < 24)
+		return table->light[DOY - 1][hr];
+	return lightME(lat, DOY, hr);
+}
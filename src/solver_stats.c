@@ -0,0 +1,129 @@
+/*
+ *  BioCro/src/solver_stats.c
+ *
+ *  How many passes the leaf solvers take, how often they stop at their cap
+ *  without converging, and the inputs of the worst call. Recorded only
+ *  when the package is compiled with BIOCRO_SOLVER_STATS.
+ *
+ */
+
+#include <R.h>
+#include <Rinternals.h>
+#include <stdio.h>
+#include <string.h>
+#include "solver_stats.h"
+
+struct solver_stats solver_stats[SOLVER_COUNT];
+
+static const char *solver_names[SOLVER_COUNT] = {
+	"c4photo", "c4photoBracketed", "c3photo", "eC4photo", "EvapoTrans2", "c3EvapoTrans"
+};
+
+static const char *input_names[SOLVER_COUNT][SOLVER_STATS_INPUTS] = {
+	{"Qp", "Tl", "RH", "StomaWS", "vmax", "Ca"},
+	{"Qp", "Tl", "RH", "StomaWS", "vmax", "Ca"},
+	{"Qp", "Tleaf", "RH", "StomWS", "Vcmax", "Ca"},
+	{"Qp", "Temp", "RH", "Ca", "Vcmax", "Vpmax"},
+	{"Rad", "Iave", "Tair", "RH", "WindSpeed", "Gs"},
+	{"Rad", "Itot", "Tair", "RH", "WindSpeed", "Gs"}
+};
+
+void solver_stats_reset(void)
+{
+	memset(solver_stats, 0, sizeof(solver_stats));
+}
+
+void solver_stats_record(enum solver_id solver, int iterations, int converged, double change,
+			 const double inputs[])
+{
+	struct solver_stats *s = &solver_stats[solver];
+	int bin = iterations < SOLVER_STATS_MAX_ITERATIONS ? iterations : SOLVER_STATS_MAX_ITERATIONS;
+
+	if(change < 0) change = -change;
+	/* The threads of BioGroEnsemble record at the same time */
+	#pragma omp critical (solver_stats)
+	{
+		s->calls++;
+		s->histogram[bin]++;
+		if(!converged) s->not_converged++;
+		if(s->calls == 1 || iterations > s->worst_iterations ||
+		   (iterations == s->worst_iterations && change > s->worst_change)){
+			s->worst_iterations = iterations;
+			s->worst_change = change;
+			memcpy(s->worst_inputs, inputs, sizeof(s->worst_inputs));
+		}
+	}
+}
+
+static SEXP named_real(int n, const double values[], const char *names[])
+{
+	SEXP ans, ans_names;
+	int i;
+	PROTECT(ans = allocVector(REALSXP, n));
+	PROTECT(ans_names = allocVector(STRSXP, n));
+	for(i = 0; i < n; i++){
+		REAL(ans)[i] = values[i];
+		SET_STRING_ELT(ans_names, i, mkChar(names[i]));
+	}
+	setAttrib(ans, R_NamesSymbol, ans_names);
+	UNPROTECT(2);
+	return(ans);
+}
+
+/* Each solver gives list(calls, notConverged, histogram, worst). The
+ * histogram counts calls by passes, named by the number of passes, up to
+ * the most any call took; the last bin also holds calls with more than
+ * SOLVER_STATS_MAX_ITERATIONS. worst holds the passes and last change of
+ * the worst call and its inputs. */
+SEXP solver_stats_list(void)
+{
+	static const char *fields[4] = {"calls", "notConverged", "histogram", "worst"};
+	SEXP ans, ans_names, entry, entry_names, histogram, histogram_names;
+	int i, j, bins;
+	char label[16];
+
+	PROTECT(ans = allocVector(VECSXP, SOLVER_COUNT));
+	PROTECT(ans_names = allocVector(STRSXP, SOLVER_COUNT));
+	for(i = 0; i < SOLVER_COUNT; i++){
+		const struct solver_stats *s = &solver_stats[i];
+		const char *worst_names[SOLVER_STATS_INPUTS + 2];
+		double worst[SOLVER_STATS_INPUTS + 2];
+
+		PROTECT(entry = allocVector(VECSXP, 4));
+		PROTECT(entry_names = allocVector(STRSXP, 4));
+		for(j = 0; j < 4; j++) SET_STRING_ELT(entry_names, j, mkChar(fields[j]));
+		setAttrib(entry, R_NamesSymbol, entry_names);
+
+		SET_VECTOR_ELT(entry, 0, ScalarReal(s->calls));
+		SET_VECTOR_ELT(entry, 1, ScalarReal(s->not_converged));
+
+		for(bins = SOLVER_STATS_MAX_ITERATIONS + 1; bins > 0 && s->histogram[bins - 1] == 0; bins--);
+		PROTECT(histogram = allocVector(REALSXP, bins));
+		PROTECT(histogram_names = allocVector(STRSXP, bins));
+		for(j = 0; j < bins; j++){
+			REAL(histogram)[j] = s->histogram[j];
+			snprintf(label, sizeof(label), "%d", j);
+			SET_STRING_ELT(histogram_names, j, mkChar(label));
+		}
+		setAttrib(histogram, R_NamesSymbol, histogram_names);
+		SET_VECTOR_ELT(entry, 2, histogram);
+		UNPROTECT(2);
+
+		worst_names[0] = "iterations";
+		worst_names[1] = "change";
+		worst[0] = s->calls > 0 ? s->worst_iterations : NA_REAL;
+		worst[1] = s->calls > 0 ? s->worst_change : NA_REAL;
+		for(j = 0; j < SOLVER_STATS_INPUTS; j++){
+			worst_names[j + 2] = input_names[i][j];
+			worst[j + 2] = s->calls > 0 ? s->worst_inputs[j] : NA_REAL;
+		}
+		SET_VECTOR_ELT(entry, 3, named_real(SOLVER_STATS_INPUTS + 2, worst, worst_names));
+
+		SET_VECTOR_ELT(ans, i, entry);
+		SET_STRING_ELT(ans_names, i, mkChar(solver_names[i]));
+		UNPROTECT(2);
+	}
+	setAttrib(ans, R_NamesSymbol, ans_names);
+	UNPROTECT(2);
+	return(ans);
+}
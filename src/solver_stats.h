@@ -0,0 +1,62 @@
+#ifndef SOLVER_STATS_H
+#define SOLVER_STATS_H
+/*
+ *  BioCro/src/solver_stats.h
+ *
+ *  Counters of the iterations of the leaf solvers, compiled in when
+ *  BIOCRO_SOLVER_STATS is defined (see Makevars). Without it SOLVER_STATS
+ *  drops its statement and nothing is counted.
+ *
+ */
+
+#ifdef BIOCRO_SOLVER_STATS
+#define SOLVER_STATS(statement) statement
+#else
+#define SOLVER_STATS(statement)
+#endif
+
+enum solver_id {
+	SOLVER_C4PHOTO,           /* c4photoC, c4photoC_warm and c4photoC_batch */
+	SOLVER_C4PHOTO_BRACKETED, /* c4photoC_bracketed and its batch */
+	SOLVER_C3PHOTO,           /* c3photoC and c3photoC_warm */
+	SOLVER_EC4PHOTO,          /* eC4photoC, which has no iteration */
+	SOLVER_EVAPOTRANS2,       /* the leaf temperature of EvapoTrans2 */
+	SOLVER_C3EVAPOTRANS,      /* and of c3EvapoTrans */
+	SOLVER_COUNT
+};
+
+/* Calls that took more passes go in the last bin */
+#define SOLVER_STATS_MAX_ITERATIONS 100
+#define SOLVER_STATS_INPUTS 6
+
+struct solver_stats {
+	double calls;
+	double histogram[SOLVER_STATS_MAX_ITERATIONS + 1]; /* calls by passes */
+	double not_converged; /* calls that stopped at the cap of passes */
+	/* The call with the most passes, and of those with the largest change
+	 * on its last pass, with the inputs it was called with */
+	int worst_iterations;
+	double worst_change;
+	double worst_inputs[SOLVER_STATS_INPUTS];
+};
+
+/* Counters of every solver since the last reset. They are shared by the
+ * whole process; solver_stats_record updates them in a critical section,
+ * so the threads of BioGroEnsemble may record at the same time, but
+ * solver_stats_reset and solver_stats_list must be called on one thread. */
+extern struct solver_stats solver_stats[SOLVER_COUNT];
+
+void solver_stats_reset(void);
+/* A call of solver that took iterations passes and ended with change, the
+ * quantity the solver compares to its tolerance. inputs holds
+ * SOLVER_STATS_INPUTS values, see solver_stats_list for which. */
+void solver_stats_record(enum solver_id solver, int iterations, int converged, double change,
+			 const double inputs[]);
+
+#ifdef R_INTERNALS_H_
+/* The counters as a list with one element per solver, for the
+ * solverStats attribute. Unprotected. */
+SEXP solver_stats_list(void);
+#endif
+
+#endif